@@ -1,20 +1,128 @@
 // vim: set noet ts=4 sts=4 sw=4:
 #pragma once
 
-#include <vector>
-#include <ostream>
-#include <iomanip>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
+/*
+Scope profiler, safe to use from any number of threads.
+
+Every thread records begin/end events of its scopes into its own ring buffer,
+recording takes no locks and no shared writes (two timestamps and two stores per scope).
+When a ring buffer is full the oldest events are overwritten.
+Events can be printed as per-scope totals or exported in the Chrome trace event format
+(open in chrome://tracing or https://ui.perfetto.dev).
+*/
 namespace profiler {
 
-class single_profiler;
+// Call site of a profiled scope
+struct site {
+	const char *name;
+	const char *filename;
+	int line_number;
+};
+
+// Timestamps are in clock ticks: TSC where available, nanoseconds otherwise
+inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Single producer ring buffer, written by the owning thread only.
+// Fields are relaxed atomics so a reader never races with the writer,
+// the reader drops events that were overwritten while it was copying them.
+class thread_buffer {
+public:
+	static constexpr size_t capacity = 1 << 18;
+
+	struct event {
+		const site *where; // nullptr for the end of the innermost open scope
+		uint64_t time;
+	};
+
+	thread_buffer(uint32_t id) : _id(id), _events(new slot[capacity]) { }
+
+	void record(const site *where, uint64_t time) {
+		uint64_t head = _head.load(std::memory_order_relaxed);
+		slot &s = _events[head & (capacity - 1)];
+		s.where.store(where, std::memory_order_relaxed);
+		s.time.store(time, std::memory_order_relaxed);
+		_head.store(head + 1, std::memory_order_release);
+	}
+
+	// Returns the events still in the buffer, oldest first
+	std::vector<event> snapshot() const {
+		uint64_t head = _head.load(std::memory_order_acquire);
+		uint64_t first = head > capacity ? head - capacity : 0;
+		std::vector<event> events;
+		events.reserve(head - first);
+		for (uint64_t i = first; i < head; ++i) {
+			slot const &s = _events[i & (capacity - 1)];
+			events.push_back({s.where.load(std::memory_order_relaxed), s.time.load(std::memory_order_relaxed)});
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t newHead = _head.load(std::memory_order_relaxed);
+		uint64_t overwritten = newHead > capacity ? newHead - capacity : 0;
+		if (overwritten > first)
+			events.erase(events.begin(), events.begin() + std::min<uint64_t>(overwritten - first, events.size()));
+		return events;
+	}
+
+	uint32_t id() const { return _id; }
+	std::string name() const {
+		std::lock_guard lock(_nameMutex);
+		return _name;
+	}
+	void set_name(std::string name) {
+		std::lock_guard lock(_nameMutex);
+		_name = std::move(name);
+	}
+
+private:
+	struct slot {
+		std::atomic<const site *> where{nullptr};
+		std::atomic<uint64_t> time{0};
+	};
+	const uint32_t _id;
+	std::unique_ptr<slot[]> _events;
+	std::atomic<uint64_t> _head{0};
+	mutable std::mutex _nameMutex;
+	std::string _name;
+};
 
 class profiler {
-	std::vector<const single_profiler *> profs;
-	int indent;
-	profiler() { }
-	const std::string format_time(double v) const {
+	mutable std::mutex _mutex;
+	// Buffers outlive their threads, so events of finished threads can still be exported
+	std::vector<std::unique_ptr<thread_buffer>> _threads;
+	std::deque<site> _interned;
+	std::deque<std::string> _internedNames;
+	uint64_t _startTicks;
+	std::chrono::steady_clock::time_point _startTime;
+	static inline thread_local thread_buffer *t_buffer = nullptr;
+	static inline thread_local std::string t_pending_name;
+
+	profiler() : _startTicks(ticks()), _startTime(std::chrono::steady_clock::now()) { }
+
+	static const std::string format_time(double v) {
 		char buf[1024];
 		if (v < 1e-6)
 			snprintf(buf, 12, "%8.2lfns", 1e9 * v);
@@ -26,17 +134,115 @@ class profiler {
 			snprintf(buf, 12, "%8.2lfs ", v);
 		return std::string(buf);
 	}
+
+	// Converts ticks to seconds since the profiler start
+	struct timebase {
+		uint64_t start;
+		double secondsPerTick;
+		double seconds(uint64_t t) const { return t >= start ? double(t - start) * secondsPerTick : -double(start - t) * secondsPerTick; }
+	};
+	timebase calibrate() const {
+#if defined(__x86_64__) || defined(__i386__)
+		// TSC rate is measured against the steady clock over the profiler lifetime, at least 10 ms
+		auto minDuration = std::chrono::milliseconds(10);
+		while (std::chrono::steady_clock::now() - _startTime < minDuration)
+			std::this_thread::yield();
+		uint64_t endTicks = ticks();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _startTime).count();
+		return {_startTicks, seconds / double(endTicks - _startTicks)};
+#else
+		return {_startTicks, 1e-9};
+#endif
+	}
+
+	// Calls fn(buffer, where, begin, end) for every complete scope, scopes still open end at `now`.
+	// Ends without a matching begin (the begin was overwritten) are dropped.
+	template<typename Fn>
+	void for_each_scope(uint64_t now, Fn &&fn) const {
+		std::vector<thread_buffer *> threads;
+		{
+			std::lock_guard lock(_mutex);
+			for (auto &buffer : _threads)
+				threads.push_back(buffer.get());
+		}
+		for (thread_buffer *buffer : threads) {
+			std::vector<thread_buffer::event> stack;
+			for (thread_buffer::event const &e : buffer->snapshot()) {
+				if (e.where) {
+					stack.push_back(e);
+				} else if (!stack.empty()) {
+					fn(*buffer, *stack.back().where, stack.back().time, e.time, stack.size() - 1);
+					stack.pop_back();
+				}
+			}
+			while (!stack.empty()) {
+				fn(*buffer, *stack.back().where, stack.back().time, now, stack.size() - 1);
+				stack.pop_back();
+			}
+		}
+	}
+
+	static void write_json_string(std::ostream &o, const std::string &s) {
+		o << '"';
+		for (char c : s) {
+			if (c == '"' || c == '\\')
+				o << '\\' << c;
+			else if (static_cast<unsigned char>(c) < 0x20)
+				o << ' ';
+			else
+				o << c;
+		}
+		o << '"';
+	}
+
 public:
 	static profiler &getInstance() {
 		static profiler instance;
 		return instance;
 	}
-	void reg(const single_profiler *prof) {
-		profs.push_back(prof);
+
+	// Buffer of the calling thread, created on first use
+	thread_buffer &current_thread() {
+		if (!t_buffer) {
+			std::lock_guard lock(_mutex);
+			_threads.push_back(std::make_unique<thread_buffer>(static_cast<uint32_t>(_threads.size())));
+			t_buffer = _threads.back().get();
+			t_buffer->set_name(std::move(t_pending_name));
+		}
+		return *t_buffer;
+	}
+
+	static thread_buffer &this_thread() {
+		return t_buffer ? *t_buffer : getInstance().current_thread();
+	}
+
+	// Names the calling thread in exported traces.
+	// Threads which never record a scope don't get a buffer.
+	static void set_thread_name(std::string name) {
+		if (t_buffer)
+			t_buffer->set_name(std::move(name));
+		else
+			t_pending_name = std::move(name);
+	}
+
+	// Returns a call site with a name built at runtime, the site lives as long as the profiler.
+	// Takes a lock, meant for coarse scopes like jobs.
+	const site *intern(std::string name, const char *filename = "", int line_number = 0) {
+		std::lock_guard lock(_mutex);
+		_internedNames.push_back(std::move(name));
+		_interned.push_back({_internedNames.back().c_str(), filename, line_number});
+		return &_interned.back();
 	}
-	int enter() { return indent++; }
-	void leave() { indent--; }
+
 	std::ostream &print(std::ostream &o, int fnwidth) const;
+	// Writes all recorded events in the Chrome trace event format
+	std::ostream &write_chrome_trace(std::ostream &o) const;
+	bool write_chrome_trace(const char *fileName) const {
+		std::ofstream file(fileName);
+		write_chrome_trace(file);
+		return bool(file);
+	}
+
 	profiler(const profiler &) = delete;
 	profiler(profiler &&) = delete;
 	profiler &operator=(const profiler &) = delete;
@@ -46,74 +252,109 @@ inline const profiler &getInstance() {
 	return profiler::getInstance();
 }
 
-class single_profiler {
-	timespec startmark;
-	int _calls;
-	double tottime;
-	int depth;
-	int indent;
-	void start() {
-		clock_gettime(CLOCK_MONOTONIC_RAW, &startmark);
-	}
-	double stop() {
-		timespec stopmark;
-		clock_gettime(CLOCK_MONOTONIC_RAW, &stopmark);
-		int nsec = stopmark.tv_nsec - startmark.tv_nsec;
-		int sec = stopmark.tv_sec - startmark.tv_sec;
-		return sec + 1e-9 * nsec;
-	}
-	const std::string _filename;
-	const std::string _pretty_function;
-	const int _line_number;
+inline void set_thread_name(std::string name) {
+	profiler::set_thread_name(std::move(name));
+}
+
+// Records a scope on the calling thread
+class scope {
+	thread_buffer *_buffer;
 public:
-	single_profiler(const char *fn, const int line, const char *func)
-		: _calls(0), tottime(0), depth(0), _filename(fn)
-		, _pretty_function(func), _line_number(line)
-	{
-		profiler::getInstance().reg(this);
+	explicit scope(const site *where) : _buffer(&profiler::this_thread()) {
+		_buffer->record(where, ticks());
 	}
-	void enter() {
-		_calls++;
-		if (depth > 0)
-			tottime += stop(); // suspend
-		else
-			indent = profiler::getInstance().enter();
-		depth++;
-		start();
-	}
-	void leave() {
-		tottime += stop();
-		depth--;
-		if (depth > 0)
-			start(); // resume
-		else
-			profiler::getInstance().leave();
+	void stop() {
+		if (_buffer) {
+			_buffer->record(nullptr, ticks());
+			_buffer = nullptr;
+		}
 	}
-	const std::string &filename() const { return _filename; }
-	int line_number() const { return _line_number; }
-	const std::string function() const { return std::string(indent, ' ') + _pretty_function; }
-	int calls() const { return _calls; }
-	double total_time() const { return tottime; }
+	~scope() { stop(); }
+	scope(const scope &) = delete;
+	scope &operator=(const scope &) = delete;
 };
 
-template<typename T>
-void profile_gate(const char *fn, const int line, const char *func, bool enter, T *) {
-	static single_profiler prof(fn, line, func);
-	if (enter)
-		prof.enter();
-	else
-		prof.leave();
-}
-
 inline std::ostream &profiler::print(std::ostream &o, int fnwidth) const {
+	// Totals per call site, nested calls of the same site are counted but their time is not added twice
+	struct totals {
+		int indent = 0;
+		int calls = 0;
+		double tottime = 0;
+		uint64_t first = UINT64_MAX;
+	};
+	timebase tb = calibrate();
+	std::map<const site *, totals> sites;
+	std::map<std::pair<const thread_buffer *, const site *>, std::vector<std::pair<uint64_t, uint64_t>>> intervals;
+	for_each_scope(ticks(), [&](thread_buffer const &buffer, site const &where, uint64_t begin, uint64_t end, size_t depth) {
+		totals &t = sites[&where];
+		if (begin < t.first) {
+			t.first = begin;
+			t.indent = int(depth);
+		}
+		t.calls++;
+		intervals[{&buffer, &where}].push_back({begin, end});
+	});
+	for (auto &[key, list] : intervals) {
+		// Inner scopes are reported first, keep only intervals not contained in another one
+		std::sort(list.begin(), list.end(), [](auto const &a, auto const &b) { return a.first < b.first || (a.first == b.first && a.second > b.second); });
+		uint64_t coveredUntil = 0;
+		for (auto [begin, end] : list) {
+			if (end <= coveredUntil)
+				continue;
+			sites[key.second].tottime += double(end - begin) * tb.secondsPerTick;
+			coveredUntil = std::max(coveredUntil, end);
+		}
+	}
+	std::vector<std::pair<const site *, totals>> ordered(sites.begin(), sites.end());
+	std::sort(ordered.begin(), ordered.end(), [](auto const &a, auto const &b) { return a.second.first < b.second.first; });
+
 	o << "\n" << std::left << std::setw(fnwidth) << "function";
 	o << "line	calls	   tottime	avgtime\n\n";
-	for (const single_profiler *p : profs) {
-		o << std::left << std::setfill('.') << std::setw(fnwidth) << p->function() << std::setfill(' ')
-			<< " " << std::setw(8) << p->line_number()
-			<< " " << std::setw(8) << p->calls() << " "
-			<< format_time(p->total_time()) << " " << format_time(p->total_time() / p->calls()) << "\n";
+	for (auto const &[p, t] : ordered) {
+		o << std::left << std::setfill('.') << std::setw(fnwidth) << (std::string(t.indent, ' ') + p->name) << std::setfill(' ')
+			<< " " << std::setw(8) << p->line_number
+			<< " " << std::setw(8) << t.calls << " "
+			<< format_time(t.tottime) << " " << format_time(t.tottime / t.calls) << "\n";
+	}
+	return o;
+}
+
+inline std::ostream &profiler::write_chrome_trace(std::ostream &o) const {
+	timebase tb = calibrate();
+	o << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	auto separator = [&] {
+		if (!first)
+			o << ",\n";
+		first = false;
+	};
+	{
+		std::lock_guard lock(_mutex);
+		for (auto const &buffer : _threads) {
+			separator();
+			o << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id() << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+			write_json_string(o, buffer->name().empty() ? "thread " + std::to_string(buffer->id()) : buffer->name());
+			o << "}}";
+		}
 	}
+	auto precision = o.precision(3);
+	auto flags = o.setf(std::ios::fixed, std::ios::floatfield);
+	// Complete events, timestamps in microseconds
+	for_each_scope(ticks(), [&](thread_buffer const &buffer, site const &where, uint64_t begin, uint64_t end, size_t) {
+		separator();
+		o << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.id() << ",\"name\":";
+		write_json_string(o, where.name);
+		o << ",\"ts\":" << tb.seconds(begin) * 1e6 << ",\"dur\":" << double(end - begin) * tb.secondsPerTick * 1e6;
+		if (where.line_number > 0) {
+			o << ",\"args\":{\"file\":";
+			write_json_string(o, where.filename);
+			o << ",\"line\":" << where.line_number << "}";
+		}
+		o << "}";
+	});
+	o.precision(precision);
+	o.flags(flags);
+	o << "]}\n";
 	return o;
 }
 
@@ -124,20 +365,8 @@ inline std::ostream &operator<<(std::ostream &o, const profiler &prof) {
 }
 
 #define PROFILE_ME_AS(name) \
-	struct __prof_data { bool early_exit; \
-		__prof_data(const char *fn, const int line, const char *func) { \
-			early_exit = false; \
-			profiler::profile_gate(fn, line, func, true, this); \
-		} \
-		void stop() { \
-			early_exit = true; \
-			profiler::profile_gate(nullptr, -1, nullptr, false, this); \
-		} \
-		~__prof_data() { \
-			if (!early_exit) \
-				stop(); \
-		} \
-	} __helper_var(__FILE__, __LINE__, name)
+	static const ::profiler::site __prof_site{name, __FILE__, __LINE__}; \
+	::profiler::scope __helper_var(&__prof_site)
 #define PROFILE_ME PROFILE_ME_AS(__PRETTY_FUNCTION__)
 #define PROFILE_END \
 	__helper_var.stop()
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// 64-bit FNV-1a hash, incremental
+class ContentHash {
+public:
+    void update(const void* data, size_t size) {
+        auto bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            m_hash = (m_hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+    }
+
+    void update(const std::string& str) {
+        update(str.data(), str.size());
+        update(uint64_t(str.size()));  // separator, so "ab" + "c" != "a" + "bc"
+    }
+
+    void update(uint64_t value) {
+        update(&value, sizeof(value));
+    }
+
+    uint64_t get() const { return m_hash; }
+
+private:
+    uint64_t m_hash = 0xcbf29ce484222325ull;
+};
+
+/*
+Persistent cache of baked assets.
+
+An asset is up to date when the hash of its inputs (source files, asset YAML, baker version)
+equals the hash recorded after the last successful bake and all recorded outputs still exist.
+Source file hashes are remembered along with file size and modification time,
+so unchanged files are not read again and a no-op run doesn't touch the big source images.
+*/
+class AssetCache {
+public:
+    explicit AssetCache(std::filesystem::path cacheFile): m_cacheFile(std::move(cacheFile)) {
+        load();
+    }
+
+    // Hash of a source file content, reusing the stored one if size and modification time didn't change
+    uint64_t hashFile(const std::filesystem::path& path) {
+        uint64_t size = std::filesystem::file_size(path);
+        uint64_t mtime = std::filesystem::last_write_time(path).time_since_epoch().count();
+        auto it = m_files.find(path.string());
+        if (it != m_files.end() && it->second.size == size && it->second.mtime == mtime) {
+            return it->second.hash;
+        }
+
+        ContentHash hash;
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to open file " + path.string());
+        }
+        std::vector<char> buffer(1 << 20);
+        while (file) {
+            file.read(buffer.data(), buffer.size());
+            hash.update(buffer.data(), file.gcount());
+        }
+        hash.update(size);
+
+        m_files[path.string()] = {size, mtime, hash.get()};
+        m_dirty = true;
+        return hash.get();
+    }
+
+    bool isUpToDate(const std::string& assetName, uint64_t key) const {
+        auto it = m_assets.find(assetName);
+        if (it == m_assets.end() || it->second.key != key) {
+            return false;
+        }
+        for (auto const& output : it->second.outputs) {
+            if (!std::filesystem::exists(output)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void store(const std::string& assetName, uint64_t key, std::vector<std::filesystem::path> const& outputs) {
+        m_assets[assetName] = {key, outputs};
+        m_dirty = true;
+    }
+
+    int save() {
+        if (!m_dirty) return 0;
+
+        std::ofstream ofs(m_cacheFile);
+        if (!ofs) {
+            std::cerr << "Error: Could not open file for writing: " << m_cacheFile << std::endl;
+            return -1;
+        }
+        ofs << std::hex;
+        ofs << "version " << FORMAT_VERSION << std::endl;
+        for (auto const& [path, file] : m_files) {
+            ofs << "file " << std::quoted(path) << " " << file.size << " " << file.mtime << " " << file.hash << std::endl;
+        }
+        for (auto const& [name, asset] : m_assets) {
+            ofs << "asset " << std::quoted(name) << " " << asset.key << " " << asset.outputs.size();
+            for (auto const& output : asset.outputs) {
+                ofs << " " << std::quoted(output.string());
+            }
+            ofs << std::endl;
+        }
+        m_dirty = false;
+        return 0;
+    }
+
+private:
+    static constexpr int FORMAT_VERSION = 1;
+
+    struct FileEntry {
+        uint64_t size;
+        uint64_t mtime;
+        uint64_t hash;
+    };
+
+    struct AssetEntry {
+        uint64_t key;
+        std::vector<std::filesystem::path> outputs;
+    };
+
+    // Missing or unreadable cache simply means that everything is rebuilt
+    void load() {
+        std::ifstream ifs(m_cacheFile);
+        if (!ifs) return;
+
+        std::string line;
+        std::string header;
+        int version = 0;
+        std::getline(ifs, line);
+        std::istringstream(line) >> header >> std::hex >> version;
+        if (header != "version" || version != FORMAT_VERSION) {
+            return;
+        }
+        while (std::getline(ifs, line)) {
+            std::istringstream iss(line);
+            iss >> std::hex;
+            std::string kind, name;
+            iss >> kind >> std::quoted(name);
+            if (kind == "file") {
+                FileEntry entry{};
+                if (iss >> entry.size >> entry.mtime >> entry.hash) {
+                    m_files[name] = entry;
+                }
+            } else if (kind == "asset") {
+                AssetEntry entry{};
+                size_t outputCount = 0;
+                iss >> entry.key >> outputCount;
+                for (size_t i = 0; i < outputCount && iss; ++i) {
+                    std::string output;
+                    iss >> std::quoted(output);
+                    entry.outputs.emplace_back(output);
+                }
+                if (iss) {
+                    m_assets[name] = std::move(entry);
+                }
+            }
+        }
+    }
+
+    std::filesystem::path m_cacheFile;
+    std::map<std::string, FileEntry> m_files;
+    std::map<std::string, AssetEntry> m_assets;
+    bool m_dirty = false;
+};
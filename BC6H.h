@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include "TextureFormats.h"
+
+/*
+BC6H (unsigned) block compression of HDR images.
+
+The encoder uses the single region modes (11 to 14). Endpoints come from the principal axis of the block colors
+and are refined with least squares fits of the selected indices. Modes 12 to 14 trade the endpoint range
+for precision, which suits the smooth blocks that dominate prefiltered environment maps.
+Work is done in the integer half float domain the format interpolates in.
+
+The decoder handles the same modes, it's used when a device can't sample BC6H textures.
+*/
+
+namespace bc6h {
+
+constexpr int WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+struct Mode {
+    uint32_t id;       // 5 mode bits
+    int endpointBits;  // precision of endpoint 0
+    int deltaBits;     // precision of endpoint 1 (a signed delta for transformed modes)
+    bool transformed;
+};
+
+constexpr Mode MODES[] = {
+    {0x03, 10, 10, false},
+    {0x07, 11, 9, true},
+    {0x0B, 12, 8, true},
+    {0x0F, 16, 4, true},
+};
+
+// Endpoint component to the 16-bit interpolation domain
+int unquantize(int comp, int bits) {
+    if (bits >= 15) return comp;
+    if (comp == 0) return 0;
+    if (comp == (1 << bits) - 1) return 0xFFFF;
+    return ((comp << 16) + 0x8000) >> bits;
+}
+
+// Interpolated value to half float bits
+int finishUnquantize(int value) {
+    return (value * 31) >> 6;
+}
+
+int interpolate(int e0, int e1, int index) {
+    return (e0 * (64 - WEIGHTS[index]) + e1 * WEIGHTS[index] + 32) >> 6;
+}
+
+// Nearest endpoint component for a value of the interpolation domain
+int quantize(float value, int bits) {
+    int maxComp = (1 << bits) - 1;
+    if (bits >= 15) return std::clamp(int(std::lround(value)), 0, maxComp);
+    int guess = std::clamp(int(value / float(1 << (16 - bits))), 0, maxComp);
+    int best = guess;
+    float bestError = std::numeric_limits<float>::max();
+    for (int comp = std::max(guess - 1, 0); comp <= std::min(guess + 1, maxComp); ++comp) {
+        float error = std::abs(float(unquantize(comp, bits)) - value);
+        if (error < bestError) {
+            bestError = error;
+            best = comp;
+        }
+    }
+    return best;
+}
+
+struct BitWriter {
+    uint8_t* data;
+    int position = 0;
+
+    void write(uint32_t value, int count) {
+        for (int i = 0; i < count; ++i, ++position) {
+            if ((value >> i) & 1) data[position >> 3] |= uint8_t(1 << (position & 7));
+        }
+    }
+};
+
+struct BitReader {
+    const uint8_t* data;
+    int position = 0;
+
+    uint32_t read(int count) {
+        uint32_t value = 0;
+        for (int i = 0; i < count; ++i, ++position) {
+            value |= uint32_t((data[position >> 3] >> (position & 7)) & 1) << i;
+        }
+        return value;
+    }
+};
+
+// Quantized endpoints and indices of a block in a particular mode
+struct BlockCandidate {
+    Mode mode;
+    int endpoints[2][3];  // quantized
+    uint8_t indices[16];
+    int64_t error = std::numeric_limits<int64_t>::max();
+};
+
+// Texels in half float bits, unsigned, at most 0x7BFF
+struct BlockTexels {
+    int half[16][3];
+    float target[16][3];  // same in the interpolation domain (before finishUnquantize)
+};
+
+// Chooses indices for the quantized endpoints and computes the error
+void assignIndices(BlockTexels const& texels, BlockCandidate& candidate) {
+    int palette[16][3];
+    for (int c = 0; c < 3; ++c) {
+        int e0 = unquantize(candidate.endpoints[0][c], candidate.mode.endpointBits);
+        int e1 = unquantize(candidate.endpoints[1][c], candidate.mode.endpointBits);
+        for (int i = 0; i < 16; ++i) {
+            palette[i][c] = finishUnquantize(interpolate(e0, e1, i));
+        }
+    }
+    candidate.error = 0;
+    for (int t = 0; t < 16; ++t) {
+        int64_t bestError = std::numeric_limits<int64_t>::max();
+        for (int i = 0; i < 16; ++i) {
+            int64_t error = 0;
+            for (int c = 0; c < 3; ++c) {
+                int64_t d = palette[i][c] - texels.half[t][c];
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                candidate.indices[t] = uint8_t(i);
+            }
+        }
+        candidate.error += bestError;
+    }
+}
+
+// Quantizes endpoints (interpolation domain) for the mode of the candidate and assigns indices.
+// Transformed modes store endpoint 1 as a delta, it's clamped to the symmetric range so endpoints can be swapped later.
+void fitEndpoints(BlockTexels const& texels, const float a[3], const float b[3], BlockCandidate& candidate) {
+    Mode mode = candidate.mode;
+    int maxComp = (1 << mode.endpointBits) - 1;
+    for (int c = 0; c < 3; ++c) {
+        int e0 = quantize(a[c], mode.endpointBits);
+        int e1 = quantize(b[c], mode.endpointBits);
+        if (mode.transformed) {
+            int maxDelta = (1 << (mode.deltaBits - 1)) - 1;
+            e1 = std::clamp(e0 + std::clamp(e1 - e0, -maxDelta, maxDelta), 0, maxComp);
+        }
+        candidate.endpoints[0][c] = e0;
+        candidate.endpoints[1][c] = e1;
+    }
+    assignIndices(texels, candidate);
+}
+
+// Least squares endpoints for the current indices, in the interpolation domain
+bool refitEndpoints(BlockTexels const& texels, BlockCandidate const& candidate, float a[3], float b[3]) {
+    float ww = 0, wv = 0, vv = 0;
+    float wt[3] = {}, vt[3] = {};
+    for (int t = 0; t < 16; ++t) {
+        float w = WEIGHTS[candidate.indices[t]] / 64.0f;
+        float v = 1.0f - w;
+        ww += w * w;
+        wv += w * v;
+        vv += v * v;
+        for (int c = 0; c < 3; ++c) {
+            vt[c] += v * texels.target[t][c];
+            wt[c] += w * texels.target[t][c];
+        }
+    }
+    float det = vv * ww - wv * wv;
+    if (std::abs(det) < 1e-6f) return false;
+    for (int c = 0; c < 3; ++c) {
+        a[c] = std::clamp((ww * vt[c] - wv * wt[c]) / det, 0.0f, 65535.0f);
+        b[c] = std::clamp((vv * wt[c] - wv * vt[c]) / det, 0.0f, 65535.0f);
+    }
+    return true;
+}
+
+// Endpoints spanning the block colors along their principal axis
+void principalAxisEndpoints(BlockTexels const& texels, float a[3], float b[3]) {
+    float mean[3] = {};
+    for (int t = 0; t < 16; ++t) {
+        for (int c = 0; c < 3; ++c) mean[c] += texels.target[t][c] / 16.0f;
+    }
+    float cov[6] = {};  // xx, xy, xz, yy, yz, zz
+    for (int t = 0; t < 16; ++t) {
+        float d[3] = {texels.target[t][0] - mean[0], texels.target[t][1] - mean[1], texels.target[t][2] - mean[2]};
+        cov[0] += d[0] * d[0];
+        cov[1] += d[0] * d[1];
+        cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1];
+        cov[4] += d[1] * d[2];
+        cov[5] += d[2] * d[2];
+    }
+    // Power iteration
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        float next[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2],
+        };
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-12f) break;
+        for (int c = 0; c < 3; ++c) axis[c] = next[c] / length;
+    }
+    float minProjection = std::numeric_limits<float>::max();
+    float maxProjection = std::numeric_limits<float>::lowest();
+    for (int t = 0; t < 16; ++t) {
+        float projection = 0;
+        for (int c = 0; c < 3; ++c) projection += (texels.target[t][c] - mean[c]) * axis[c];
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+    for (int c = 0; c < 3; ++c) {
+        a[c] = std::clamp(mean[c] + axis[c] * minProjection, 0.0f, 65535.0f);
+        b[c] = std::clamp(mean[c] + axis[c] * maxProjection, 0.0f, 65535.0f);
+    }
+}
+
+// Tries moving every quantized endpoint component by one step
+void searchEndpoints(BlockTexels const& texels, BlockCandidate& candidate) {
+    int maxComp = (1 << candidate.mode.endpointBits) - 1;
+    int maxDelta = (1 << (candidate.mode.deltaBits - 1)) - 1;
+    for (int e = 0; e < 2; ++e) {
+        for (int c = 0; c < 3; ++c) {
+            for (int step : {-1, 1}) {
+                BlockCandidate trial = candidate;
+                int& comp = trial.endpoints[e][c];
+                comp += step;
+                if (comp < 0 || comp > maxComp) continue;
+                if (candidate.mode.transformed && std::abs(trial.endpoints[1][c] - trial.endpoints[0][c]) > maxDelta) continue;
+                assignIndices(texels, trial);
+                if (trial.error < candidate.error) candidate = trial;
+            }
+        }
+    }
+}
+
+void writeBlock(BlockCandidate candidate, uint8_t* block) {
+    Mode mode = candidate.mode;
+    // Anchor texel 0 has an implicit zero index MSB
+    if (candidate.indices[0] >= 8) {
+        for (int c = 0; c < 3; ++c) std::swap(candidate.endpoints[0][c], candidate.endpoints[1][c]);
+        for (uint8_t& index : candidate.indices) index = uint8_t(15 - index);
+    }
+
+    std::memset(block, 0, 16);
+    BitWriter writer{block};
+    writer.write(mode.id, 5);
+    for (int c = 0; c < 3; ++c) {
+        writer.write(uint32_t(candidate.endpoints[0][c]) & 0x3FF, 10);
+    }
+    for (int c = 0; c < 3; ++c) {
+        int e0 = candidate.endpoints[0][c];
+        int e1 = candidate.endpoints[1][c];
+        uint32_t second = mode.transformed ? uint32_t(e1 - e0) : uint32_t(e1);
+        writer.write(second & ((1u << mode.deltaBits) - 1), mode.deltaBits);
+        // High bits of endpoint 0 follow in descending order
+        for (int bit = mode.endpointBits - 1; bit >= 10; --bit) {
+            writer.write((uint32_t(e0) >> bit) & 1, 1);
+        }
+    }
+    writer.write(candidate.indices[0], 3);
+    for (int t = 1; t < 16; ++t) {
+        writer.write(candidate.indices[t], 4);
+    }
+}
+
+} // namespace bc6h
+
+// Encodes a 4x4 block of RGB texels (negative values are clamped to 0) into 16 bytes
+void encodeBC6HBlock(const float rgb[16][3], BC6HQuality quality, uint8_t* block) {
+    using namespace bc6h;
+    BlockTexels texels;
+    for (int t = 0; t < 16; ++t) {
+        for (int c = 0; c < 3; ++c) {
+            texels.half[t][c] = std::min<int>(floatToHalf(std::max(rgb[t][c], 0.0f)) & 0x7FFF, 0x7BFF);
+            texels.target[t][c] = texels.half[t][c] * (64.0f / 31.0f);
+        }
+    }
+
+    float a[3], b[3];
+    principalAxisEndpoints(texels, a, b);
+
+    int modeCount = quality == BC6HQuality::Fast ? 1 : 4;
+    int refinements = quality == BC6HQuality::Fast ? 0 : quality == BC6HQuality::Normal ? 2 : 4;
+    BlockCandidate best;
+    best.mode = MODES[0];
+    for (int m = 0; m < modeCount; ++m) {
+        BlockCandidate candidate;
+        candidate.mode = MODES[m];
+        fitEndpoints(texels, a, b, candidate);
+        for (int iteration = 0; iteration < refinements && candidate.error > 0; ++iteration) {
+            float ra[3], rb[3];
+            if (!refitEndpoints(texels, candidate, ra, rb)) break;
+            BlockCandidate refined = candidate;
+            fitEndpoints(texels, ra, rb, refined);
+            if (refined.error >= candidate.error) break;
+            candidate = refined;
+        }
+        if (quality == BC6HQuality::High) {
+            searchEndpoints(texels, candidate);
+        }
+        if (candidate.error < best.error) best = candidate;
+    }
+    writeBlock(best, block);
+}
+
+// Decodes a block written by encodeBC6HBlock into half float RGB texels.
+// Returns false for modes other than the single region ones.
+bool decodeBC6HBlock(const uint8_t* block, uint16_t rgb[16][3]) {
+    using namespace bc6h;
+    BitReader reader{block};
+    uint32_t modeId = reader.read(2);
+    if (modeId & 2) modeId |= reader.read(3) << 2;
+    const Mode* mode = nullptr;
+    for (Mode const& m : MODES) {
+        if (m.id == modeId) mode = &m;
+    }
+    if (!mode) return false;
+
+    int endpoints[2][3];
+    for (int c = 0; c < 3; ++c) endpoints[0][c] = int(reader.read(10));
+    for (int c = 0; c < 3; ++c) {
+        int second = int(reader.read(mode->deltaBits));
+        for (int bit = mode->endpointBits - 1; bit >= 10; --bit) {
+            endpoints[0][c] |= int(reader.read(1)) << bit;
+        }
+        if (mode->transformed) {
+            int sign = 1 << (mode->deltaBits - 1);
+            int delta = (second ^ sign) - sign;  // sign extension
+            second = (endpoints[0][c] + delta) & ((1 << mode->endpointBits) - 1);
+        }
+        endpoints[1][c] = second;
+    }
+    for (int t = 0; t < 16; ++t) {
+        int index = int(reader.read(t == 0 ? 3 : 4));
+        for (int c = 0; c < 3; ++c) {
+            int e0 = unquantize(endpoints[0][c], mode->endpointBits);
+            int e1 = unquantize(endpoints[1][c], mode->endpointBits);
+            rgb[t][c] = uint16_t(finishUnquantize(interpolate(e0, e1, index)));
+        }
+    }
+    return true;
+}
+
+// Decodes to RGBA16F with alpha 1, returns false if the image uses an unsupported mode
+bool decodeBC6HImage(const uint8_t* src, int width, int height, uint16_t* rgba) {
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    uint16_t rgb[16][3];
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            if (!decodeBC6HBlock(src + (size_t(by) * blocksX + bx) * 16, rgb)) return false;
+            for (int t = 0; t < 16; ++t) {
+                int x = bx * 4 + t % 4;
+                int y = by * 4 + t / 4;
+                if (x >= width || y >= height) continue;
+                uint16_t* texel = rgba + (size_t(y) * width + x) * 4;
+                texel[0] = rgb[t][0];
+                texel[1] = rgb[t][1];
+                texel[2] = rgb[t][2];
+                texel[3] = 0x3C00;  // 1.0
+            }
+        }
+    }
+    return true;
+}
@@ -7,20 +7,49 @@
 #include <iostream>
 #include <ktx.h>
 #include <vulkan/vulkan.h>
+#include "ThreadPool.h"
+#include "TextureFormats.h"
 
 // Hammersley sequence generation for quasi-random sampling
-float radicalInverse_VdC(uint32_t bits) {
+// Non-zero scramble applies random digit scrambling (XOR of the reversed bits)
+float radicalInverse_VdC(uint32_t bits, uint32_t scramble = 0) {
     bits = (bits << 16u) | (bits >> 16u);
     bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
     bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
     bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
     bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    bits ^= scramble;
     return float(bits) * 2.3283064365386963e-10; // = 1 / 0x100000000
 }
 
+// Turns a user seed into well distributed scramble bits (PCG hash)
+uint32_t hashSeed(uint32_t seed) {
+    if (seed == 0) return 0;
+    uint32_t state = seed * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
 // Returns Hammersley point for index i out of numSamples
-std::pair<float, float> hammersley(uint32_t i, uint32_t numSamples) {
-    return { float(i) / float(numSamples), radicalInverse_VdC(i) };
+// The point set is deterministic and stateless, so it can be evaluated from any thread.
+// Scramble 0 gives the classic Hammersley set,
+// other values give a different point set with the same stratification.
+std::pair<float, float> hammersley(uint32_t i, uint32_t numSamples, uint32_t scramble = 0) {
+    float u = float(i) / float(numSamples) + float(scramble & 0xFFFFu) / 65536.0f; // Cranley-Patterson rotation
+    return { u - std::floor(u), radicalInverse_VdC(i, scramble) };
+}
+
+// Returns point i of the (0, 2)-sequence formed by the first two Sobol dimensions.
+// Unlike Hammersley the set doesn't depend on the total count: every prefix of 2^k points is stratified,
+// so the number of samples can grow progressively. Scrambling is a digital shift, it keeps the stratification.
+std::pair<float, float> sobol02(uint32_t i, uint32_t scramble = 0) {
+    float u = radicalInverse_VdC(i, scramble);
+    uint32_t bits = 0;
+    for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+        if (i & 1) bits ^= v;
+    }
+    bits ^= hashSeed(scramble);
+    return { u, float(bits) * 2.3283064365386963e-10f };
 }
 
 // GGX/Trowbridge-Reitz importance sampling
@@ -57,6 +86,7 @@ float geometrySmith(float NdotV, float NdotL, float roughness) {
 }
 
 // Calculate the BRDF scale and bias for a specific roughness and NdotV
+// Scalar reference implementation, ProcessAssetsBench compares the vectorized LUT against it
 std::pair<float, float> integrateBRDF(float NdotV, float roughness, uint32_t numSamples) {
     // View vector (in tangent space)
     float Vx = std::sqrt(1.0f - NdotV * NdotV); // sin
@@ -109,9 +139,85 @@ std::pair<float, float> integrateBRDF(float NdotV, float roughness, uint32_t num
     return {A, B};
 }
 
+// GGX half vectors of a Hammersley set for a single roughness, in tangent space (N = +Z), stored as arrays for vectorization.
+// View vectors of the LUT lie in the XZ plane, so the Y components are not needed.
+struct GGXHalfVectors {
+    std::vector<float> x;
+    std::vector<float> z;
+};
+
+GGXHalfVectors generateGGXHalfVectors(std::vector<std::pair<float, float>> const& points, float roughness) {
+    GGXHalfVectors halfVectors;
+    halfVectors.x.resize(points.size());
+    halfVectors.z.resize(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        auto [Hx, Hy, Hz] = importanceSampleGGX(points[i].first, points[i].second, roughness);
+        halfVectors.x[i] = Hx;
+        halfVectors.z[i] = Hz;
+    }
+    return halfVectors;
+}
+
+// Same as integrateBRDF above, with precomputed half vectors.
+// The loop has no transcendental functions and no branches, samples are accumulated in independent lanes
+// so the compiler can vectorize it.
+std::pair<float, float> integrateBRDF(float NdotV, float roughness, GGXHalfVectors const& halfVectors) {
+    constexpr int LANES = 8;
+    const float Vx = std::sqrt(1.0f - NdotV * NdotV);
+    const float Vz = NdotV;
+    const float k = (roughness * roughness) / 8.0f;
+    const float geometryV = geometrySchlickGGX(NdotV, roughness);
+    const float* Hx = halfVectors.x.data();
+    const float* Hz = halfVectors.z.data();
+    const size_t numSamples = halfVectors.x.size();
+
+    auto accumulate = [&](size_t i, float& A, float& B) {
+        float VdotH = Vx * Hx[i] + Vz * Hz[i];
+        float NdotL = 2.0f * VdotH * Hz[i] - Vz;
+        float geometryL = NdotL / (NdotL * (1.0f - k) + k);
+        float G_vis = geometryV * geometryL * VdotH / (Hz[i] * NdotV);
+        G_vis = NdotL > 0.0f ? G_vis : 0.0f;
+        float m = 1.0f - VdotH;
+        float Fc = m * m * m * m * m;
+        A += (1.0f - Fc) * G_vis;
+        B += Fc * G_vis;
+    };
+
+    float A[LANES] = {};
+    float B[LANES] = {};
+    size_t i = 0;
+    for (; i + LANES <= numSamples; i += LANES) {
+        for (int lane = 0; lane < LANES; ++lane) {
+            accumulate(i + lane, A[lane], B[lane]);
+        }
+    }
+    for (; i < numSamples; ++i) {
+        accumulate(i, A[0], B[0]);
+    }
+    for (int width = LANES / 2; width > 0; width /= 2) {
+        for (int lane = 0; lane < width; ++lane) {
+            A[lane] += A[lane + width];
+            B[lane] += B[lane + width];
+        }
+    }
+    return {A[0] / float(numSamples), B[0] / float(numSamples)};
+}
+
+// NdotV of a LUT column
+float dfgLutNdotV(uint32_t x, uint32_t size) {
+    float NdotV = float(x) / float(size - 1);
+
+    // Use quadratic scale to increase sample count at grazing angles.
+    NdotV *= NdotV;
+
+    // Clamp NdotV to avoid singularity
+    return std::max(NdotV, 0.001f);
+}
+
 /**
  * Generates a DFG Lookup Table (LUT) for PBR rendering.
  * 
+ * @param threadPool Rows of the LUT are computed in parallel
  * @param size Size of the LUT texture
  * @param numSamples Number of Monte Carlo samples per texel
  * @return Vector of floats containing the LUT data
@@ -120,44 +226,60 @@ std::pair<float, float> integrateBRDF(float NdotV, float roughness, uint32_t num
  * Values are stored as [r,g,r,g,...] where r=scale, g=bias
  */
 std::vector<float> generateDFGLookupTable(
+    ThreadPool& threadPool,
     uint32_t size, 
     uint32_t numSamples
 ) {
+    PROFILE_ME_AS("generateDFGLookupTable");
     std::vector<float> lutData(size * size * 2);
-    
-    // Generate LUT data
-    #pragma omp parallel for collapse(2)
-    for (uint32_t y = 0; y < size; ++y) {
-        for (uint32_t x = 0; x < size; ++x) {
-            // Convert texture coordinates to roughness and NdotV
-            float roughness = float(y) / float(size - 1);
-            float NdotV = float(x) / float(size - 1);
 
-            // Use quadratic scale to increase sample count at grazing angles.
-            NdotV *= NdotV;
+    // All texels share the sample points, half vectors are shared by a row (same roughness)
+    std::vector<std::pair<float, float>> points(numSamples);
+    for (uint32_t i = 0; i < numSamples; ++i) {
+        points[i] = hammersley(i, numSamples);
+    }
 
-            // Clamp NdotV to avoid singularity
-            NdotV = std::max(NdotV, 0.001f);
-            
+    // Generate LUT data
+    threadPool.parallelFor(size, [&](size_t y) {
+        float roughness = float(y) / float(size - 1);
+        GGXHalfVectors halfVectors = generateGGXHalfVectors(points, roughness);
+        for (uint32_t x = 0; x < size; ++x) {
             // Calculate BRDF terms
-            auto [scale, bias] = integrateBRDF(NdotV, roughness, numSamples);
+            auto [scale, bias] = integrateBRDF(dfgLutNdotV(x, size), roughness, halfVectors);
 
             // Store in the output array
             size_t index = (y * size + x) * 2;
             lutData[index + 0] = scale; // R = scale
             lutData[index + 1] = bias;  // G = bias
         }
-    }
+    });
     
     return lutData;
 }
 
-int generate2DLookupTableToFile(std::vector<float> lutData, uint32_t size, const char* fileName) {
+// Same LUT with the scalar integrateBRDF, as a reference for generateDFGLookupTable
+std::vector<float> generateDFGLookupTableReference(ThreadPool& threadPool, uint32_t size, uint32_t numSamples) {
+    std::vector<float> lutData(size * size * 2);
+    threadPool.parallelFor(size, [&](size_t y) {
+        float roughness = float(y) / float(size - 1);
+        for (uint32_t x = 0; x < size; ++x) {
+            auto [scale, bias] = integrateBRDF(dfgLutNdotV(x, size), roughness, numSamples);
+            size_t index = (y * size + x) * 2;
+            lutData[index + 0] = scale;
+            lutData[index + 1] = bias;
+        }
+    });
+    return lutData;
+}
+
+// lutData contains RG texels, they are converted to the requested format
+int generate2DLookupTableToFile(std::vector<float> lutData, uint32_t size, const char* fileName, TextureEncoding const& encoding = {TextureFormat::RG32F}) {
+    TextureFormat format = encoding.format;
     ktxTexture2* texture;
     KTX_error_code result;
     
     ktxTextureCreateInfo createInfo = {
-        .vkFormat = VK_FORMAT_R32G32_SFLOAT,
+        .vkFormat = static_cast<ktx_uint32_t>(textureFormatToVkFormat(format)),
         .baseWidth = size,
         .baseHeight = size,
         .baseDepth = 1,
@@ -178,6 +300,10 @@ int generate2DLookupTableToFile(std::vector<float> lutData, uint32_t size, const
         return -1;
     }
     
+    size_t texelCount = size_t(size) * size;
+    std::vector<ktx_uint8_t> imageData(textureFormatImageSize(format, size, size));
+    encodeTexels(format, lutData.data(), 2, texelCount, imageData.data());
+
     ktx_uint32_t level = 0;
     ktx_uint32_t layer = 0;
     ktx_uint32_t faceSlice = 0;
@@ -186,15 +312,15 @@ int generate2DLookupTableToFile(std::vector<float> lutData, uint32_t size, const
         level,
         layer,
         faceSlice,
-        (ktx_uint8_t*)lutData.data(),
-        lutData.size() * sizeof(lutData[0])
+        imageData.data(),
+        imageData.size()
     );
     if (result != KTX_SUCCESS) {
         std::cerr << ktxErrorString(result) << std::endl;
         return -1;
     }
 
-    ktxTexture_WriteToNamedFile(ktxTexture(texture), fileName);
+    int status = writeKtx2ToFile(texture, fileName, encoding.zstdLevel);
     ktxTexture_Destroy(ktxTexture(texture));
-    return 0;
+    return status;
 }
\ No newline at end of file
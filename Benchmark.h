@@ -0,0 +1,343 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vulkan/vulkan.h>
+
+#include "Camera.h"
+#include "FileFunctions.h"
+#include "FrameStats.h"
+#include "Tonemapper.h"
+#include "RenderingConfig.h"
+
+/*
+Scripted benchmark, loaded from YAML:
+
+timestep: 0.0166667     # seconds of camera movement per frame
+warmupFrames: 60        # defaults for the segments
+frames: 600
+segments:
+  - name: hills-msaa4
+    environment: 0      # index in the environment list
+    msaa: 4             # 1, 2, 4, ... 64
+    anisotropy: 16      # 0 is trilinear
+    tonemapper: aces    # none, reinhard, uncharted2, aces, hejl
+    exposure: 1.0
+    vsync: false
+    camera:
+      - {time: 0, position: [0, 1, 2], target: [0, 0, 0]}
+      - {time: 5, position: [2, 1, 0], orientation: [1, 0, 0, 0]}   # quaternion w, x, y, z
+
+Settings a segment doesn't mention keep their previous values, the camera stays where it is without a path.
+Camera time runs from the first measured frame and advances by the fixed timestep,
+so every run renders the same frames regardless of the frame rate.
+Warmup frames must cover the frames in flight, GPU times arrive that many frames late. They also absorb
+the device wait when a segment changes settings that recreate pipelines or the swapchain.
+*/
+struct CameraKeyframe {
+    float time; // seconds
+    glm::vec3 position;
+    glm::quat orientation;
+};
+
+struct BenchmarkSegment {
+    std::string name;
+    uint32_t warmupFrames;
+    uint32_t frames;
+    std::optional<int> environmentIndex;
+    std::optional<VkSampleCountFlagBits> msaaSamples;
+    std::optional<float> maxAnisotropy;
+    std::optional<Tonemapper::Operator> tonemapOperator;
+    std::optional<float> exposure;
+    std::optional<bool> vsyncEnabled;
+    std::vector<CameraKeyframe> cameraPath;
+};
+
+struct BenchmarkScript {
+    float timestep = 1.0f / 60.0f;
+    std::vector<BenchmarkSegment> segments;
+};
+
+Tonemapper::Operator parseTonemapOperator(std::string const& name) {
+    if (name == "none") return Tonemapper::Operator::NoTonemapping;
+    if (name == "reinhard") return Tonemapper::Operator::Reinhard;
+    if (name == "uncharted2") return Tonemapper::Operator::Uncharted2;
+    if (name == "aces") return Tonemapper::Operator::ACES;
+    if (name == "hejl") return Tonemapper::Operator::Hejl;
+    throw std::runtime_error("Unknown tonemapper " + name);
+}
+
+BenchmarkScript loadBenchmarkScript(const char* fileName) {
+    fkyaml::node yaml = loadYaml(fileName);
+    auto vec3 = [](fkyaml::node& node) {
+        return glm::vec3{node[0].get_value<float>(), node[1].get_value<float>(), node[2].get_value<float>()};
+    };
+
+    BenchmarkScript script;
+    if (yaml.contains("timestep")) {
+        script.timestep = yaml["timestep"].get_value<float>();
+    }
+    uint32_t warmupFrames = yaml.contains("warmupFrames") ? yaml["warmupFrames"].get_value<uint32_t>() : 60;
+    uint32_t frames = yaml.contains("frames") ? yaml["frames"].get_value<uint32_t>() : 600;
+    if (!yaml.contains("segments") || !yaml["segments"].is_sequence()) {
+        throw std::runtime_error("Benchmark script has no segments");
+    }
+
+    fkyaml::node& segmentsYaml = yaml["segments"];
+    for (size_t i = 0; i < segmentsYaml.size(); ++i) {
+        fkyaml::node& segmentYaml = segmentsYaml[i];
+        BenchmarkSegment segment {
+            .name = segmentYaml.contains("name") ? segmentYaml["name"].get_value<std::string>() : "segment " + std::to_string(i),
+            .warmupFrames = segmentYaml.contains("warmupFrames") ? segmentYaml["warmupFrames"].get_value<uint32_t>() : warmupFrames,
+            .frames = segmentYaml.contains("frames") ? segmentYaml["frames"].get_value<uint32_t>() : frames,
+        };
+        if (segment.frames == 0) {
+            throw std::runtime_error("Benchmark segment " + segment.name + " has no frames");
+        }
+        if (segmentYaml.contains("environment")) {
+            segment.environmentIndex = segmentYaml["environment"].get_value<int>();
+        }
+        if (segmentYaml.contains("msaa")) {
+            // Sample count bits have the values of the counts
+            uint32_t samples = segmentYaml["msaa"].get_value<uint32_t>();
+            if (samples == 0 || samples > 64 || (samples & (samples - 1)) != 0) {
+                throw std::runtime_error("Benchmark segment " + segment.name + ": msaa must be a power of two up to 64");
+            }
+            segment.msaaSamples = static_cast<VkSampleCountFlagBits>(samples);
+        }
+        if (segmentYaml.contains("anisotropy")) {
+            segment.maxAnisotropy = segmentYaml["anisotropy"].get_value<float>();
+        }
+        if (segmentYaml.contains("tonemapper")) {
+            segment.tonemapOperator = parseTonemapOperator(segmentYaml["tonemapper"].get_value<std::string>());
+        }
+        if (segmentYaml.contains("exposure")) {
+            segment.exposure = segmentYaml["exposure"].get_value<float>();
+        }
+        if (segmentYaml.contains("vsync")) {
+            segment.vsyncEnabled = segmentYaml["vsync"].get_value<bool>();
+        }
+        if (segmentYaml.contains("camera")) {
+            fkyaml::node& pathYaml = segmentYaml["camera"];
+            for (size_t k = 0; k < pathYaml.size(); ++k) {
+                fkyaml::node& keyframeYaml = pathYaml[k];
+                CameraKeyframe keyframe {
+                    .time = keyframeYaml["time"].get_value<float>(),
+                    .position = vec3(keyframeYaml["position"]),
+                };
+                if (keyframeYaml.contains("orientation")) {
+                    fkyaml::node& q = keyframeYaml["orientation"];
+                    keyframe.orientation = glm::normalize(glm::quat(q[0].get_value<float>(), q[1].get_value<float>(), q[2].get_value<float>(), q[3].get_value<float>()));
+                }
+                else if (keyframeYaml.contains("target")) {
+                    keyframe.orientation = glm::quatLookAt(glm::normalize(vec3(keyframeYaml["target"]) - keyframe.position), glm::vec3(0, 1, 0));
+                }
+                else {
+                    throw std::runtime_error("Benchmark segment " + segment.name + ": camera keyframes need a target or an orientation");
+                }
+                if (!segment.cameraPath.empty() && keyframe.time <= segment.cameraPath.back().time) {
+                    throw std::runtime_error("Benchmark segment " + segment.name + ": camera keyframe times must increase");
+                }
+                segment.cameraPath.push_back(keyframe);
+            }
+        }
+        script.segments.push_back(segment);
+    }
+    return script;
+}
+
+// Settings which can only be checked once the device and the scene are known
+// GPU timestamps of a frame are read back when its slot is reused, framesInFlight frames later,
+// so fewer warmup frames would attribute the previous segment's GPU times to this one.
+void validateBenchmarkScript(BenchmarkScript const& script, size_t environmentCount, VkSampleCountFlags supportedSampleCounts, uint32_t framesInFlight) {
+    for (BenchmarkSegment const& segment : script.segments) {
+        if (segment.warmupFrames < framesInFlight) {
+            throw std::runtime_error("Benchmark segment " + segment.name + ": warmupFrames must be at least " + std::to_string(framesInFlight) + " (frames in flight)");
+        }
+        if (segment.environmentIndex && (*segment.environmentIndex < 0 || size_t(*segment.environmentIndex) >= environmentCount)) {
+            throw std::runtime_error("Benchmark segment " + segment.name + ": environment must be below " + std::to_string(environmentCount));
+        }
+        if (segment.msaaSamples && !(*segment.msaaSamples & supportedSampleCounts)) {
+            throw std::runtime_error("Benchmark segment " + segment.name + ": msaa " + std::to_string(*segment.msaaSamples) + " is not supported by the device");
+        }
+    }
+}
+
+// Interpolates the path, clamped to its first and last keyframes
+void applyCameraPath(std::vector<CameraKeyframe> const& path, float time, Camera& camera) {
+    size_t next = 0;
+    while (next < path.size() && path[next].time <= time) {
+        next++;
+    }
+    if (next == 0 || next == path.size()) {
+        CameraKeyframe const& keyframe = next == 0 ? path.front() : path.back();
+        camera.setPosition(keyframe.position);
+        camera.setOrientation(keyframe.orientation);
+        return;
+    }
+    CameraKeyframe const& a = path[next - 1];
+    CameraKeyframe const& b = path[next];
+    float t = (time - a.time) / (b.time - a.time);
+    camera.setPosition(glm::mix(a.position, b.position, t));
+    camera.setOrientation(glm::slerp(a.orientation, b.orientation, t));
+}
+
+// Quoted and escaped, names come from the script and the driver
+std::string jsonString(std::string const& value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            const char* hex = "0123456789abcdef";
+            quoted += "\\u00";
+            quoted += hex[c >> 4];
+            quoted += hex[c & 15];
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+/*
+Runs a BenchmarkScript in the main loop, one frame at a time.
+Frame timings come from the main FrameStats, samples of the measured frames are copied into per-segment stats.
+*/
+class BenchmarkRunner {
+public:
+    struct SegmentResult {
+        std::string name;
+        RenderingConfig config;
+        FrameStats::Summary summary;
+    };
+
+    explicit BenchmarkRunner(BenchmarkScript script): m_script(std::move(script)) {}
+
+    BenchmarkScript const& getScript() const { return m_script; }
+    float getTimestep() const { return m_script.timestep; }
+    bool isFinished() const { return m_segmentIndex >= m_script.segments.size(); }
+
+    // To be called at the start of every frame, right after frameStats.beginFrame() finished the previous one.
+    // Places the camera. When a segment starts, applies its settings to config and returns true.
+    bool beginFrame(FrameStats const& frameStats, RenderingConfig& config, Camera& camera) {
+        if (m_measuring && frameStats.size() > 0) {
+            m_segmentStats.add(frameStats.sample(frameStats.size() - 1));
+        }
+        m_measuring = false;
+        while (!isFinished() && m_frame == segment().warmupFrames + segment().frames) {
+            m_results.push_back({segment().name, m_segmentConfig, m_segmentStats.summary()});
+            m_segmentIndex++;
+            m_frame = 0;
+        }
+        if (isFinished()) {
+            return false;
+        }
+
+        BenchmarkSegment const& s = segment();
+        bool started = m_frame == 0;
+        if (started) {
+            if (s.environmentIndex) config.environmentIndex = *s.environmentIndex;
+            if (s.msaaSamples) config.msaaSamples = *s.msaaSamples;
+            if (s.maxAnisotropy) config.maxAnisotropy = *s.maxAnisotropy;
+            if (s.tonemapOperator) config.tonemapOperator = *s.tonemapOperator;
+            if (s.exposure) config.exposure = *s.exposure;
+            if (s.vsyncEnabled) config.vsyncEnabled = *s.vsyncEnabled;
+            m_segmentConfig = config;
+            m_segmentStats = FrameStats(s.frames);
+            std::cout << "Benchmark segment " << s.name << std::endl;
+        }
+        if (!s.cameraPath.empty()) {
+            // Warmup frames stay at the start of the path
+            float time = m_frame < s.warmupFrames ? 0.0f : float(m_frame - s.warmupFrames) * m_script.timestep;
+            applyCameraPath(s.cameraPath, time, camera);
+        }
+        m_measuring = m_frame >= s.warmupFrames;
+        m_frame++;
+        return started;
+    }
+
+    std::vector<SegmentResult> const& getResults() const { return m_results; }
+
+    void writeJson(std::ostream& os, const char* deviceName) const {
+        os << "{\n  \"device\": " << jsonString(deviceName) << ",\n  \"timestep\": " << m_script.timestep << ",\n  \"segments\": [";
+        for (size_t i = 0; i < m_results.size(); ++i) {
+            SegmentResult const& result = m_results[i];
+            os << (i ? ",\n" : "\n") << "    {\n";
+            os << "      \"name\": " << jsonString(result.name) << ",\n";
+            os << "      \"environment\": " << result.config.environmentIndex << ",\n";
+            os << "      \"msaaSamples\": " << static_cast<uint32_t>(result.config.msaaSamples) << ",\n";
+            os << "      \"maxAnisotropy\": " << result.config.maxAnisotropy << ",\n";
+            os << "      \"tonemapper\": \"" << getTonemapOperatorName(result.config.tonemapOperator) << "\",\n";
+            os << "      \"exposure\": " << result.config.exposure << ",\n";
+            os << "      \"vsync\": " << (result.config.vsyncEnabled ? "true" : "false") << ",\n";
+            FrameStats::writeSummaryJson(os, result.summary, "      ");
+            os << "\n    }";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+    bool save(std::string const& fileName, const char* deviceName) const {
+        std::ofstream file(fileName);
+        writeJson(file, deviceName);
+        return bool(file);
+    }
+
+private:
+    BenchmarkSegment const& segment() const { return m_script.segments[m_segmentIndex]; }
+
+    BenchmarkScript m_script;
+    size_t m_segmentIndex = 0;
+    uint32_t m_frame = 0; // in the current segment, including warmup
+    bool m_measuring = false; // the frame in progress is measured
+    RenderingConfig m_segmentConfig;
+    FrameStats m_segmentStats;
+    std::vector<SegmentResult> m_results;
+};
+
+/*
+Records the camera while flying by hand. Saved as a benchmark script with a single segment,
+so the flight can be replayed frame by frame with a fixed timestep.
+Camera poses are recorded rather than SDL input: controllers poll the keyboard state and integrate
+with the variable frame time, which doesn't replay deterministically.
+*/
+class CameraRecorder {
+public:
+    void record(Camera const& camera, float dt) {
+        if (m_keyframes.empty() || m_time - m_keyframes.back().time >= KEYFRAME_INTERVAL) {
+            m_keyframes.push_back({m_time, camera.getPosition(), camera.getOrientation()});
+        }
+        m_time += dt;
+    }
+
+    bool save(std::string const& fileName) const {
+        static constexpr float TIMESTEP = 1.0f / 60.0f;
+        std::ofstream file(fileName);
+        file << "timestep: " << TIMESTEP << "\n";
+        file << "segments:\n";
+        file << "  - name: recorded\n";
+        file << "    frames: " << std::max<uint32_t>(1, static_cast<uint32_t>(m_time / TIMESTEP)) << "\n";
+        file << "    camera:\n";
+        for (CameraKeyframe const& k : m_keyframes) {
+            file << "      - {time: " << k.time
+                 << ", position: [" << k.position.x << ", " << k.position.y << ", " << k.position.z << "]"
+                 << ", orientation: [" << k.orientation.w << ", " << k.orientation.x << ", " << k.orientation.y << ", " << k.orientation.z << "]}\n";
+        }
+        return bool(file);
+    }
+
+private:
+    static constexpr float KEYFRAME_INTERVAL = 0.1f; // seconds
+
+    float m_time = 0;
+    std::vector<CameraKeyframe> m_keyframes;
+};
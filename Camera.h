@@ -35,6 +35,18 @@ public:
         fov = newFov;
     }
 
+    glm::vec3 const& getPosition() const {
+        return position;
+    }
+
+    glm::quat const& getOrientation() const {
+        return orientation;
+    }
+
+    void setOrientation(const glm::quat& newOrientation) {
+        orientation = newOrientation;
+    }
+
     glm::vec3 getForward() const {
         return orientation * glm::vec3(0, 0, -1);
     }
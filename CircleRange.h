@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <cmath>
 #include <iterator>
 #include <tuple>
 
@@ -57,6 +58,13 @@ private:
     int cx, cy, r;
 };
 
+// Largest x offset of the ellipse (x/rx)^2 + (y/ry)^2 <= 1 at row offset y
+int ellipseHalfWidth(int rx, int ry, int y) {
+    double y_norm = static_cast<double>(y) / ry;
+    double x_norm_max = std::sqrt(std::max(0.0, 1.0 - y_norm * y_norm));
+    return static_cast<int>(std::floor(x_norm_max * rx));
+}
+
 class CircleRangeEllipse {
 public:
     struct Iterator {
@@ -95,10 +103,7 @@ public:
 
     private:
         void update_x_max() {
-            // Ellipse equation: (x/rx)^2 + (y/ry)^2 <= 1
-            double y_norm = static_cast<double>(y) / ry;
-            double x_norm_max = std::sqrt(std::max(0.0, 1.0 - y_norm * y_norm));
-            x_max = static_cast<int>(std::floor(x_norm_max * rx));
+            x_max = ellipseHalfWidth(rx, ry, y);
         }
     };
 
@@ -108,6 +113,19 @@ public:
     Iterator begin() const { return Iterator(cx, cy, rx, ry); }
     Iterator end() const { return Iterator(cx, cy, rx, ry, true); }
 
+    // Calls fn(y, xBegin, xEnd) for every row, xEnd is exclusive.
+    // Covers the same texels as the iterator with one call per row instead of one increment per texel.
+    template<typename Fn>
+    void forEachRow(Fn&& fn) const {
+        for (int y = -ry; y <= ry; ++y) {
+            int xMax = ellipseHalfWidth(rx, ry, y);
+            fn(cy + y, cx - xMax, cx + xMax + 1);
+        }
+    }
+
+    int top() const { return cy - ry; }
+    int bottom() const { return cy + ry + 1; }  // exclusive
+
 private:
     int cx, cy, rx, ry;
 };
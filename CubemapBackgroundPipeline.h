@@ -5,6 +5,7 @@
 #include <vulkan/vulkan.h>
 #include "VulkanFunctions.h"
 #include "FileFunctions.h"
+#include "FrameCounters.h"
 
 class CubemapBackgroundPipeline {
 public:
@@ -44,6 +45,11 @@ public:
         std::array descriptorSets = {frameLevelDescriptorSet};
         vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_layout, 0, descriptorSets.size(), descriptorSets.data(), 0, nullptr);
         vkCmdDraw(commandBuffer, 36, 1, 0, 0);
+
+        FrameCounters& counters = frameCounters();
+        counters.pipelineBinds++;
+        counters.descriptorSetBinds++;
+        counters.draw(36);
     }
 
 private:
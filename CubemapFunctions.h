@@ -1,12 +1,22 @@
 #pragma once
 
+#include <atomic>
 #include <filesystem>
 #include <tinyexr.h>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
 #include <ktx.h>
 #include <vulkan/vulkan.h>
 #include <glm/glm.hpp>
 #include "ImageFunctions.h"
+#include "ThreadPool.h"
+#include "EquirectangularBatch.h"
+#include "BRDF.h"
+#include "TextureFormats.h"
+#include "BC6H.h"
 
 enum CubemapFace {
     POSITIVE_X = 0,
@@ -17,16 +27,25 @@ enum CubemapFace {
     NEGATIVE_Z = 5
 };
 
-// Convert 3D direction vector to 2D equirectangular coordinates
-void directionToEquirectangular(float x, float y, float z, float& u, float& v) {
-    // Calculate spherical coordinates
-    // x, y, z aligned with default camera orientation so that the resulting coordinates point to a center of panorama
-    float phi = atan2(x, -z); // range (-pi, pi]
-    float theta = asin(-y); // range (-pi/2, pi/2)
-    
-    // Map to UV coordinates [0,1] where (0, 0) is the top-left corner
-    u = (phi + M_PI) / (2.0f * M_PI);
-    v = (theta + M_PI / 2.0f) / M_PI;
+// Rectangular part of a single cubemap face of a single mip level
+struct CubemapTile {
+    int mip;
+    int face;
+    int x0, y0;
+    int x1, y1;  // exclusive
+};
+
+// Tiles are small enough to stay in cache and numerous enough to keep all cores busy
+constexpr int CUBEMAP_TILE_SIZE = 32;
+
+void appendCubemapTiles(std::vector<CubemapTile>& tiles, int mip, int faceSize, int tileSize = CUBEMAP_TILE_SIZE) {
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < faceSize; y += tileSize) {
+            for (int x = 0; x < faceSize; x += tileSize) {
+                tiles.push_back({mip, face, x, y, std::min(x + tileSize, faceSize), std::min(y + tileSize, faceSize)});
+            }
+        }
+    }
 }
 
 // Top-left corner: (x, y) = (0, 0)
@@ -80,70 +99,78 @@ glm::vec3 facePointToDirection(CubemapFace face, int faceSize, int x, int y) {
     return dir;
 }
 
-// Sample image with bilinear interpolation
-// u [0, 1]
-// v [0, 1]
-// uv = (0, 0) is the top-left corner
-void sampleImage(const float* image, int width, int height, float u, float v, float* rgba) {
-    // Convert to pixel coordinates
-    float x = u * (width - 1);
-    float y = v * (height - 1);
-    
-    // Get integer and fractional parts
-    int x0 = static_cast<int>(floor(x));
-    int y0 = static_cast<int>(floor(y));
-    int x1 = (x0 + 1) % width;
-    int y1 = fmin(y0 + 1, height - 1);
-    
-    float fx = x - x0;
-    float fy = y - y0;
-    
-    // Read four nearest pixels
-    float rgba00[4], rgba01[4], rgba10[4], rgba11[4];
-    for (int i = 0; i < 4; i++) {
-        rgba00[i] = image[(y0 * width + x0) * 4 + i];
-        rgba01[i] = image[(y0 * width + x1) * 4 + i];
-        rgba10[i] = image[(y1 * width + x0) * 4 + i];
-        rgba11[i] = image[(y1 * width + x1) * 4 + i];
-    }
-    
-    // Bilinear interpolation
-    for (int i = 0; i < 4; i++) {
-        float top = rgba00[i] * (1 - fx) + rgba01[i] * fx;
-        float bottom = rgba10[i] * (1 - fx) + rgba11[i] * fx;
-        rgba[i] = top * (1 - fy) + bottom * fy;
-    }
-}
+// Continuous equirectangular source coordinates of every base level texel (face * faceSize^2 + y * faceSize + x).
+// Only depends on the sizes, so the direction math is done once instead of for every texel of every panorama.
+struct EquirectangularTexelTable {
+    std::vector<float> sourceX;
+    std::vector<float> sourceY;
+};
 
-glm::vec3 sampleEquirectangular(ImageData const& image, glm::vec3 dir) {
-    float u, v;
-    directionToEquirectangular(dir.x, dir.y, dir.z, u, v);
-    float rgba[4];
-    float* data = static_cast<float*>(image.data.get());
-    sampleImage(data, image.width, image.height, u, v, rgba);
-    return glm::vec3(rgba[0], rgba[1], rgba[2]);
+EquirectangularTexelTable buildEquirectangularTexelTable(ThreadPool& threadPool, int faceSize, int width, int height) {
+    size_t faceTexelCount = size_t(faceSize) * faceSize;
+    EquirectangularTexelTable table;
+    table.sourceX.resize(6 * faceTexelCount);
+    table.sourceY.resize(6 * faceTexelCount);
+    threadPool.parallelFor(6 * size_t(faceSize), [&](size_t faceRow) {
+        int face = int(faceRow / faceSize);
+        int y = int(faceRow % faceSize);
+        size_t rowBegin = faceRow * faceSize;
+        // Directions of a face row are converted as one batch
+        std::vector<float> dirX(faceSize), dirY(faceSize), dirZ(faceSize);
+        for (int x = 0; x < faceSize; x++) {
+            glm::vec3 dir = facePointToDirection(static_cast<CubemapFace>(face), faceSize, x, y);
+            dirX[x] = dir.x;
+            dirY[x] = dir.y;
+            dirZ[x] = dir.z;
+        }
+        equirectangularSourceCoordinates(dirX.data(), dirY.data(), dirZ.data(), width, height,
+                                         table.sourceX.data() + rowBegin, table.sourceY.data() + rowBegin, faceSize);
+    });
+    return table;
 }
 
-std::vector<float> convertEquirectangularToCubemap(ImageData const& image, int faceSize) {
-    // Allocate memory for 6 faces * faceSize^2 * 3 channels (RGB)
-    std::vector<float> cubemapData(6 * faceSize * faceSize * 3);
-
-    for (ktx_uint32_t faceSlice = 0; faceSlice < 6; faceSlice++) {
-        CubemapFace face = static_cast<CubemapFace>(faceSlice);
-        for (int y = 0; y < faceSize; y++) {
-            for (int x = 0; x < faceSize; x++) {
-                glm::vec3 dir = facePointToDirection(face, faceSize, x, y);
-                glm::vec3 rgb = sampleEquirectangular(image, dir);
-
-                int pixelIndex = (face * faceSize * faceSize + y * faceSize + x) * 3;
-                cubemapData[pixelIndex + 0] = rgb.r;
-                cubemapData[pixelIndex + 1] = rgb.g;
-                cubemapData[pixelIndex + 2] = rgb.b;
-            }
+// Base level texels grouped by the band of source rows they are sampled from.
+// A texel belongs to the band containing the top row of its bilinear footprint,
+// so a band has to be read with one extra row at the bottom.
+std::vector<std::vector<uint32_t>> groupCubemapTexelsByBand(ThreadPool& threadPool, EquirectangularTexelTable const& table, int faceSize, int height, int bandHeight) {
+    int bandCount = (height + bandHeight - 1) / bandHeight;
+    size_t faceTexelCount = size_t(faceSize) * faceSize;
+    std::vector<std::vector<std::vector<uint32_t>>> faceBands(6, std::vector<std::vector<uint32_t>>(bandCount));
+    threadPool.parallelFor(6, [&](size_t face) {
+        for (size_t i = face * faceTexelCount; i < (face + 1) * faceTexelCount; i++) {
+            int row = std::clamp(static_cast<int>(std::floor(table.sourceY[i])), 0, height - 1);
+            faceBands[face][row / bandHeight].push_back(uint32_t(i));
+        }
+    });
+
+    std::vector<std::vector<uint32_t>> bands(bandCount);
+    for (int band = 0; band < bandCount; ++band) {
+        for (int face = 0; face < 6; ++face) {
+            bands[band].insert(bands[band].end(), faceBands[face][band].begin(), faceBands[face][band].end());
         }
     }
+    return bands;
+}
 
-    return cubemapData;
+// Sampling reduces to a fetch at the precomputed coordinates, done in batches of texels
+void convertEquirectangularRowsToCubemapTexels(EquirectangularRows const& rows, EquirectangularTexelTable const& table, const uint32_t* texels, size_t count, float* cubemapData) {
+    constexpr size_t BATCH_SIZE = 64;
+    float px[BATCH_SIZE], py[BATCH_SIZE];
+    float r[BATCH_SIZE], g[BATCH_SIZE], b[BATCH_SIZE];
+    for (size_t begin = 0; begin < count; begin += BATCH_SIZE) {
+        size_t batchCount = std::min(BATCH_SIZE, count - begin);
+        for (size_t i = 0; i < batchCount; i++) {
+            px[i] = table.sourceX[texels[begin + i]];
+            py[i] = table.sourceY[texels[begin + i]];
+        }
+        sampleEquirectangularAt(rows, px, py, r, g, b, batchCount);
+        for (size_t i = 0; i < batchCount; i++) {
+            float* rgb = cubemapData + size_t(texels[begin + i]) * 3;
+            rgb[0] = r[i];
+            rgb[1] = g[i];
+            rgb[2] = b[i];
+        }
+    }
 }
 
 glm::vec3 worldDirFromSphericalCoordinates(float sinTheta, float cosTheta, float sinPhi, float cosPhi) {
@@ -176,295 +203,465 @@ glm::vec3 worldDirFromEquirectangularCoordinates(int x, int y, int width, int he
     return worldDirFromEquirectangularUV(u, v);
 }
 
-// Calculate spherical harmonics from equirectangular environment map
-std::vector<glm::vec3> calculateDiffuseSphericalHarmonics(ImageData const& image) {
-    float* equiRgba = static_cast<float*>(image.data.get());
-    int width = image.width;
-    int height = image.height;
+// Cubemap with a full chain of box filtered mip levels, RGB float texels.
+// Used as a source for filtered importance sampling: wide GGX lobes read from coarse levels
+// instead of integrating over thousands of full resolution texels.
+struct CubemapPyramid {
+    int baseFaceSize;
+    std::vector<std::vector<float>> levels;
+};
 
-    // 9 SH coefficients (3 bands) for each of RGB
-    std::vector<glm::vec3> shCoeffs(9, glm::vec3(0.0f));
-    
-    const float dTheta = M_PI / float(height);
-    const float dPhi = 2.0f * M_PI / float(width);
-
-    // Loop through every pixel in the equirectangular map
-    for (int y = 0; y < height; ++y) {
-        float v = (y + 0.5f) / float(height); // [0,1]
-        float theta = v * M_PI; // [0, PI]
-
-        float sinTheta = std::sin(theta);
-        float cosTheta = std::cos(theta);
-
-        for (int x = 0; x < width; ++x) {
-            float u = (x + 0.5f) / float(width); // [0,1]
-            float phi = u * 2.0f * M_PI; // [0, 2PI]
-
-            float sinPhi = std::sin(phi);
-            float cosPhi = std::cos(phi);
-
-            glm::vec3 dir = worldDirFromSphericalCoordinates(sinTheta, cosTheta, sinPhi, cosPhi);
-
-            // Get color from equirectangular image
-            int pixelIndex = (y * width + x) * 4;
-            glm::vec3 color(
-                equiRgba[pixelIndex + 0],
-                equiRgba[pixelIndex + 1],
-                equiRgba[pixelIndex + 2]
-            );
-
-            // Differential solid angle of the texel
-            // sin(θ) comes from Jacobian of spherical coordinates
-            float dOmega = dTheta * dPhi * sinTheta;
-
-            // Evaluate SH basis functions (real, normalized)
-            float Y[9] = {};
-            Y[0] = 0.282095f;
-            Y[1] = 0.488603f * dir.y;
-            Y[2] = 0.488603f * dir.z;
-            Y[3] = 0.488603f * dir.x;
-            Y[4] = 1.092548f * dir.x * dir.y;
-            Y[5] = 1.092548f * dir.y * dir.z;
-            Y[6] = 0.315392f * (3.0f * dir.z * dir.z - 1.0f);
-            Y[7] = 1.092548f * dir.x * dir.z;
-            Y[8] = 0.546274f * (dir.x * dir.x - dir.y * dir.y);
-
-            // Accumulate SH coefficients
-            for (int i = 0; i < 9; ++i) {
-                shCoeffs[i] += color * Y[i] * dOmega;
+void downsampleCubemapTile(const float* src, int srcFaceSize, CubemapTile const& tile, float* dst) {
+    int dstFaceSize = std::max(srcFaceSize / 2, 1);
+    const float* srcFace = src + size_t(tile.face) * srcFaceSize * srcFaceSize * 3;
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            int sx0 = std::min(x * 2, srcFaceSize - 1);
+            int sy0 = std::min(y * 2, srcFaceSize - 1);
+            int sx1 = std::min(sx0 + 1, srcFaceSize - 1);
+            int sy1 = std::min(sy0 + 1, srcFaceSize - 1);
+            size_t pixelIndex = (size_t(tile.face) * dstFaceSize * dstFaceSize + y * dstFaceSize + x) * 3;
+            for (int c = 0; c < 3; ++c) {
+                dst[pixelIndex + c] = 0.25f * (
+                    srcFace[(sy0 * srcFaceSize + sx0) * 3 + c] +
+                    srcFace[(sy0 * srcFaceSize + sx1) * 3 + c] +
+                    srcFace[(sy1 * srcFaceSize + sx0) * 3 + c] +
+                    srcFace[(sy1 * srcFaceSize + sx1) * 3 + c]
+                );
             }
         }
     }
+}
 
-    // Apply analytic convolution of Lambertian BRDF (cosθ/π) with SH basis. This transforms radiance to irradiance.
-    // These weights come from projecting cosine lobe onto SH basis functions.
-    shCoeffs[0] *= M_PI;
-    for (int i = 1; i <= 3; ++i) shCoeffs[i] *= (2.0 * M_PI) / 3.0;
-    for (int i = 4; i <= 8; ++i) shCoeffs[i] *= M_PI / 4.0;
+CubemapPyramid buildCubemapPyramid(ThreadPool& threadPool, std::vector<float> baseLevel, int baseFaceSize) {
+    CubemapPyramid pyramid{baseFaceSize, {}};
+    pyramid.levels.push_back(std::move(baseLevel));
+
+    for (int faceSize = baseFaceSize; faceSize > 1; faceSize /= 2) {
+        int dstFaceSize = faceSize / 2;
+        std::vector<float> level(6 * dstFaceSize * dstFaceSize * 3);
+        std::vector<CubemapTile> tiles;
+        appendCubemapTiles(tiles, int(pyramid.levels.size()), dstFaceSize);
+        const float* src = pyramid.levels.back().data();
+        threadPool.parallelFor(tiles.size(), [&](size_t i) {
+            downsampleCubemapTile(src, faceSize, tiles[i], level.data());
+        });
+        pyramid.levels.push_back(std::move(level));
+    }
 
-    // Convert to reflected radiance (dividing by π according to Lambertian model).
-    for (auto& c : shCoeffs) c /= M_PI;
+    return pyramid;
+}
 
-    return shCoeffs;
+// Inverse of facePointToDirection: returns the face and continuous texel coordinates
+// (texel centers are at integer + 0.5)
+CubemapFace directionToFacePoint(glm::vec3 dir, int faceSize, float& x, float& y) {
+    glm::vec3 a = glm::abs(dir);
+    CubemapFace face;
+    float u, v;
+    if (a.x >= a.y && a.x >= a.z) {
+        face = dir.x > 0 ? POSITIVE_X : NEGATIVE_X;
+        u = dir.x > 0 ? -dir.z / a.x : dir.z / a.x;
+        v = -dir.y / a.x;
+    } else if (a.y >= a.z) {
+        face = dir.y > 0 ? POSITIVE_Y : NEGATIVE_Y;
+        u = dir.x / a.y;
+        v = dir.y > 0 ? dir.z / a.y : -dir.z / a.y;
+    } else {
+        face = dir.z > 0 ? POSITIVE_Z : NEGATIVE_Z;
+        u = dir.z > 0 ? dir.x / a.z : -dir.x / a.z;
+        v = -dir.y / a.z;
+    }
+    x = (u + 1.0f) * 0.5f * faceSize;
+    y = (v + 1.0f) * 0.5f * faceSize;
+    return face;
 }
 
-int calculateDiffuseSphericalHarmonics(ImageData const& image, const char* outputFileName) {
-    auto shCoeffs = calculateDiffuseSphericalHarmonics(image);
-    std::ofstream outFile(outputFileName);
-    if (!outFile) {
-        std::cerr << "Error: Could not open file for writing: " << outputFileName << std::endl;
-        return -1;
+// Bilinear sample within a single face, clamped at face edges
+glm::vec3 sampleCubemapLevel(const float* level, int faceSize, CubemapFace face, float x, float y) {
+    x = std::clamp(x - 0.5f, 0.0f, float(faceSize - 1));
+    y = std::clamp(y - 0.5f, 0.0f, float(faceSize - 1));
+    int x0 = static_cast<int>(x);
+    int y0 = static_cast<int>(y);
+    int x1 = std::min(x0 + 1, faceSize - 1);
+    int y1 = std::min(y0 + 1, faceSize - 1);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    const float* faceData = level + size_t(face) * faceSize * faceSize * 3;
+    auto texel = [&](int tx, int ty) {
+        const float* p = faceData + (ty * faceSize + tx) * 3;
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+    glm::vec3 top = texel(x0, y0) * (1 - fx) + texel(x1, y0) * fx;
+    glm::vec3 bottom = texel(x0, y1) * (1 - fx) + texel(x1, y1) * fx;
+    return top * (1 - fy) + bottom * fy;
+}
+
+// Trilinear sample, lod 0 is the base level
+glm::vec3 sampleCubemapPyramid(CubemapPyramid const& pyramid, glm::vec3 dir, float lod) {
+    int maxLevel = int(pyramid.levels.size()) - 1;
+    lod = std::clamp(lod, 0.0f, float(maxLevel));
+    int level0 = static_cast<int>(lod);
+    int level1 = std::min(level0 + 1, maxLevel);
+    float t = lod - level0;
+
+    auto sampleLevel = [&](int level) {
+        int faceSize = std::max(pyramid.baseFaceSize >> level, 1);
+        float x, y;
+        CubemapFace face = directionToFacePoint(dir, faceSize, x, y);
+        return sampleCubemapLevel(pyramid.levels[level].data(), faceSize, face, x, y);
+    };
+    glm::vec3 color = sampleLevel(level0);
+    if (t > 0.0f && level1 != level0) {
+        color = color * (1.0f - t) + sampleLevel(level1) * t;
     }
-    
-    outFile << shCoeffs.size() << std::endl;
-    
-    for (const auto& coeff : shCoeffs) {
-        outFile << coeff.x << " " << coeff.y << " " << coeff.z << std::endl;
+    return color;
+}
+
+// Light direction sample in tangent space (normal = view = +Z)
+struct GGXSample {
+    glm::vec3 lightDir;
+    float NdotL;
+    float lod;  // source pyramid level to read from
+};
+
+// Source level follows filtered importance sampling (Krivanek & Colbert, GPU Gems 3, ch. 20):
+// a sample covers the solid angle 1 / (N * pdf), which is matched with the texel solid angle of a pyramid level.
+// Returns false for light directions below the horizon.
+bool makeGGXSample(float xi1, float xi2, float roughness, int sampleCount, float texelSolidAngle, GGXSample& sample) {
+    float alpha = roughness * roughness;
+    float alpha2 = alpha * alpha;
+    auto [hx, hy, hz] = importanceSampleGGX(xi1, xi2, roughness);
+
+    // Reflect view (= normal) direction around the half vector
+    glm::vec3 lightDir(2.0f * hz * hx, 2.0f * hz * hy, 2.0f * hz * hz - 1.0f);
+    float NdotL = lightDir.z;
+    if (NdotL <= 0.0f) return false;
+
+    // pdf(L) = D * NdotH / (4 * VdotH), and NdotH == VdotH when N == V
+    float d = hz * hz * (alpha2 - 1.0f) + 1.0f;
+    float D = alpha2 / (M_PI * d * d);
+    float pdf = D / 4.0f;
+    float sampleSolidAngle = 1.0f / (sampleCount * pdf + 1e-6f);
+    float lod = std::max(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f);
+
+    sample = {glm::normalize(lightDir), NdotL, lod};
+    return true;
+}
+
+// Sample points come from a (scrambled) Hammersley set: the same low-discrepancy pattern is used for every texel,
+// so directions, weights and source levels are computed once per roughness.
+std::vector<GGXSample> generateGGXSamples(float roughness, int sampleCount, int sourceFaceSize, uint32_t scramble = 0) {
+    std::vector<GGXSample> samples;
+    samples.reserve(sampleCount);
+    float texelSolidAngle = 4.0f * M_PI / (6.0f * sourceFaceSize * sourceFaceSize);
+
+    for (int i = 0; i < sampleCount; ++i) {
+        auto [xi1, xi2] = hammersley(i, sampleCount, scramble);
+        GGXSample sample;
+        if (makeGGXSample(xi1, xi2, roughness, sampleCount, texelSolidAngle, sample)) {
+            samples.push_back(sample);
+        }
     }
-    
-    outFile.close();
-    return 0;
+
+    return samples;
+}
+
+// Progressive prefiltering: a texel takes samples in rounds of doubling size, starting with minSampleCount,
+// until the relative standard error of its luminance drops below targetRelativeError or maxSampleCount is reached.
+struct AdaptiveSampling {
+    float targetRelativeError;
+    int minSampleCount;
+    int maxSampleCount;
+};
+
+// Sample count after the round that contains sample i
+int adaptiveRoundEnd(AdaptiveSampling const& adaptive, int i) {
+    int end = adaptive.minSampleCount;
+    while (end <= i) end *= 2;
+    return std::min(end, adaptive.maxSampleCount);
 }
 
-std::vector<glm::vec3> loadSHCoeffs(const char* filename) {
-    std::ifstream inFile(filename);
-    if (!inFile) {
-        std::cerr << "Error: Could not open file for reading: " << filename << std::endl;
-        return {};
+// Samples of a (0, 2)-sequence, every round is a stratified extension of the previous ones.
+// A sample's source level is based on the sample count at the end of its round.
+// Samples below the horizon are kept with zero weight, so rounds end at fixed positions.
+std::vector<GGXSample> generateProgressiveGGXSamples(float roughness, AdaptiveSampling const& adaptive, int sourceFaceSize, uint32_t scramble = 0) {
+    std::vector<GGXSample> samples(adaptive.maxSampleCount, GGXSample{glm::vec3(0.0f, 0.0f, 1.0f), 0.0f, 0.0f});
+    float texelSolidAngle = 4.0f * M_PI / (6.0f * sourceFaceSize * sourceFaceSize);
+
+    for (int i = 0; i < adaptive.maxSampleCount; ++i) {
+        auto [xi1, xi2] = sobol02(i, scramble);
+        makeGGXSample(xi1, xi2, roughness, adaptiveRoundEnd(adaptive, i), texelSolidAngle, samples[i]);
     }
-    
-    size_t numCoeffs;
-    inFile >> numCoeffs;
-    
-    std::vector<glm::vec3> shCoeffs;
-    shCoeffs.reserve(numCoeffs);
-    
-    for (size_t i = 0; i < numCoeffs; ++i) {
-        float x, y, z;
-        inFile >> x >> y >> z;
-        shCoeffs.emplace_back(x, y, z);
+
+    return samples;
+}
+
+/*
+Sampling tables shared by all assets baked in one run.
+
+GGX samples depend only on roughness, sample count, source size and seed, texel tables only on face and panorama size,
+so same-sized environments reuse them. Tables are kept until the cache is destroyed.
+Safe to use from concurrent jobs. A missing table is built without holding the lock, because thread pool waits
+run other queued jobs that may ask for the same table; if two jobs race, one of the identical results is dropped.
+*/
+class SamplingTables {
+public:
+    using GGXSamples = std::vector<GGXSample>;
+
+    std::shared_ptr<const GGXSamples> ggxSamples(float roughness, int sampleCount, int sourceFaceSize, uint32_t scramble) {
+        return getOrBuild(m_ggxSamples, {roughness, sampleCount, sourceFaceSize, scramble}, [&] {
+            return generateGGXSamples(roughness, sampleCount, sourceFaceSize, scramble);
+        });
     }
-    
-    inFile.close();
-    return shCoeffs;
+
+    std::shared_ptr<const GGXSamples> progressiveGGXSamples(float roughness, AdaptiveSampling const& adaptive, int sourceFaceSize, uint32_t scramble) {
+        return getOrBuild(m_progressiveGGXSamples, {roughness, adaptive.minSampleCount, adaptive.maxSampleCount, sourceFaceSize, scramble}, [&] {
+            return generateProgressiveGGXSamples(roughness, adaptive, sourceFaceSize, scramble);
+        });
+    }
+
+    std::shared_ptr<const EquirectangularTexelTable> equirectangularTexels(ThreadPool& threadPool, int faceSize, int width, int height) {
+        return getOrBuild(m_equirectangularTexels, {faceSize, width, height}, [&] {
+            return buildEquirectangularTexelTable(threadPool, faceSize, width, height);
+        });
+    }
+
+private:
+    template<typename Key, typename Table, typename Build>
+    std::shared_ptr<const Table> getOrBuild(std::map<Key, std::shared_ptr<const Table>>& tables, Key const& key, Build&& build) {
+        {
+            std::lock_guard lock(m_mutex);
+            auto it = tables.find(key);
+            if (it != tables.end()) return it->second;
+        }
+        auto table = std::make_shared<const Table>(build());
+        std::lock_guard lock(m_mutex);
+        return tables.try_emplace(key, std::move(table)).first->second;
+    }
+
+    std::mutex m_mutex;
+    std::map<std::tuple<float, int, int, uint32_t>, std::shared_ptr<const GGXSamples>> m_ggxSamples;
+    std::map<std::tuple<float, int, int, int, uint32_t>, std::shared_ptr<const GGXSamples>> m_progressiveGGXSamples;
+    std::map<std::tuple<int, int, int>, std::shared_ptr<const EquirectangularTexelTable>> m_equirectangularTexels;
+};
+
+// Tangent space basis around the normal
+void tangentFrame(const glm::vec3& normal, glm::vec3& tangent, glm::vec3& bitangent) {
+    glm::vec3 up = abs(normal.z) < 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+    tangent = glm::normalize(glm::cross(up, normal));
+    bitangent = glm::cross(normal, tangent);
 }
 
-glm::vec3 importanceSampleGGX(const ImageData& equirectangularImage, const glm::vec3& normal, float roughness, int sampleCount) {
+glm::vec3 prefilteredRadiance(CubemapPyramid const& source, const glm::vec3& normal, std::vector<GGXSample> const& samples) {
     glm::vec3 color(0.0f);
     float totalWeight = 0.0f;
+    glm::vec3 tangent, bitangent;
+    tangentFrame(normal, tangent, bitangent);
 
-    // Create tangent space basis
-    glm::vec3 up = abs(normal.z) < 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
-    glm::vec3 tangent = glm::normalize(glm::cross(up, normal));
-    glm::vec3 bitangent = glm::cross(normal, tangent);
-    
-    float alpha = roughness * roughness;
-    
-    for (int i = 0; i < sampleCount; ++i) {
-        // TODO: use a proper random number generator
-        float xi1 = static_cast<float>(rand()) / RAND_MAX;
-        float xi2 = static_cast<float>(rand()) / RAND_MAX;
-        
-        // Importance sample GGX distribution
-        float phi = 2.0f * M_PI * xi1;
-        float cosTheta = sqrt((1.0f - xi2) / (1.0f + (alpha * alpha - 1.0f) * xi2));
-        float sinTheta = sqrt(1.0f - cosTheta * cosTheta);
-        
-        // Convert to Cartesian coordinates in tangent space
-        glm::vec3 halfVector(
-            sinTheta * cos(phi),
-            sinTheta * sin(phi),
-            cosTheta
-        );
-        
-        // Transform to world space
-        glm::vec3 sampleDir = halfVector.x * tangent + halfVector.y * bitangent + halfVector.z * normal;
-        
-        // Calculate reflection direction
-        glm::vec3 lightDir = glm::normalize(2.0f * glm::dot(sampleDir, normal) * sampleDir - normal);
-
-        float NdotL = glm::max(glm::dot(normal, lightDir), 0.0f);
-        if (NdotL > 0.0f) {
-            glm::vec3 envColor = sampleEquirectangular(equirectangularImage, lightDir);
-            color += envColor * NdotL;
-            totalWeight += NdotL;
-        }
+    for (GGXSample const& sample : samples) {
+        glm::vec3 lightDir = sample.lightDir.x * tangent + sample.lightDir.y * bitangent + sample.lightDir.z * normal;
+        color += sampleCubemapPyramid(source, lightDir, sample.lod) * sample.NdotL;
+        totalWeight += sample.NdotL;
     }
-    
+
     return totalWeight > 0.0f ? color / totalWeight : glm::vec3(0.0f);
 }
 
-std::vector<float> filterCubemapForRoughness(const ImageData& equirectangularImage, int faceSize, float roughness, int sampleCount) {
-    // Allocate memory for 6 faces * faceSize^2 * 3 channels (RGB)
-    std::vector<float> cubemapData(6 * faceSize * faceSize * 3);
-    
-    // For each face of the cubemap
-    for (int face = 0; face < 6; ++face) {
-        for (int y = 0; y < faceSize; ++y) {
-            for (int x = 0; x < faceSize; ++x) {
-                glm::vec3 dir = facePointToDirection(static_cast<CubemapFace>(face), faceSize, x, y);
-                
-                // Apply importance sampling based on GGX/Trowbridge-Reitz distribution
-                glm::vec3 filteredColor = importanceSampleGGX(equirectangularImage, dir, roughness, sampleCount);
-                
-                // Store in cubemap data
-                int pixelIndex = (face * faceSize * faceSize + y * faceSize + x) * 3;
-                cubemapData[pixelIndex + 0] = filteredColor.r;
-                cubemapData[pixelIndex + 1] = filteredColor.g;
-                cubemapData[pixelIndex + 2] = filteredColor.b;
+// Progressive variant of prefilteredRadiance over samples from generateProgressiveGGXSamples.
+// The error estimate treats the NdotL weighted mean as a ratio estimator (Kish effective sample size).
+// It ignores the stratification of the sequence, so it overestimates the actual error.
+glm::vec3 prefilteredRadianceAdaptive(CubemapPyramid const& source, const glm::vec3& normal, std::vector<GGXSample> const& samples, AdaptiveSampling const& adaptive, int& usedSampleCount) {
+    glm::vec3 color(0.0f);
+    glm::vec3 tangent, bitangent;
+    tangentFrame(normal, tangent, bitangent);
+
+    double weightSum = 0.0, weightSquaredSum = 0.0, luminanceSum = 0.0, luminanceSquaredSum = 0.0;
+    double target2 = double(adaptive.targetRelativeError) * adaptive.targetRelativeError;
+    int count = int(samples.size());
+    int i = 0;
+    for (int roundEnd = std::min(adaptive.minSampleCount, count); ; roundEnd = std::min(roundEnd * 2, count)) {
+        for (; i < roundEnd; ++i) {
+            GGXSample const& sample = samples[i];
+            if (sample.NdotL == 0.0f) continue;
+            glm::vec3 lightDir = sample.lightDir.x * tangent + sample.lightDir.y * bitangent + sample.lightDir.z * normal;
+            glm::vec3 radiance = sampleCubemapPyramid(source, lightDir, sample.lod);
+            double luminance = 0.2126 * radiance.r + 0.7152 * radiance.g + 0.0722 * radiance.b;
+            color += radiance * sample.NdotL;
+            weightSum += sample.NdotL;
+            weightSquaredSum += double(sample.NdotL) * sample.NdotL;
+            luminanceSum += sample.NdotL * luminance;
+            luminanceSquaredSum += sample.NdotL * luminance * luminance;
+        }
+        if (i >= count || weightSum == 0.0) break;
+
+        // relative error^2 = variance / (effective sample count * mean^2), effective sample count = weightSum^2 / weightSquaredSum
+        double mean = luminanceSum / weightSum;
+        double variance = std::max(luminanceSquaredSum / weightSum - mean * mean, 0.0);
+        if (mean <= 0.0 || variance * weightSquaredSum <= target2 * mean * mean * weightSum * weightSum) break;
+    }
+
+    usedSampleCount = i;
+    return weightSum > 0.0 ? color / float(weightSum) : glm::vec3(0.0f);
+}
+
+// Writes the tile as RGB rows of the tile width, returns the number of samples taken.
+// Samples come from generateProgressiveGGXSamples when adaptive sampling is set, otherwise from generateGGXSamples.
+uint64_t filterCubemapTileForRoughness(CubemapPyramid const& source, int faceSize, CubemapTile const& tile, std::vector<GGXSample> const& samples, AdaptiveSampling const* adaptive, float* tileData) {
+    int tileWidth = tile.x1 - tile.x0;
+    uint64_t sampleCount = 0;
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            glm::vec3 dir = facePointToDirection(static_cast<CubemapFace>(tile.face), faceSize, x, y);
+
+            // Apply importance sampling based on GGX/Trowbridge-Reitz distribution
+            glm::vec3 filteredColor;
+            if (adaptive) {
+                int usedSampleCount;
+                filteredColor = prefilteredRadianceAdaptive(source, dir, samples, *adaptive, usedSampleCount);
+                sampleCount += usedSampleCount;
+            } else {
+                filteredColor = prefilteredRadiance(source, dir, samples);
+                sampleCount += samples.size();
             }
+
+            size_t pixelIndex = (size_t(y - tile.y0) * tileWidth + (x - tile.x0)) * 3;
+            tileData[pixelIndex + 0] = filteredColor.r;
+            tileData[pixelIndex + 1] = filteredColor.g;
+            tileData[pixelIndex + 2] = filteredColor.b;
         }
     }
-    
-    return cubemapData;
+    return sampleCount;
 }
 
-int saveCubemapMipsToKtx2(const std::vector<std::vector<float>>& mipData, const char* filename, int baseFaceSize) {
-    ktxTexture2* texture;
-    KTX_error_code result;
-    
+// Allocates the whole mip chain of a cubemap in its final format, so tiles can be encoded straight into it
+ktxTexture2* createCubemapKtx2(int baseFaceSize, int numMipLevels, TextureFormat format) {
     ktxTextureCreateInfo createInfo = {
-        .vkFormat = VK_FORMAT_R32G32B32A32_SFLOAT,
+        .vkFormat = static_cast<ktx_uint32_t>(textureFormatToVkFormat(format)),
         .baseWidth = static_cast<ktx_uint32_t>(baseFaceSize),
         .baseHeight = static_cast<ktx_uint32_t>(baseFaceSize),
         .baseDepth = 1,
         .numDimensions = 2,
-        .numLevels = static_cast<ktx_uint32_t>(mipData.size()),
+        .numLevels = static_cast<ktx_uint32_t>(numMipLevels),
         .numLayers = 1,
         .numFaces = 6,
         .isArray = false,
         .generateMipmaps = false,
     };
-    
-    result = ktxTexture2_Create(
-        &createInfo,
-        KTX_TEXTURE_CREATE_ALLOC_STORAGE,
-        &texture
-    );
+    ktxTexture2* texture;
+    KTX_error_code result = ktxTexture2_Create(&createInfo, KTX_TEXTURE_CREATE_ALLOC_STORAGE, &texture);
     if (result != KTX_SUCCESS) {
         std::cerr << "Failed to create KTX2 texture: " << ktxErrorString(result) << std::endl;
-        return -1;
+        return nullptr;
     }
-    
-    // Process each mip level
-    for (ktx_uint32_t mipLevel = 0; mipLevel < mipData.size(); ++mipLevel) {
-        int currentFaceSize = baseFaceSize >> mipLevel; // Divide by 2^mipLevel
-        if (currentFaceSize < 1) currentFaceSize = 1;
-        
-        // Convert RGB data to RGBA by adding alpha channel
-        auto rgbaData = std::make_unique<float[]>(4 * currentFaceSize * currentFaceSize);
-        
-        // Process each face
-        for (ktx_uint32_t face = 0; face < 6; ++face) {
-            // Calculate source offset in RGB data (3 channels per pixel)
-            int srcOffset = face * currentFaceSize * currentFaceSize * 3;
-            
-            // Convert RGB to RGBA for this face
-            for (int pixel = 0; pixel < currentFaceSize * currentFaceSize; ++pixel) {
-                int srcIdx = srcOffset + pixel * 3;
-                int dstIdx = pixel * 4;
-                
-                rgbaData[dstIdx + 0] = mipData[mipLevel][srcIdx + 0]; // R
-                rgbaData[dstIdx + 1] = mipData[mipLevel][srcIdx + 1]; // G
-                rgbaData[dstIdx + 2] = mipData[mipLevel][srcIdx + 2]; // B
-                rgbaData[dstIdx + 3] = 1.0f; // A (alpha = 1.0)
-            }
-            
-            ktx_size_t faceDataSize = 4 * sizeof(float) * currentFaceSize * currentFaceSize;
-            
-            result = ktxTexture_SetImageFromMemory(
-                ktxTexture(texture),
-                mipLevel,
-                0, // layer
-                face,
-                reinterpret_cast<ktx_uint8_t*>(rgbaData.get()),
-                faceDataSize
-            );
-            
-            if (result != KTX_SUCCESS) {
-                std::cerr << "Failed to set image data for mip " << mipLevel 
-                          << ", face " << face << ": " << ktxErrorString(result) << std::endl;
-                ktxTexture_Destroy(ktxTexture(texture));
-                return -1;
+    return texture;
+}
+
+// Encodes RGB texels of a tile into its slot of the texture, rowStride is the distance between rows in texels.
+// Tile origins are multiples of 4, so BC6H blocks never straddle tiles; blocks crossing the face edge repeat the edge texels.
+void storeCubemapTile(ktxTexture2* texture, TextureEncoding const& encoding, int faceSize, CubemapTile const& tile, const float* rgb, size_t rowStride) {
+    ktx_size_t offset;
+    ktxTexture_GetImageOffset(ktxTexture(texture), tile.mip, 0, tile.face, &offset);
+    uint8_t* faceData = ktxTexture_GetData(ktxTexture(texture)) + offset;
+
+    if (encoding.format == TextureFormat::BC6H) {
+        int blocksX = (faceSize + 3) / 4;
+        float block[16][3];
+        for (int by = tile.y0 / 4; by * 4 < tile.y1; ++by) {
+            for (int bx = tile.x0 / 4; bx * 4 < tile.x1; ++bx) {
+                for (int t = 0; t < 16; ++t) {
+                    int x = std::min(bx * 4 + t % 4, tile.x1 - 1) - tile.x0;
+                    int y = std::min(by * 4 + t / 4, tile.y1 - 1) - tile.y0;
+                    const float* texel = rgb + (y * rowStride + x) * 3;
+                    for (int c = 0; c < 3; ++c) block[t][c] = texel[c];
+                }
+                encodeBC6HBlock(block, encoding.bc6hQuality, faceData + (size_t(by) * blocksX + bx) * 16);
             }
         }
+        return;
     }
-    
-    result = ktxTexture_WriteToNamedFile(ktxTexture(texture), filename);
-    if (result != KTX_SUCCESS) {
-        std::cerr << "Failed to write KTX2 file: " << ktxErrorString(result) << std::endl;
-        ktxTexture_Destroy(ktxTexture(texture));
-        return -1;
+
+    size_t texelSize = textureFormatTexelSize(encoding.format);
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        encodeTexels(
+            encoding.format,
+            rgb + (y - tile.y0) * rowStride * 3,
+            3,
+            tile.x1 - tile.x0,
+            faceData + (size_t(y) * faceSize + tile.x0) * texelSize
+        );
     }
-    
-    ktxTexture_Destroy(ktxTexture(texture));
-    return 0;
 }
 
-int prefilterEnvmap(const ImageData& inputImage, const char* outputFileName, int baseFaceSize, int sampleCount) {
+// baseLevel is the environment converted to a cubemap, it becomes mip 0 (roughness 0)
+int prefilterEnvmap(
+    ThreadPool& threadPool,
+    SamplingTables& samplingTables,
+    std::vector<float> baseLevel,
+    const char* outputFileName,
+    int baseFaceSize,
+    int sampleCount,
+    uint32_t seed = 0,
+    TextureEncoding const& encoding = {TextureFormat::RGBA32F},
+    AdaptiveSampling const* adaptive = nullptr
+) {
+    PROFILE_ME_AS("prefilterEnvmap");
     // Calculate number of mip levels based on face size
     int numMipLevels = static_cast<int>(std::floor(std::log2(baseFaceSize))) + 1;
-    
-    // Create cubemap data for all mip levels
-    std::vector<std::vector<float>> cubemapMips;
-    cubemapMips.resize(numMipLevels);
 
-    // Base level contains original map
-    cubemapMips[0] = convertEquirectangularToCubemap(inputImage, baseFaceSize);
-    
-    // mips 1+ contain prefiltered data for specular reflections
-    for (int mip = 1; mip < numMipLevels; ++mip) {
-        int faceSize = baseFaceSize >> mip; // Divide by 2^mip
-        if (faceSize < 1) faceSize = 1;
-        
-        // Calculate roughness for this mip level
+    // Every tile is encoded into its final place, there are no intermediate mip images
+    ktxTexture2* texture = createCubemapKtx2(baseFaceSize, numMipLevels, encoding.format);
+    if (!texture) {
+        return -1;
+    }
+
+    // Prefiltering reads from a box filtered pyramid of the base level, its level 0 is also the source of mip 0
+    CubemapPyramid source = buildCubemapPyramid(threadPool, std::move(baseLevel), baseFaceSize);
+
+    // Tiles of all mip levels are scheduled at once, so the cheap small mips fill the gaps
+    // instead of leaving cores idle at the end of each level.
+    std::vector<CubemapTile> tiles;
+    std::vector<std::shared_ptr<const SamplingTables::GGXSamples>> mipSamples(numMipLevels);
+    uint32_t scramble = hashSeed(seed);
+    for (int mip = 0; mip < numMipLevels; ++mip) {
+        int faceSize = std::max(baseFaceSize >> mip, 1); // Divide by 2^mip
+        appendCubemapTiles(tiles, mip, faceSize);
+        if (mip == 0) continue;
+
+        // mips 1+ contain prefiltered data for specular reflections
         // Mip 0 = roughness 0 (mirror), higher mips = higher roughness
         float roughness = static_cast<float>(mip) / static_cast<float>(numMipLevels - 1);
-        
-        // Generate filtered cubemap for this roughness level
-        std::vector<float> filteredCubemap = filterCubemapForRoughness(inputImage, faceSize, roughness, sampleCount);
-        cubemapMips[mip] = std::move(filteredCubemap);
+        mipSamples[mip] = adaptive
+            ? samplingTables.progressiveGGXSamples(roughness, *adaptive, baseFaceSize, scramble)
+            : samplingTables.ggxSamples(roughness, sampleCount, baseFaceSize, scramble);
     }
-    
-    return saveCubemapMipsToKtx2(cubemapMips, outputFileName, baseFaceSize);
+
+    std::atomic<uint64_t> totalSampleCount = 0;
+    uint64_t filteredTexelCount = 0;
+    for (int mip = 1; mip < numMipLevels; ++mip) {
+        filteredTexelCount += 6 * uint64_t(std::max(baseFaceSize >> mip, 1)) * std::max(baseFaceSize >> mip, 1);
+    }
+
+    threadPool.parallelFor(tiles.size(), [&](size_t i) {
+        CubemapTile const& tile = tiles[i];
+        int faceSize = std::max(baseFaceSize >> tile.mip, 1);
+        if (tile.mip == 0) {
+            const float* base = source.levels[0].data() + ((size_t(tile.face) * faceSize + tile.y0) * faceSize + tile.x0) * 3;
+            storeCubemapTile(texture, encoding, faceSize, tile, base, faceSize);
+            return;
+        }
+        PROFILE_ME_AS("prefilterTile");
+        float tileData[CUBEMAP_TILE_SIZE * CUBEMAP_TILE_SIZE * 3];
+        totalSampleCount += filterCubemapTileForRoughness(source, faceSize, tile, *mipSamples[tile.mip], adaptive, tileData);
+        storeCubemapTile(texture, encoding, faceSize, tile, tileData, tile.x1 - tile.x0);
+    });
+    // One write per line, other jobs print concurrently
+    if (filteredTexelCount > 0) {
+        std::cout << std::string(outputFileName) + ": " + std::to_string(totalSampleCount) + " specular samples, "
+            + std::to_string(totalSampleCount / filteredTexelCount) + " per texel\n" << std::flush;
+    }
+
+    int status = writeKtx2ToFile(texture, outputFileName, encoding.zstdLevel);
+    ktxTexture_Destroy(ktxTexture(texture));
+    return status;
 }
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "CubemapFunctions.h"
+#include "SphericalHarmonics.h"
+#include "SunExtraction.h"
+#include "EquirectangularReader.h"
+#include "ThreadPool.h"
+
+/*
+Streaming passes over an equirectangular panorama.
+
+The panorama is read band by band (see EquirectangularReader), work inside a band is spread over the thread pool.
+Peak memory is one band plus the outputs, regardless of the panorama size.
+Reductions are done in row order, so results don't depend on the number of threads.
+*/
+
+// Rows per parallel task within a band
+constexpr int INGEST_ROWS_PER_TASK = 8;
+// Cubemap texels per parallel task within a band
+constexpr size_t INGEST_TEXELS_PER_TASK = 4096;
+
+SunPeak findSunPeak(ThreadPool& threadPool, EquirectangularReader& reader) {
+    int width = reader.getWidth();
+    int height = reader.getHeight();
+    int bandHeight = reader.getBandHeight();
+    std::vector<float> rows;
+    SunPeak peak;
+    for (int bandBegin = 0; bandBegin < height; bandBegin += bandHeight) {
+        int bandEnd = std::min(bandBegin + bandHeight, height);
+        reader.readRows(bandBegin, bandEnd, rows);
+
+        size_t taskCount = (bandEnd - bandBegin + INGEST_ROWS_PER_TASK - 1) / INGEST_ROWS_PER_TASK;
+        std::vector<SunPeak> taskPeaks(taskCount);
+        threadPool.parallelFor(taskCount, [&](size_t task) {
+            int rowBegin = bandBegin + int(task) * INGEST_ROWS_PER_TASK;
+            int rowEnd = std::min(rowBegin + INGEST_ROWS_PER_TASK, bandEnd);
+            findSunPeakInRows(rows.data() + size_t(rowBegin - bandBegin) * width * 4, width, rowBegin, rowEnd, taskPeaks[task]);
+        });
+        for (SunPeak const& taskPeak : taskPeaks) {
+            if (taskPeak.radiance > peak.radiance) peak = taskPeak;
+        }
+    }
+    return peak;
+}
+
+// Reads only the rows around the peak
+ExtractedSunData extractSunAroundPeak(EquirectangularReader& reader, SunPeak peak, float sunSolidAngle, SunRemoval& removal) {
+    int width = reader.getWidth();
+    int height = reader.getHeight();
+    auto [rowBegin, rowEnd] = sunRegionRows(peak, width, height, sunSolidAngle);
+    std::vector<float> rows;
+    reader.readRows(rowBegin, rowEnd, rows);
+    return extractSunFromRows(rows.data(), width, height, rowBegin, rowEnd, peak, sunSolidAngle, removal);
+}
+
+struct IngestedEnvmap {
+    std::vector<float> cubemap;  // base level, RGB
+    std::vector<glm::vec3> diffuseSH;
+};
+
+// Converts the panorama to a cubemap and projects it to SH of the given order in a single pass, removing the sun first if requested
+IngestedEnvmap ingestEquirectangularPanorama(ThreadPool& threadPool, SamplingTables& samplingTables, EquirectangularReader& reader, int faceSize, int shOrder, SunRemoval const* sunRemoval) {
+    PROFILE_ME_AS("ingestEquirectangularPanorama");
+    int width = reader.getWidth();
+    int height = reader.getHeight();
+    int bandHeight = reader.getBandHeight();
+
+    IngestedEnvmap result;
+    result.cubemap.resize(6 * faceSize * faceSize * 3);
+    SHProjector shProjector(width, height, shOrder);
+    std::vector<std::vector<double>> shPartials;
+    auto texelTable = samplingTables.equirectangularTexels(threadPool, faceSize, width, height);
+    std::vector<std::vector<uint32_t>> bandTexels = groupCubemapTexelsByBand(threadPool, *texelTable, faceSize, height, bandHeight);
+
+    std::vector<float> rows;
+    for (int bandBegin = 0; bandBegin < height; bandBegin += bandHeight) {
+        int bandEnd = std::min(bandBegin + bandHeight, height);
+        // One extra row for the bottom taps of bilinear filtering
+        int readEnd = std::min(bandEnd + 1, height);
+        {
+            PROFILE_ME_AS("readRows");
+            reader.readRows(bandBegin, readEnd, rows);
+        }
+        if (sunRemoval) {
+            removeSunFromRows(rows.data(), width, height, bandBegin, readEnd, *sunRemoval);
+        }
+
+        size_t shTaskCount = (bandEnd - bandBegin + INGEST_ROWS_PER_TASK - 1) / INGEST_ROWS_PER_TASK;
+        size_t shPartialBegin = shPartials.size();
+        shPartials.resize(shPartialBegin + shTaskCount);
+        std::vector<uint32_t> const& texels = bandTexels[bandBegin / bandHeight];
+        size_t texelTaskCount = (texels.size() + INGEST_TEXELS_PER_TASK - 1) / INGEST_TEXELS_PER_TASK;
+        EquirectangularRows bandRows = {rows.data(), width, height, bandBegin, readEnd};
+
+        threadPool.parallelFor(shTaskCount + texelTaskCount, [&](size_t task) {
+            if (task < shTaskCount) {
+                int rowBegin = bandBegin + int(task) * INGEST_ROWS_PER_TASK;
+                int rowEnd = std::min(rowBegin + INGEST_ROWS_PER_TASK, bandEnd);
+                shProjector.accumulateRows(rows.data() + size_t(rowBegin - bandBegin) * width * 4, rowBegin, rowEnd, shPartials[shPartialBegin + task]);
+            } else {
+                size_t begin = (task - shTaskCount) * INGEST_TEXELS_PER_TASK;
+                size_t count = std::min(INGEST_TEXELS_PER_TASK, texels.size() - begin);
+                convertEquirectangularRowsToCubemapTexels(bandRows, *texelTable, texels.data() + begin, count, result.cubemap.data());
+            }
+        });
+    }
+
+    result.diffuseSH = SHProjector::toCoefficients(reduceSHPartials(std::move(shPartials)));
+    applyLambertianConvolution(result.diffuseSH);
+    return result;
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// AVX2 kernels are compiled for that target per function and picked at run time, the rest of the baker stays baseline x86-64
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define EQUIRECT_BATCH_AVX2 1
+#define EQUIRECT_BATCH_AVX2_TARGET __attribute__((target("avx2,fma")))
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define EQUIRECT_BATCH_NEON 1
+#endif
+
+/*
+Batched lookups into an RGBA float equirectangular image, in two steps:
+directions to continuous source pixel coordinates, and bilinear fetches at such coordinates.
+
+Directions, coordinates and results are passed as separate arrays (SoA),
+so every step maps directly onto vector registers: 8 lanes with AVX2 (when the CPU supports it), 4 lanes with NEON.
+atan2 and asin are replaced by polynomial approximations (max error ~1e-5 rad, well below a texel of a 16k panorama).
+The scalar fallback uses the same polynomials, so all paths produce the same texel coordinates up to rounding.
+Mapping: u = (atan2(x, -z) + pi) / 2pi, v = (asin(-y) + pi/2) / pi with (0, 0) at the top-left corner,
+so the default camera direction (-Z) looks at the center of the panorama. Pixel coordinates are uv * (size - 1),
+bilinear lookups wrap horizontally.
+*/
+
+// Rows [rowBegin, rowEnd) of a width x height RGBA float equirectangular image.
+// rgba points to the first texel of rowBegin. Lookups outside of the rows are clamped to them.
+struct EquirectangularRows {
+    const float* rgba;
+    int width;
+    int height;
+    int rowBegin;
+    int rowEnd;
+};
+
+namespace equirect_batch {
+
+constexpr float PI = 3.14159265358979f;
+constexpr float HALF_PI = 1.57079632679490f;
+
+// atan(t) for t in [0, 1]
+constexpr float ATAN_C0 = 0.99997726f;
+constexpr float ATAN_C1 = -0.33262347f;
+constexpr float ATAN_C2 = 0.19354346f;
+constexpr float ATAN_C3 = -0.11643287f;
+constexpr float ATAN_C4 = 0.05265332f;
+constexpr float ATAN_C5 = -0.01172120f;
+
+// asin(x) = pi/2 - sqrt(1 - x) * P(x) for x in [0, 1] (Abramowitz & Stegun 4.4.46)
+constexpr float ASIN_C0 = 1.5707963050f;
+constexpr float ASIN_C1 = -0.2145988016f;
+constexpr float ASIN_C2 = 0.0889789874f;
+constexpr float ASIN_C3 = -0.0501743046f;
+constexpr float ASIN_C4 = 0.0308918810f;
+constexpr float ASIN_C5 = -0.0170881256f;
+constexpr float ASIN_C6 = 0.0066700901f;
+constexpr float ASIN_C7 = -0.0012624911f;
+
+float atan2Approx(float y, float x) {
+    float ax = std::abs(x);
+    float ay = std::abs(y);
+    float t = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f);
+    float t2 = t * t;
+    float r = t * (ATAN_C0 + t2 * (ATAN_C1 + t2 * (ATAN_C2 + t2 * (ATAN_C3 + t2 * (ATAN_C4 + t2 * ATAN_C5)))));
+    if (ay > ax) r = HALF_PI - r;
+    if (x < 0.0f) r = PI - r;
+    // Sign bit, not y < 0: -0 gives -pi at the seam like the vector paths
+    return std::signbit(y) ? -r : r;
+}
+
+float asinApprox(float x) {
+    float ax = std::min(std::abs(x), 1.0f);
+    float p = ASIN_C0 + ax * (ASIN_C1 + ax * (ASIN_C2 + ax * (ASIN_C3 + ax * (ASIN_C4 + ax * (ASIN_C5 + ax * (ASIN_C6 + ax * ASIN_C7))))));
+    float r = HALF_PI - std::sqrt(1.0f - ax) * p;
+    return std::signbit(x) ? -r : r;
+}
+
+// Bilinear sample at continuous pixel coordinates, wrapping horizontally
+void sampleBilinear(EquirectangularRows const& rows, float px, float py, float& r, float& g, float& b) {
+    int width = rows.width;
+    int x0 = std::clamp(static_cast<int>(std::floor(px)), 0, width - 1);
+    int y0 = std::clamp(static_cast<int>(std::floor(py)), rows.rowBegin, rows.rowEnd - 1);
+    int x1 = (x0 + 1) % width;
+    int y1 = std::min(y0 + 1, rows.rowEnd - 1);
+    float fx = px - x0;
+    float fy = py - y0;
+    y0 -= rows.rowBegin;
+    y1 -= rows.rowBegin;
+
+    const float* p00 = rows.rgba + (size_t(y0) * width + x0) * 4;
+    const float* p01 = rows.rgba + (size_t(y0) * width + x1) * 4;
+    const float* p10 = rows.rgba + (size_t(y1) * width + x0) * 4;
+    const float* p11 = rows.rgba + (size_t(y1) * width + x1) * 4;
+    float w00 = (1 - fx) * (1 - fy);
+    float w01 = fx * (1 - fy);
+    float w10 = (1 - fx) * fy;
+    float w11 = fx * fy;
+    r = p00[0] * w00 + p01[0] * w01 + p10[0] * w10 + p11[0] * w11;
+    g = p00[1] * w00 + p01[1] * w01 + p10[1] * w10 + p11[1] * w11;
+    b = p00[2] * w00 + p01[2] * w01 + p10[2] * w10 + p11[2] * w11;
+}
+
+void sourceCoordinatesScalar(float x, float y, float z, int width, int height, float& px, float& py) {
+    float u = (atan2Approx(x, -z) + PI) * (0.5f / PI);
+    float v = (asinApprox(-y) + HALF_PI) * (1.0f / PI);
+    px = u * (width - 1);
+    py = v * (height - 1);
+}
+
+#if EQUIRECT_BATCH_AVX2
+
+bool cpuSupportsAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+}
+
+EQUIRECT_BATCH_AVX2_TARGET
+__m256 atan2Avx2(__m256 y, __m256 x) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 ax = _mm256_andnot_ps(signMask, x);
+    __m256 ay = _mm256_andnot_ps(signMask, y);
+    __m256 mx = _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(1e-30f));
+    __m256 t = _mm256_div_ps(_mm256_min_ps(ax, ay), mx);
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_set1_ps(ATAN_C5);
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(ATAN_C4));
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(ATAN_C3));
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(ATAN_C2));
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(ATAN_C1));
+    p = _mm256_fmadd_ps(p, t2, _mm256_set1_ps(ATAN_C0));
+    __m256 r = _mm256_mul_ps(p, t);
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(HALF_PI), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(PI), r), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+    return _mm256_or_ps(r, _mm256_and_ps(y, signMask));
+}
+
+EQUIRECT_BATCH_AVX2_TARGET
+__m256 asinAvx2(__m256 x) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 ax = _mm256_min_ps(_mm256_andnot_ps(signMask, x), _mm256_set1_ps(1.0f));
+    __m256 p = _mm256_set1_ps(ASIN_C7);
+    p = _mm256_fmadd_ps(p, ax, _mm256_set1_ps(ASIN_C6));
+    p = _mm256_fmadd_ps(p, ax, _mm256_set1_ps(ASIN_C5));
+    p = _mm256_fmadd_ps(p, ax, _mm256_set1_ps(ASIN_C4));
+    p = _mm256_fmadd_ps(p, ax, _mm256_set1_ps(ASIN_C3));
+    p = _mm256_fmadd_ps(p, ax, _mm256_set1_ps(ASIN_C2));
+    p = _mm256_fmadd_ps(p, ax, _mm256_set1_ps(ASIN_C1));
+    p = _mm256_fmadd_ps(p, ax, _mm256_set1_ps(ASIN_C0));
+    __m256 r = _mm256_fnmadd_ps(_mm256_sqrt_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), ax)), p, _mm256_set1_ps(HALF_PI));
+    return _mm256_or_ps(r, _mm256_and_ps(x, signMask));
+}
+
+// Bilinear weighted sum of one channel of the four corners
+EQUIRECT_BATCH_AVX2_TARGET
+__m256 gatherBilinearAvx2(const float* channel, __m256i i00, __m256i i01, __m256i i10, __m256i i11,
+                          __m256 w00, __m256 w01, __m256 w10, __m256 w11) {
+    __m256 v = _mm256_mul_ps(_mm256_i32gather_ps(channel, i00, 4), w00);
+    v = _mm256_fmadd_ps(_mm256_i32gather_ps(channel, i01, 4), w01, v);
+    v = _mm256_fmadd_ps(_mm256_i32gather_ps(channel, i10, 4), w10, v);
+    return _mm256_fmadd_ps(_mm256_i32gather_ps(channel, i11, 4), w11, v);
+}
+
+EQUIRECT_BATCH_AVX2_TARGET
+void sourceCoordinatesAvx2(const float* x, const float* y, const float* z, int width, int height, float* px, float* py) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 phi = atan2Avx2(_mm256_loadu_ps(x), _mm256_xor_ps(_mm256_loadu_ps(z), signMask));
+    __m256 theta = asinAvx2(_mm256_xor_ps(_mm256_loadu_ps(y), signMask));
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(phi, _mm256_set1_ps(PI)), _mm256_set1_ps(0.5f / PI));
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(theta, _mm256_set1_ps(HALF_PI)), _mm256_set1_ps(1.0f / PI));
+    _mm256_storeu_ps(px, _mm256_mul_ps(u, _mm256_set1_ps(float(width - 1))));
+    _mm256_storeu_ps(py, _mm256_mul_ps(v, _mm256_set1_ps(float(height - 1))));
+}
+
+EQUIRECT_BATCH_AVX2_TARGET
+void sampleBilinearAvx2(EquirectangularRows const& rows, const float* sourceX, const float* sourceY, float* r, float* g, float* b) {
+    int width = rows.width;
+    __m256 px = _mm256_loadu_ps(sourceX);
+    __m256 py = _mm256_loadu_ps(sourceY);
+
+    __m256i x0 = _mm256_cvttps_epi32(_mm256_floor_ps(px));
+    __m256i y0 = _mm256_cvttps_epi32(_mm256_floor_ps(py));
+    x0 = _mm256_min_epi32(_mm256_max_epi32(x0, _mm256_setzero_si256()), _mm256_set1_epi32(width - 1));
+    y0 = _mm256_min_epi32(_mm256_max_epi32(y0, _mm256_set1_epi32(rows.rowBegin)), _mm256_set1_epi32(rows.rowEnd - 1));
+    __m256i x1 = _mm256_add_epi32(x0, _mm256_set1_epi32(1));
+    x1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(x1, _mm256_set1_epi32(width)), x1);  // wrap to 0
+    __m256i y1 = _mm256_min_epi32(_mm256_add_epi32(y0, _mm256_set1_epi32(1)), _mm256_set1_epi32(rows.rowEnd - 1));
+
+    __m256 fx = _mm256_sub_ps(px, _mm256_cvtepi32_ps(x0));
+    __m256 fy = _mm256_sub_ps(py, _mm256_cvtepi32_ps(y0));
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 gx = _mm256_sub_ps(one, fx);
+    __m256 gy = _mm256_sub_ps(one, fy);
+    __m256 w00 = _mm256_mul_ps(gx, gy);
+    __m256 w01 = _mm256_mul_ps(fx, gy);
+    __m256 w10 = _mm256_mul_ps(gx, fy);
+    __m256 w11 = _mm256_mul_ps(fx, fy);
+
+    // Offsets of RGBA texels in floats
+    __m256i rowWidth = _mm256_set1_epi32(width);
+    __m256i rowBegin = _mm256_set1_epi32(rows.rowBegin);
+    __m256i row0 = _mm256_mullo_epi32(_mm256_sub_epi32(y0, rowBegin), rowWidth);
+    __m256i row1 = _mm256_mullo_epi32(_mm256_sub_epi32(y1, rowBegin), rowWidth);
+    __m256i i00 = _mm256_slli_epi32(_mm256_add_epi32(row0, x0), 2);
+    __m256i i01 = _mm256_slli_epi32(_mm256_add_epi32(row0, x1), 2);
+    __m256i i10 = _mm256_slli_epi32(_mm256_add_epi32(row1, x0), 2);
+    __m256i i11 = _mm256_slli_epi32(_mm256_add_epi32(row1, x1), 2);
+
+    _mm256_storeu_ps(r, gatherBilinearAvx2(rows.rgba + 0, i00, i01, i10, i11, w00, w01, w10, w11));
+    _mm256_storeu_ps(g, gatherBilinearAvx2(rows.rgba + 1, i00, i01, i10, i11, w00, w01, w10, w11));
+    _mm256_storeu_ps(b, gatherBilinearAvx2(rows.rgba + 2, i00, i01, i10, i11, w00, w01, w10, w11));
+}
+
+#elif EQUIRECT_BATCH_NEON
+
+// r with the sign bit of s, r is non-negative
+float32x4_t copySignBitNeon(float32x4_t r, float32x4_t s) {
+    uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(s), vdupq_n_u32(0x80000000u));
+    return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(r), sign));
+}
+
+float32x4_t atan2Neon(float32x4_t y, float32x4_t x) {
+    float32x4_t ax = vabsq_f32(x);
+    float32x4_t ay = vabsq_f32(y);
+    float32x4_t mx = vmaxq_f32(vmaxq_f32(ax, ay), vdupq_n_f32(1e-30f));
+    float32x4_t t = vdivq_f32(vminq_f32(ax, ay), mx);
+    float32x4_t t2 = vmulq_f32(t, t);
+    float32x4_t p = vdupq_n_f32(ATAN_C5);
+    p = vfmaq_f32(vdupq_n_f32(ATAN_C4), p, t2);
+    p = vfmaq_f32(vdupq_n_f32(ATAN_C3), p, t2);
+    p = vfmaq_f32(vdupq_n_f32(ATAN_C2), p, t2);
+    p = vfmaq_f32(vdupq_n_f32(ATAN_C1), p, t2);
+    p = vfmaq_f32(vdupq_n_f32(ATAN_C0), p, t2);
+    float32x4_t r = vmulq_f32(p, t);
+    r = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(vdupq_n_f32(HALF_PI), r), r);
+    r = vbslq_f32(vcltq_f32(x, vdupq_n_f32(0.0f)), vsubq_f32(vdupq_n_f32(PI), r), r);
+    return copySignBitNeon(r, y);
+}
+
+float32x4_t asinNeon(float32x4_t x) {
+    float32x4_t ax = vminq_f32(vabsq_f32(x), vdupq_n_f32(1.0f));
+    float32x4_t p = vdupq_n_f32(ASIN_C7);
+    p = vfmaq_f32(vdupq_n_f32(ASIN_C6), p, ax);
+    p = vfmaq_f32(vdupq_n_f32(ASIN_C5), p, ax);
+    p = vfmaq_f32(vdupq_n_f32(ASIN_C4), p, ax);
+    p = vfmaq_f32(vdupq_n_f32(ASIN_C3), p, ax);
+    p = vfmaq_f32(vdupq_n_f32(ASIN_C2), p, ax);
+    p = vfmaq_f32(vdupq_n_f32(ASIN_C1), p, ax);
+    p = vfmaq_f32(vdupq_n_f32(ASIN_C0), p, ax);
+    float32x4_t r = vfmsq_f32(vdupq_n_f32(HALF_PI), vsqrtq_f32(vsubq_f32(vdupq_n_f32(1.0f), ax)), p);
+    return copySignBitNeon(r, x);
+}
+
+// NEON has no gather, bilinear fetches use the scalar path
+void sourceCoordinatesNeon(const float* x, const float* y, const float* z, int width, int height, float* px, float* py) {
+    float32x4_t phi = atan2Neon(vld1q_f32(x), vnegq_f32(vld1q_f32(z)));
+    float32x4_t theta = asinNeon(vnegq_f32(vld1q_f32(y)));
+    float32x4_t u = vmulq_f32(vaddq_f32(phi, vdupq_n_f32(PI)), vdupq_n_f32(0.5f / PI));
+    float32x4_t v = vmulq_f32(vaddq_f32(theta, vdupq_n_f32(HALF_PI)), vdupq_n_f32(1.0f / PI));
+    vst1q_f32(px, vmulq_f32(u, vdupq_n_f32(float(width - 1))));
+    vst1q_f32(py, vmulq_f32(v, vdupq_n_f32(float(height - 1))));
+}
+
+#endif
+
+} // namespace equirect_batch
+
+// Continuous source pixel coordinates (px[i], py[i]) of count normalized directions (x[i], y[i], z[i]).
+// Arrays don't need any particular alignment.
+void equirectangularSourceCoordinates(const float* x, const float* y, const float* z, int width, int height,
+                                      float* px, float* py, size_t count) {
+    size_t i = 0;
+#if EQUIRECT_BATCH_AVX2
+    if (equirect_batch::cpuSupportsAvx2()) {
+        for (; i + 8 <= count; i += 8) {
+            equirect_batch::sourceCoordinatesAvx2(x + i, y + i, z + i, width, height, px + i, py + i);
+        }
+    }
+#elif EQUIRECT_BATCH_NEON
+    for (; i + 4 <= count; i += 4) {
+        equirect_batch::sourceCoordinatesNeon(x + i, y + i, z + i, width, height, px + i, py + i);
+    }
+#endif
+    for (; i < count; ++i) {
+        equirect_batch::sourceCoordinatesScalar(x[i], y[i], z[i], width, height, px[i], py[i]);
+    }
+}
+
+// Bilinear lookups at count source coordinates from equirectangularSourceCoordinates into r/g/b arrays
+void sampleEquirectangularAt(EquirectangularRows const& rows, const float* px, const float* py,
+                             float* r, float* g, float* b, size_t count) {
+    size_t i = 0;
+#if EQUIRECT_BATCH_AVX2
+    if (equirect_batch::cpuSupportsAvx2()) {
+        for (; i + 8 <= count; i += 8) {
+            equirect_batch::sampleBilinearAvx2(rows, px + i, py + i, r + i, g + i, b + i);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        equirect_batch::sampleBilinear(rows, px[i], py[i], r[i], g[i], b[i]);
+    }
+}
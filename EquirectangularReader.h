@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <tinyexr.h>
+
+/*
+Reads an EXR panorama in horizontal bands of rows,
+so processing of huge panoramas needs memory proportional to the band size rather than to the whole image.
+
+Scanline images are decoded a few chunks at a time: chunks covering the requested rows are handed to tinyexr
+as a standalone image made of the original header bytes, an offset table rewritten for these chunks
+and the chunk data, with the data window narrowed to the band.
+Tiled and multipart images are loaded whole and served from memory.
+*/
+class EquirectangularReader {
+public:
+    explicit EquirectangularReader(const std::string& filename): m_filename(filename) {
+        EXRVersion version;
+        if (ParseEXRVersionFromFile(&version, filename.c_str()) != TINYEXR_SUCCESS) {
+            throw std::runtime_error("not an EXR file: " + filename);
+        }
+        if (version.tiled || version.multipart || version.non_image) {
+            loadWhole();
+            return;
+        }
+
+        InitEXRHeader(&m_header);
+        m_headerValid = true;
+        const char* err = nullptr;
+        if (ParseEXRHeaderFromFile(&m_header, &version, filename.c_str(), &err) != TINYEXR_SUCCESS) {
+            throwExrError("failed to parse EXR header", err);
+        }
+        if (m_header.tiled) {
+            FreeEXRHeader(&m_header);
+            m_headerValid = false;
+            loadWhole();
+            return;
+        }
+        for (int c = 0; c < m_header.num_channels; ++c) {
+            if (m_header.pixel_types[c] == TINYEXR_PIXELTYPE_HALF) {
+                m_header.requested_pixel_types[c] = TINYEXR_PIXELTYPE_FLOAT;
+            }
+        }
+        findChannels();
+
+        m_width = m_header.data_window.max_x - m_header.data_window.min_x + 1;
+        m_height = m_header.data_window.max_y - m_header.data_window.min_y + 1;
+        m_linesPerChunk = linesPerChunk(m_header.compression_type);
+        int chunkCount = m_header.chunk_count > 0 ? m_header.chunk_count : (m_height + m_linesPerChunk - 1) / m_linesPerChunk;
+
+        // Header bytes are copied into every band, the offset table follows them
+        m_file.open(filename, std::ios::binary);
+        m_headerBytes.resize(8 + m_header.header_len);
+        m_offsets.resize(chunkCount);
+        m_file.read(reinterpret_cast<char*>(m_headerBytes.data()), m_headerBytes.size());
+        m_file.read(reinterpret_cast<char*>(m_offsets.data()), m_offsets.size() * sizeof(uint64_t));
+        if (!m_file) {
+            throw std::runtime_error("failed to read EXR offset table: " + filename);
+        }
+        for (uint64_t offset : m_offsets) {
+            if (offset == 0) {
+                // Incomplete file, only tinyexr's own loader can reconstruct the offsets
+                FreeEXRHeader(&m_header);
+                m_headerValid = false;
+                loadWhole();
+                return;
+            }
+        }
+    }
+
+    ~EquirectangularReader() {
+        if (m_headerValid) FreeEXRHeader(&m_header);
+        free(m_wholeImage);
+    }
+
+    EquirectangularReader(const EquirectangularReader&) = delete;
+    EquirectangularReader& operator=(const EquirectangularReader&) = delete;
+
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+
+    // Number of rows per band that keeps a decoded band around 32 MB, aligned to EXR chunks
+    int getBandHeight() const {
+        int rows = std::max((32 << 20) / (m_width * 4 * int(sizeof(float))), 1);
+        rows = std::max(rows / m_linesPerChunk, 1) * m_linesPerChunk;
+        return std::min(rows, m_height);
+    }
+
+    bool isStreaming() const { return m_wholeImage == nullptr; }
+
+    // Decodes rows [rowBegin, rowEnd) as RGBA float
+    void readRows(int rowBegin, int rowEnd, std::vector<float>& rgba) {
+        rowBegin = std::clamp(rowBegin, 0, m_height);
+        rowEnd = std::clamp(rowEnd, rowBegin, m_height);
+        rgba.resize(size_t(rowEnd - rowBegin) * m_width * 4);
+        if (rowBegin == rowEnd) return;
+
+        if (!isStreaming()) {
+            std::copy_n(m_wholeImage + size_t(rowBegin) * m_width * 4, rgba.size(), rgba.data());
+            return;
+        }
+
+        int firstChunk = rowBegin / m_linesPerChunk;
+        int endChunk = std::min((rowEnd + m_linesPerChunk - 1) / m_linesPerChunk, int(m_offsets.size()));
+        int chunkCount = endChunk - firstChunk;
+
+        // Standalone image: header, offset table, chunks
+        std::vector<unsigned char>& memory = m_bandMemory;
+        memory.assign(m_headerBytes.begin(), m_headerBytes.end());
+        size_t tableOffset = memory.size();
+        memory.resize(tableOffset + chunkCount * sizeof(uint64_t));
+        for (int i = 0; i < chunkCount; ++i) {
+            uint64_t chunkOffset = memory.size();
+            std::memcpy(memory.data() + tableOffset + i * sizeof(uint64_t), &chunkOffset, sizeof(uint64_t));
+
+            // Chunk: int32 line number, int32 data size, data
+            int32_t chunkHeader[2];
+            m_file.seekg(m_offsets[firstChunk + i]);
+            m_file.read(reinterpret_cast<char*>(chunkHeader), sizeof(chunkHeader));
+            if (!m_file || chunkHeader[1] <= 0) {
+                throw std::runtime_error("invalid EXR chunk in " + m_filename);
+            }
+            memory.resize(chunkOffset + sizeof(chunkHeader) + chunkHeader[1]);
+            std::memcpy(memory.data() + chunkOffset, chunkHeader, sizeof(chunkHeader));
+            m_file.read(reinterpret_cast<char*>(memory.data() + chunkOffset + sizeof(chunkHeader)), chunkHeader[1]);
+            if (!m_file) {
+                throw std::runtime_error("truncated EXR file " + m_filename);
+            }
+        }
+
+        EXRHeader bandHeader = m_header;
+        int bandFirstRow = firstChunk * m_linesPerChunk;
+        bandHeader.data_window.min_y = m_header.data_window.min_y + bandFirstRow;
+        bandHeader.data_window.max_y = std::min(m_header.data_window.min_y + endChunk * m_linesPerChunk, m_header.data_window.max_y + 1) - 1;
+        bandHeader.chunk_count = chunkCount;
+
+        EXRImage image;
+        InitEXRImage(&image);
+        const char* err = nullptr;
+        if (LoadEXRImageFromMemory(&image, &bandHeader, memory.data(), memory.size(), &err) != TINYEXR_SUCCESS) {
+            throwExrError("failed to decode EXR rows", err);
+        }
+
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            size_t srcRow = size_t(y - bandFirstRow) * m_width;
+            float* dst = rgba.data() + size_t(y - rowBegin) * m_width * 4;
+            for (int c = 0; c < 4; ++c) {
+                int channel = m_channels[c];
+                if (channel < 0) {
+                    for (int x = 0; x < m_width; ++x) dst[x * 4 + c] = 1.0f;
+                } else if (m_header.requested_pixel_types[channel] == TINYEXR_PIXELTYPE_UINT) {
+                    auto src = reinterpret_cast<const uint32_t*>(image.images[channel]) + srcRow;
+                    for (int x = 0; x < m_width; ++x) dst[x * 4 + c] = float(src[x]);
+                } else {
+                    auto src = reinterpret_cast<const float*>(image.images[channel]) + srcRow;
+                    for (int x = 0; x < m_width; ++x) dst[x * 4 + c] = src[x];
+                }
+            }
+        }
+        FreeEXRImage(&image);
+    }
+
+private:
+    static int linesPerChunk(int compressionType) {
+        switch (compressionType) {
+            case TINYEXR_COMPRESSIONTYPE_ZIP: return 16;
+            case TINYEXR_COMPRESSIONTYPE_PIZ: return 32;
+            case TINYEXR_COMPRESSIONTYPE_ZFP: return 16;
+            default: return 1;
+        }
+    }
+
+    [[noreturn]] void throwExrError(const char* message, const char* err) {
+        std::string text = std::string(message) + " [" + m_filename + "]";
+        if (err) {
+            text += ": " + std::string(err);
+            FreeEXRErrorMessage(err);
+        }
+        throw std::runtime_error(text);
+    }
+
+    // RGBA channel indices, single channel images are treated as gray
+    void findChannels() {
+        const char* names[4] = {"R", "G", "B", "A"};
+        for (int c = 0; c < 4; ++c) {
+            m_channels[c] = -1;
+            for (int i = 0; i < m_header.num_channels; ++i) {
+                if (std::strcmp(m_header.channels[i].name, names[c]) == 0) {
+                    m_channels[c] = i;
+                }
+            }
+        }
+        if (m_channels[0] < 0 && m_channels[1] < 0 && m_channels[2] < 0 && m_header.num_channels == 1) {
+            m_channels[0] = m_channels[1] = m_channels[2] = 0;
+        }
+        if (m_channels[0] < 0 || m_channels[1] < 0 || m_channels[2] < 0) {
+            throw std::runtime_error("EXR file has no RGB channels: " + m_filename);
+        }
+    }
+
+    void loadWhole() {
+        const char* err = nullptr;
+        if (LoadEXR(&m_wholeImage, &m_width, &m_height, m_filename.c_str(), &err) != TINYEXR_SUCCESS) {
+            throwExrError("failed to load EXR file", err);
+        }
+    }
+
+    std::string m_filename;
+    std::ifstream m_file;
+    EXRHeader m_header;
+    bool m_headerValid = false;
+    std::vector<unsigned char> m_headerBytes;
+    std::vector<uint64_t> m_offsets;
+    std::vector<unsigned char> m_bandMemory;
+    int m_channels[4] = {};
+    int m_linesPerChunk = 1;
+    int m_width = 0;
+    int m_height = 0;
+    float* m_wholeImage = nullptr;  // fallback for images that can't be streamed
+};
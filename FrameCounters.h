@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/*
+Amount of work recorded for a frame.
+
+Recording code increments the counters of frameCounters(), the main loop takes a copy
+and resets them once per frame. Rendering is recorded from a single thread, so the counters are plain integers.
+*/
+struct FrameCounters {
+    uint64_t drawCalls = 0;
+    uint64_t triangles = 0;
+    uint64_t pipelineBinds = 0;
+    uint64_t descriptorSetBinds = 0; // vkCmdBindDescriptorSets calls
+    uint64_t vertexBufferBinds = 0;
+    uint64_t indexBufferBinds = 0;
+    uint64_t uniformBytesWritten = 0; // to mapped uniform buffers
+    uint64_t descriptorUpdates = 0; // written descriptors
+
+    // Vertex count of vkCmdDraw or index count of vkCmdDrawIndexed
+    void draw(uint32_t vertexCount, uint32_t instanceCount = 1) {
+        drawCalls++;
+        triangles += uint64_t(vertexCount / 3) * instanceCount;
+    }
+
+    // Calls fn(name, value) for every counter, in declaration order
+    template<typename Fn>
+    void forEach(Fn&& fn) const {
+        fn("drawCalls", drawCalls);
+        fn("triangles", triangles);
+        fn("pipelineBinds", pipelineBinds);
+        fn("descriptorSetBinds", descriptorSetBinds);
+        fn("vertexBufferBinds", vertexBufferBinds);
+        fn("indexBufferBinds", indexBufferBinds);
+        fn("uniformBytesWritten", uniformBytesWritten);
+        fn("descriptorUpdates", descriptorUpdates);
+    }
+};
+
+// Counters of the frame being recorded
+FrameCounters& frameCounters() {
+    static FrameCounters counters;
+    return counters;
+}
+
+/*
+GPU pipeline statistics of whole frames (VK_QUERY_TYPE_PIPELINE_STATISTICS).
+
+Works like GpuTimer: one query per frame in flight, begun before the render pass and ended after it,
+read back without waiting when the frame is started again. Requires the pipelineStatisticsQuery device feature,
+without it the query does nothing and reports no results.
+*/
+class PipelineStatisticsQuery {
+public:
+    struct Statistics {
+        bool valid = false;
+        uint64_t inputAssemblyVertices = 0;
+        uint64_t inputAssemblyPrimitives = 0;
+        uint64_t vertexShaderInvocations = 0;
+        uint64_t clippingInvocations = 0;
+        uint64_t clippingPrimitives = 0;
+        uint64_t fragmentShaderInvocations = 0;
+
+        template<typename Fn>
+        void forEach(Fn&& fn) const {
+            fn("inputAssemblyVertices", inputAssemblyVertices);
+            fn("inputAssemblyPrimitives", inputAssemblyPrimitives);
+            fn("vertexShaderInvocations", vertexShaderInvocations);
+            fn("clippingInvocations", clippingInvocations);
+            fn("clippingPrimitives", clippingPrimitives);
+            fn("fragmentShaderInvocations", fragmentShaderInvocations);
+        }
+    };
+
+    PipelineStatisticsQuery(VkDevice device, uint32_t framesInFlight, bool enabled):
+        m_device(device),
+        m_frameUsed(framesInFlight, false)
+    {
+        if (!enabled) return;
+        VkQueryPoolCreateInfo createInfo {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+            .queryCount = framesInFlight,
+            .pipelineStatistics = STATISTICS,
+        };
+        if (vkCreateQueryPool(m_device, &createInfo, nullptr, &m_queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create pipeline statistics query pool!");
+        }
+    }
+
+    ~PipelineStatisticsQuery() {
+        if (m_queryPool) {
+            vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+        }
+    }
+
+    PipelineStatisticsQuery(const PipelineStatisticsQuery&) = delete;
+    PipelineStatisticsQuery& operator=(const PipelineStatisticsQuery&) = delete;
+
+    bool isSupported() const { return m_queryPool != VK_NULL_HANDLE; }
+
+    // To be called after the fence of the frame was waited on, outside of a render pass
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+        if (!m_queryPool) return;
+        if (m_frameUsed[frameIndex]) {
+            readResults(frameIndex);
+        }
+        vkCmdResetQueryPool(commandBuffer, m_queryPool, frameIndex, 1);
+        vkCmdBeginQuery(commandBuffer, m_queryPool, frameIndex, 0);
+        m_frameUsed[frameIndex] = true;
+    }
+
+    // After the render pass
+    void endFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+        if (!m_queryPool) return;
+        vkCmdEndQuery(commandBuffer, m_queryPool, frameIndex);
+    }
+
+    // Most recent complete results
+    Statistics const& latest() const { return m_latest; }
+
+private:
+    // Results are written in the order of the bits
+    static constexpr VkQueryPipelineStatisticFlags STATISTICS =
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    void readResults(uint32_t frameIndex) {
+        // Six statistics and the availability
+        std::array<uint64_t, 7> results;
+        VkResult result = vkGetQueryPoolResults(
+            m_device,
+            m_queryPool,
+            frameIndex,
+            1,
+            sizeof(results),
+            results.data(),
+            sizeof(results),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+        );
+        if ((result != VK_SUCCESS && result != VK_NOT_READY) || !results[6]) {
+            return;
+        }
+        m_latest = {
+            .valid = true,
+            .inputAssemblyVertices = results[0],
+            .inputAssemblyPrimitives = results[1],
+            .vertexShaderInvocations = results[2],
+            .clippingInvocations = results[3],
+            .clippingPrimitives = results[4],
+            .fragmentShaderInvocations = results[5],
+        };
+    }
+
+    VkDevice m_device;
+    VkQueryPool m_queryPool = VK_NULL_HANDLE;
+    std::vector<bool> m_frameUsed;
+    Statistics m_latest;
+};
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <imgui.h>
+#include "GpuTimer.h"
+#include "FrameCounters.h"
+
+/*
+CPU timings of the last frames.
+
+Frame time is the interval between two beginFrame calls. The main loop is split into phases:
+beginPhase ends the running phase and starts the next one, so every frame is fully covered.
+GPU times and pipeline statistics are attached to the frame during which they became available.
+Work counters are attached to the frame that recorded the work.
+Samples are kept in a ring buffer, percentiles are recomputed every few frames, not on every query.
+*/
+class FrameStats {
+public:
+    enum class Phase {
+        Events,
+        Camera,
+        Acquire,
+        Uniforms,
+        Draw,
+        Gui,
+        Present,
+        Reconfigure,
+        Count,
+    };
+    static constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::Count);
+
+    static const char* phaseName(Phase phase) {
+        switch (phase) {
+            case Phase::Events: return "events";
+            case Phase::Camera: return "camera";
+            case Phase::Acquire: return "acquire";
+            case Phase::Uniforms: return "uniforms";
+            case Phase::Draw: return "draw";
+            case Phase::Gui: return "gui";
+            case Phase::Present: return "present";
+            case Phase::Reconfigure: return "reconfigure";
+            case Phase::Count: break;
+        }
+        return "unknown";
+    }
+
+    // Milliseconds
+    struct Sample {
+        float frameTime = 0;
+        std::array<float, PHASE_COUNT> phaseTimes = {};
+        GpuTimer::Times gpu;
+        FrameCounters counters;
+        PipelineStatisticsQuery::Statistics pipelineStatistics;
+    };
+
+    struct Distribution {
+        float mean = 0;
+        float p50 = 0;
+        float p95 = 0;
+        float p99 = 0;
+        float max = 0;
+    };
+
+    struct Summary {
+        size_t frameCount = 0;
+        Distribution frameTime;
+        std::array<float, PHASE_COUNT> phaseMean = {};
+        std::array<float, PHASE_COUNT> phaseMax = {};
+        // Only frames with valid GPU times
+        size_t gpuFrameCount = 0;
+        Distribution gpuFrameTime;
+        std::array<float, GpuTimer::PHASE_COUNT> gpuPhaseMean = {};
+        std::array<float, GpuTimer::PHASE_COUNT> gpuPhaseMax = {};
+    };
+
+    explicit FrameStats(size_t capacity = 10000) : m_samples(capacity) {}
+
+    // Finishes the previous frame (if any) and starts a new one with the first phase
+    void beginFrame(Phase phase = Phase::Events) {
+        Clock::time_point now = Clock::now();
+        if (m_frameStarted) {
+            endPhase(now);
+            m_current.frameTime = toMs(now - m_frameStart);
+            add(m_current);
+        }
+        m_current = {};
+        m_frameStarted = true;
+        m_frameStart = now;
+        m_phase = phase;
+        m_phaseStart = now;
+    }
+
+    void setGpuTimes(GpuTimer::Times const& times) {
+        m_current.gpu = times;
+    }
+
+    void setPipelineStatistics(PipelineStatisticsQuery::Statistics const& statistics) {
+        m_current.pipelineStatistics = statistics;
+    }
+
+    void setCounters(FrameCounters const& counters) {
+        m_current.counters = counters;
+    }
+
+    void beginPhase(Phase phase) {
+        Clock::time_point now = Clock::now();
+        endPhase(now);
+        m_phase = phase;
+        m_phaseStart = now;
+    }
+
+    // Adds a finished frame, for collecting samples measured by another FrameStats
+    void add(Sample const& sample) {
+        m_samples[m_head % m_samples.size()] = sample;
+        m_head++;
+        m_framesSinceSummary++;
+    }
+
+    size_t size() const { return std::min(m_head, m_samples.size()); }
+
+    // i-th sample of the window, 0 is the oldest
+    Sample const& sample(size_t i) const {
+        return m_samples[(m_head - size() + i) % m_samples.size()];
+    }
+
+    Summary const& summary() {
+        if (m_framesSinceSummary >= SUMMARY_INTERVAL || m_summary.frameCount == 0) {
+            updateSummary();
+        }
+        return m_summary;
+    }
+
+    // One line per frame, oldest first
+    void writeCsv(std::ostream& os) const {
+        os << "frame";
+        for (size_t p = 0; p < PHASE_COUNT; ++p) {
+            os << "," << phaseName(static_cast<Phase>(p));
+        }
+        os << ",gpu frame";
+        for (size_t p = 0; p < GpuTimer::PHASE_COUNT; ++p) {
+            os << ",gpu " << GpuTimer::phaseName(static_cast<GpuTimer::Phase>(p));
+        }
+        FrameCounters{}.forEach([&](const char* name, uint64_t) { os << "," << name; });
+        PipelineStatisticsQuery::Statistics{}.forEach([&](const char* name, uint64_t) { os << "," << name; });
+        os << "\n";
+        for (size_t i = 0; i < size(); ++i) {
+            Sample const& s = sample(i);
+            os << s.frameTime;
+            for (float time : s.phaseTimes) {
+                os << "," << time;
+            }
+            // Empty GPU columns when there were no results
+            os << ",";
+            if (s.gpu.valid) os << s.gpu.frame;
+            for (float time : s.gpu.phases) {
+                os << ",";
+                if (s.gpu.valid) os << time;
+            }
+            s.counters.forEach([&](const char*, uint64_t value) { os << "," << value; });
+            s.pipelineStatistics.forEach([&](const char*, uint64_t value) {
+                os << ",";
+                if (s.pipelineStatistics.valid) os << value;
+            });
+            os << "\n";
+        }
+    }
+
+    // Members of a JSON object, each on its own line starting with indent
+    static void writeSummaryJson(std::ostream& os, Summary const& s, const char* indent) {
+        auto writeDistribution = [&](Distribution const& d) {
+            os << "{\"mean\": " << d.mean << ", \"p50\": " << d.p50 << ", \"p95\": " << d.p95 << ", \"p99\": " << d.p99 << ", \"max\": " << d.max << "}";
+        };
+        os << indent << "\"frameCount\": " << s.frameCount << ",\n" << indent << "\"frameTimeMs\": ";
+        writeDistribution(s.frameTime);
+        os << ",\n" << indent << "\"phasesMs\": {";
+        for (size_t p = 0; p < PHASE_COUNT; ++p) {
+            os << (p ? ", " : "") << "\"" << phaseName(static_cast<Phase>(p)) << "\": {\"mean\": " << s.phaseMean[p] << ", \"max\": " << s.phaseMax[p] << "}";
+        }
+        os << "},\n" << indent << "\"gpuFrameCount\": " << s.gpuFrameCount << ",\n" << indent << "\"gpuFrameTimeMs\": ";
+        writeDistribution(s.gpuFrameTime);
+        os << ",\n" << indent << "\"gpuPhasesMs\": {";
+        for (size_t p = 0; p < GpuTimer::PHASE_COUNT; ++p) {
+            os << (p ? ", " : "") << "\"" << GpuTimer::phaseName(static_cast<GpuTimer::Phase>(p)) << "\": {\"mean\": " << s.gpuPhaseMean[p] << ", \"max\": " << s.gpuPhaseMax[p] << "}";
+        }
+        os << "}";
+    }
+
+    void writeJson(std::ostream& os) {
+        os << "{\n";
+        writeSummaryJson(os, summary(), "  ");
+        // One object per frame for offline analysis
+        os << ",\n  \"frames\": [";
+        for (size_t i = 0; i < size(); ++i) {
+            Sample const& f = sample(i);
+            os << (i ? ",\n    " : "\n    ") << "{\"cpuMs\": " << f.frameTime;
+            if (f.gpu.valid) {
+                os << ", \"gpuMs\": " << f.gpu.frame;
+            }
+            f.counters.forEach([&](const char* name, uint64_t value) { os << ", \"" << name << "\": " << value; });
+            if (f.pipelineStatistics.valid) {
+                f.pipelineStatistics.forEach([&](const char* name, uint64_t value) { os << ", \"" << name << "\": " << value; });
+            }
+            os << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+    // Writes CSV or JSON depending on the file extension
+    bool save(std::string const& fileName) {
+        std::ofstream file(fileName);
+        if (fileName.ends_with(".json")) {
+            writeJson(file);
+        } else {
+            writeCsv(file);
+        }
+        return bool(file);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t SUMMARY_INTERVAL = 30;
+
+    static float toMs(Clock::duration duration) {
+        return std::chrono::duration<float, std::milli>(duration).count();
+    }
+
+    void endPhase(Clock::time_point now) {
+        m_current.phaseTimes[static_cast<size_t>(m_phase)] += toMs(now - m_phaseStart);
+    }
+
+    // Nearest rank percentiles. Every nth_element only partitions the part above the previous rank,
+    // so each value has to be read before the next call reorders that part.
+    static Distribution distribution(std::vector<float>& values) {
+        Distribution d;
+        if (values.empty()) return d;
+        size_t count = values.size();
+        for (float value : values) {
+            d.mean += value;
+        }
+        d.mean /= float(count);
+        size_t from = 0;
+        auto percentile = [&](float fraction) {
+            size_t rank = std::min(count - 1, static_cast<size_t>(fraction * float(count)));
+            std::nth_element(values.begin() + from, values.begin() + rank, values.end());
+            from = rank;
+            return values[rank];
+        };
+        d.p50 = percentile(0.50f);
+        d.p95 = percentile(0.95f);
+        d.p99 = percentile(0.99f);
+        d.max = *std::max_element(values.begin() + from, values.end());
+        return d;
+    }
+
+    void updateSummary() {
+        m_framesSinceSummary = 0;
+        m_summary = {};
+        size_t count = size();
+        if (count == 0) return;
+
+        m_sorted.clear();
+        m_gpuSorted.clear();
+        for (size_t i = 0; i < count; ++i) {
+            Sample const& s = sample(i);
+            m_sorted.push_back(s.frameTime);
+            for (size_t p = 0; p < PHASE_COUNT; ++p) {
+                m_summary.phaseMean[p] += s.phaseTimes[p];
+                m_summary.phaseMax[p] = std::max(m_summary.phaseMax[p], s.phaseTimes[p]);
+            }
+            if (s.gpu.valid) {
+                m_gpuSorted.push_back(s.gpu.frame);
+                for (size_t p = 0; p < GpuTimer::PHASE_COUNT; ++p) {
+                    m_summary.gpuPhaseMean[p] += s.gpu.phases[p];
+                    m_summary.gpuPhaseMax[p] = std::max(m_summary.gpuPhaseMax[p], s.gpu.phases[p]);
+                }
+            }
+        }
+        m_summary.frameCount = count;
+        for (float& mean : m_summary.phaseMean) {
+            mean /= float(count);
+        }
+        m_summary.gpuFrameCount = m_gpuSorted.size();
+        for (float& mean : m_summary.gpuPhaseMean) {
+            mean /= float(std::max<size_t>(m_gpuSorted.size(), 1));
+        }
+        m_summary.frameTime = distribution(m_sorted);
+        m_summary.gpuFrameTime = distribution(m_gpuSorted);
+    }
+
+    std::vector<Sample> m_samples;
+    size_t m_head = 0;
+    Sample m_current;
+    bool m_frameStarted = false;
+    Clock::time_point m_frameStart;
+    Phase m_phase = Phase::Events;
+    Clock::time_point m_phaseStart;
+
+    size_t m_framesSinceSummary = 0;
+    Summary m_summary;
+    std::vector<float> m_sorted;
+    std::vector<float> m_gpuSorted;
+};
+
+void frameStatsGui(FrameStats& stats) {
+    static constexpr int GRAPH_FRAME_COUNT = 300;
+    static char fileName[256] = "frame_stats.csv";
+    static std::string saveStatus;
+
+    ImGui::Begin("Frame Stats");
+    FrameStats::Summary const& summary = stats.summary();
+    auto distributionText = [](const char* label, FrameStats::Distribution const& d) {
+        ImGui::Text("%s: mean %.2f  p50 %.2f  p95 %.2f  p99 %.2f  max %.2f ms", label, d.mean, d.p50, d.p95, d.p99, d.max);
+    };
+    ImGui::Text("%zu frames", summary.frameCount);
+    distributionText("CPU", summary.frameTime);
+    if (summary.gpuFrameCount > 0) {
+        distributionText("GPU", summary.gpuFrameTime);
+    } else {
+        ImGui::TextUnformatted("GPU: no timestamps");
+    }
+
+    // Last frames, fixed scale so spikes stand out instead of rescaling the graph
+    auto getter = [](void* data, int i) -> float {
+        auto& s = *static_cast<FrameStats*>(data);
+        return s.sample(s.size() - std::min<size_t>(s.size(), GRAPH_FRAME_COUNT) + i).frameTime;
+    };
+    int graphCount = static_cast<int>(std::min<size_t>(stats.size(), GRAPH_FRAME_COUNT));
+    float scaleMax = std::max(2.0f * summary.frameTime.p99, 1.0f);
+    ImGui::PlotLines("##frameTimes", getter, &stats, graphCount, 0, "frame time (ms)", 0.0f, scaleMax, ImVec2(0, 80));
+
+    if (ImGui::BeginTable("phases", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("CPU phase");
+        ImGui::TableSetupColumn("mean ms");
+        ImGui::TableSetupColumn("max ms");
+        ImGui::TableHeadersRow();
+        for (size_t p = 0; p < FrameStats::PHASE_COUNT; ++p) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(FrameStats::phaseName(static_cast<FrameStats::Phase>(p)));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", summary.phaseMean[p]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", summary.phaseMax[p]);
+        }
+        ImGui::EndTable();
+    }
+    if (summary.gpuFrameCount > 0 && ImGui::BeginTable("gpuPhases", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("GPU phase");
+        ImGui::TableSetupColumn("mean ms");
+        ImGui::TableSetupColumn("max ms");
+        ImGui::TableHeadersRow();
+        for (size_t p = 0; p < GpuTimer::PHASE_COUNT; ++p) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(GpuTimer::phaseName(static_cast<GpuTimer::Phase>(p)));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", summary.gpuPhaseMean[p]);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", summary.gpuPhaseMax[p]);
+        }
+        ImGui::EndTable();
+    }
+
+    if (stats.size() > 0 && ImGui::CollapsingHeader("Counters (last frame)", ImGuiTreeNodeFlags_DefaultOpen)) {
+        FrameStats::Sample const& last = stats.sample(stats.size() - 1);
+        auto counterText = [](const char* name, uint64_t value) {
+            ImGui::Text("%-26s %llu", name, static_cast<unsigned long long>(value));
+        };
+        last.counters.forEach(counterText);
+        if (last.pipelineStatistics.valid) {
+            last.pipelineStatistics.forEach(counterText);
+        } else {
+            ImGui::TextUnformatted("No pipeline statistics");
+        }
+    }
+
+    ImGui::InputText("File", fileName, sizeof(fileName));
+    if (ImGui::Button("Save (.csv or .json)")) {
+        saveStatus = stats.save(fileName) ? std::string("Saved ") + fileName : std::string("Failed to write ") + fileName;
+    }
+    if (!saveStatus.empty()) {
+        ImGui::TextUnformatted(saveStatus.c_str());
+    }
+    ImGui::End();
+}
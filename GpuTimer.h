@@ -0,0 +1,172 @@
+#pragma once
+
+#include <array>
+#include <stdexcept>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/*
+GPU durations of the render phases, measured with timestamp queries.
+
+Every frame in flight has its own range of queries. The range of a frame is read back when the frame
+is started again, after its fence was waited on, so reading never stalls the CPU.
+Results are therefore framesInFlight frames late.
+When the graphics queue doesn't support timestamps the timer does nothing and reports no results.
+*/
+class GpuTimer {
+public:
+    enum class Phase {
+        Background,
+        Meshes,
+        Tonemap,
+        Gui,
+        Count,
+    };
+    static constexpr size_t PHASE_COUNT = static_cast<size_t>(Phase::Count);
+
+    static const char* phaseName(Phase phase) {
+        switch (phase) {
+            case Phase::Background: return "background";
+            case Phase::Meshes: return "meshes";
+            case Phase::Tonemap: return "tonemap";
+            case Phase::Gui: return "gui";
+            case Phase::Count: break;
+        }
+        return "unknown";
+    }
+
+    // Milliseconds, phases which weren't recorded are 0
+    struct Times {
+        bool valid = false;
+        float frame = 0;
+        std::array<float, PHASE_COUNT> phases = {};
+    };
+
+    // Marks a phase for the lifetime of the object
+    class Scope {
+    public:
+        Scope(GpuTimer& timer, VkCommandBuffer commandBuffer, uint32_t frameIndex, Phase phase):
+            m_timer(timer),
+            m_commandBuffer(commandBuffer),
+            m_frameIndex(frameIndex),
+            m_phase(phase)
+        {
+            m_timer.writeTimestamp(m_commandBuffer, m_frameIndex, 2 + 2 * static_cast<uint32_t>(m_phase), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+        }
+        ~Scope() {
+            m_timer.writeTimestamp(m_commandBuffer, m_frameIndex, 3 + 2 * static_cast<uint32_t>(m_phase), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        GpuTimer& m_timer;
+        VkCommandBuffer m_commandBuffer;
+        uint32_t m_frameIndex;
+        Phase m_phase;
+    };
+
+    GpuTimer(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamilyIndex, uint32_t framesInFlight):
+        m_device(device),
+        m_frameUsed(framesInFlight, false)
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+        uint32_t validBits = queueFamilyIndex < queueFamilyCount ? queueFamilies[queueFamilyIndex].timestampValidBits : 0;
+        if (validBits == 0 || properties.limits.timestampPeriod == 0) {
+            return;
+        }
+        m_timestampMask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+        m_msPerTick = properties.limits.timestampPeriod * 1e-6;
+
+        VkQueryPoolCreateInfo createInfo {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = QUERIES_PER_FRAME * framesInFlight,
+        };
+        if (vkCreateQueryPool(m_device, &createInfo, nullptr, &m_queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create timestamp query pool!");
+        }
+    }
+
+    ~GpuTimer() {
+        if (m_queryPool) {
+            vkDestroyQueryPool(m_device, m_queryPool, nullptr);
+        }
+    }
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    bool isSupported() const { return m_queryPool != VK_NULL_HANDLE; }
+
+    // To be called after the fence of the frame was waited on, outside of a render pass.
+    // Reads the results of the previous use of the frame, then resets its queries and marks the frame start.
+    void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+        if (!m_queryPool) return;
+        if (m_frameUsed[frameIndex]) {
+            readResults(frameIndex);
+        }
+        vkCmdResetQueryPool(commandBuffer, m_queryPool, frameIndex * QUERIES_PER_FRAME, QUERIES_PER_FRAME);
+        m_frameUsed[frameIndex] = true;
+        writeTimestamp(commandBuffer, frameIndex, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    }
+
+    void endFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+        writeTimestamp(commandBuffer, frameIndex, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    }
+
+    // Most recent complete results
+    Times const& latest() const { return m_latest; }
+
+private:
+    // Frame begin, frame end, then begin and end of every phase
+    static constexpr uint32_t QUERIES_PER_FRAME = 2 + 2 * PHASE_COUNT;
+
+    void writeTimestamp(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint32_t query, VkPipelineStageFlagBits stage) {
+        if (!m_queryPool) return;
+        vkCmdWriteTimestamp(commandBuffer, stage, m_queryPool, frameIndex * QUERIES_PER_FRAME + query);
+    }
+
+    void readResults(uint32_t frameIndex) {
+        // Value and availability pairs, phases that weren't recorded this frame are simply unavailable
+        std::array<uint64_t, 2 * QUERIES_PER_FRAME> results;
+        VkResult result = vkGetQueryPoolResults(
+            m_device,
+            m_queryPool,
+            frameIndex * QUERIES_PER_FRAME,
+            QUERIES_PER_FRAME,
+            sizeof(results),
+            results.data(),
+            2 * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+        );
+        if (result != VK_SUCCESS && result != VK_NOT_READY) {
+            return;
+        }
+        auto duration = [&](uint32_t beginQuery, uint32_t endQuery, float& ms) {
+            if (!results[2 * beginQuery + 1] || !results[2 * endQuery + 1]) return false;
+            uint64_t ticks = (results[2 * endQuery] - results[2 * beginQuery]) & m_timestampMask;
+            ms = static_cast<float>(double(ticks) * m_msPerTick);
+            return true;
+        };
+        Times times;
+        times.valid = duration(0, 1, times.frame);
+        if (!times.valid) return;
+        for (uint32_t p = 0; p < PHASE_COUNT; ++p) {
+            duration(2 + 2 * p, 3 + 2 * p, times.phases[p]);
+        }
+        m_latest = times;
+    }
+
+    VkDevice m_device;
+    VkQueryPool m_queryPool = VK_NULL_HANDLE;
+    uint64_t m_timestampMask = 0;
+    double m_msPerTick = 0;
+    std::vector<bool> m_frameUsed;
+    Times m_latest;
+};
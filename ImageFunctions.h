@@ -1,10 +1,13 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <cmath>
 #include <iostream>
 #include <stb_image.h>
 #include <tinyexr.h>
 #include <vulkan/vulkan.h>
+#include <glm/gtc/packing.hpp>
 #include <Profiler.h>
 
 struct ImageData {
@@ -67,3 +70,39 @@ ImageData loadImage(std::string const& filename) {
         return result;
     }
 }
+
+// Saves pixels read back from a render target as a half float EXR, 8-bit sRGB formats are converted to linear
+void saveExr(std::string const& filename, std::vector<uint8_t> const& pixels, VkFormat format, int width, int height) {
+    size_t pixelCount = size_t(width) * height;
+    std::vector<float> rgba(pixelCount * 4);
+    if (format == VK_FORMAT_R16G16B16A16_SFLOAT) {
+        const uint16_t* halfs = reinterpret_cast<const uint16_t*>(pixels.data());
+        for (size_t i = 0; i < rgba.size(); ++i) {
+            rgba[i] = glm::unpackHalf1x16(halfs[i]);
+        }
+    }
+    else if (format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB) {
+        auto toLinear = [](uint8_t value) {
+            float c = value / 255.0f;
+            return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        };
+        bool bgr = format == VK_FORMAT_B8G8R8A8_SRGB;
+        for (size_t i = 0; i < pixelCount; ++i) {
+            const uint8_t* pixel = &pixels[i * 4];
+            rgba[i * 4 + 0] = toLinear(pixel[bgr ? 2 : 0]);
+            rgba[i * 4 + 1] = toLinear(pixel[1]);
+            rgba[i * 4 + 2] = toLinear(pixel[bgr ? 0 : 2]);
+            rgba[i * 4 + 3] = pixel[3] / 255.0f;
+        }
+    }
+    else {
+        throw std::runtime_error("Unsupported format for saving an EXR image");
+    }
+
+    const char* err = nullptr;
+    if (SaveEXR(rgba.data(), width, height, 4, 1, filename.c_str(), &err) != TINYEXR_SUCCESS) {
+        std::string message = err ? err : "unknown error";
+        FreeEXRErrorMessage(err);
+        throw std::runtime_error("Failed to save " + filename + ": " + message);
+    }
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <Profiler.h>
+#include "ThreadPool.h"
+
+/*
+Dependency graph of jobs executed on a ThreadPool.
+
+A job is started as soon as all of its dependencies are finished, so independent jobs run concurrently.
+Jobs return 0 on success. When a job fails (returns non-zero or throws),
+the jobs that depend on it are skipped and reported as failed too.
+Jobs may use the same pool for nested parallel loops.
+*/
+class JobGraph {
+public:
+    using JobId = size_t;
+
+    JobId add(std::string name, std::function<int()> fn, std::vector<JobId> const& dependencies = {}) {
+        JobId id = m_jobs.size();
+        auto job = std::make_unique<Job>();
+        job->site = profiler::profiler::getInstance().intern(name);
+        job->name = std::move(name);
+        job->fn = std::move(fn);
+        job->dependencyCount = dependencies.size();
+        for (JobId dependency : dependencies) {
+            m_jobs[dependency]->dependents.push_back(id);
+        }
+        m_jobs.push_back(std::move(job));
+        return id;
+    }
+
+    // Runs all jobs and returns the number of failed (or skipped) ones
+    int run(ThreadPool& threadPool) {
+        for (auto& job : m_jobs) {
+            job->remainingDependencies = job->dependencyCount;
+        }
+        m_startTime = std::chrono::steady_clock::now();
+
+        ThreadPool::TaskGroup group;
+        for (JobId id = 0; id < m_jobs.size(); ++id) {
+            if (m_jobs[id]->dependencyCount == 0) {
+                submit(threadPool, group, id);
+            }
+        }
+        threadPool.wait(group);
+
+        int failureCount = 0;
+        for (auto const& job : m_jobs) {
+            if (job->result != 0) failureCount++;
+        }
+        return failureCount;
+    }
+
+    bool succeeded(JobId id) const { return m_jobs[id]->result == 0; }
+
+    // Prints start offset and duration of every job, in the order the jobs were added
+    void printTimings(std::ostream& os) const {
+        for (auto const& job : m_jobs) {
+            os << "  " << job->name << ": ";
+            if (job->skipped) {
+                os << "skipped" << std::endl;
+                continue;
+            }
+            os << "started at " << toMs(job->startTime - m_startTime) << " ms, took " << toMs(job->endTime - job->startTime) << " ms";
+            if (job->result != 0) os << " (FAILED)";
+            os << std::endl;
+        }
+    }
+
+private:
+    struct Job {
+        std::string name;
+        const profiler::site* site;  // jobs show up in profiler traces under their name
+        std::function<int()> fn;
+        std::vector<JobId> dependents;
+        size_t dependencyCount = 0;
+        std::atomic<size_t> remainingDependencies = 0;
+        std::atomic<bool> dependencyFailed = false;
+        int result = -1;
+        bool skipped = false;
+        std::chrono::steady_clock::time_point startTime;
+        std::chrono::steady_clock::time_point endTime;
+    };
+
+    static long long toMs(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    }
+
+    void submit(ThreadPool& threadPool, ThreadPool::TaskGroup& group, JobId id) {
+        threadPool.submit(group, [this, &threadPool, &group, id] {
+            Job& job = *m_jobs[id];
+            if (job.dependencyFailed) {
+                job.skipped = true;
+            } else {
+                job.startTime = std::chrono::steady_clock::now();
+                profiler::scope jobScope(job.site);
+                try {
+                    job.result = job.fn();
+                } catch (std::exception const& e) {
+                    std::cerr << job.name << ": " << e.what() << std::endl;
+                    job.result = -1;
+                }
+                job.endTime = std::chrono::steady_clock::now();
+            }
+            job.fn = nullptr;  // release captured data as early as possible
+
+            // Dependents are submitted before this task finishes, so the group can't complete prematurely
+            for (JobId dependentId : job.dependents) {
+                Job& dependent = *m_jobs[dependentId];
+                if (job.result != 0) dependent.dependencyFailed = true;
+                if (dependent.remainingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    submit(threadPool, group, dependentId);
+                }
+            }
+        });
+    }
+
+    std::vector<std::unique_ptr<Job>> m_jobs;
+    std::chrono::steady_clock::time_point m_startTime;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Model.h"
+
+/*
+Cooked mesh written by ProcessAssets, loaded by the app as is.
+
+  char[4] "MESH", uint32 version
+  uint32 vertexCount, uint32 indexCount
+  Vertex[vertexCount], uint32 indices[indexCount]
+  material textures (base color, normal, roughness), each as uint32 length + characters
+
+Native endianness and Vertex layout, it's a build artifact and not meant to be portable.
+*/
+constexpr uint32_t MESH_FILE_VERSION = 1;
+
+int saveMesh(Model const& model, const char* fileName) {
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error: Could not open file for writing: " << fileName << std::endl;
+        return -1;
+    }
+    auto writeUint32 = [&](uint32_t value) { file.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+    auto writeString = [&](std::string const& str) {
+        writeUint32(uint32_t(str.size()));
+        file.write(str.data(), str.size());
+    };
+    file.write("MESH", 4);
+    writeUint32(MESH_FILE_VERSION);
+    writeUint32(uint32_t(model.vertices.size()));
+    writeUint32(uint32_t(model.indices.size()));
+    file.write(reinterpret_cast<const char*>(model.vertices.data()), sizeof(Vertex) * model.vertices.size());
+    file.write(reinterpret_cast<const char*>(model.indices.data()), sizeof(uint32_t) * model.indices.size());
+    writeString(model.material.baseColorTexture);
+    writeString(model.material.normalTexture);
+    writeString(model.material.roughnessTexture);
+    if (!file) {
+        std::cerr << "Error: Failed to write " << fileName << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+Model loadMesh(const std::string& fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("failed to open mesh file " + fileName);
+    }
+    auto readUint32 = [&] {
+        uint32_t value = 0;
+        file.read(reinterpret_cast<char*>(&value), sizeof(value));
+        return value;
+    };
+    auto readString = [&] {
+        std::string str(readUint32(), '\0');
+        file.read(str.data(), str.size());
+        return str;
+    };
+    char magic[4] = {};
+    file.read(magic, 4);
+    if (memcmp(magic, "MESH", 4) != 0 || readUint32() != MESH_FILE_VERSION) {
+        throw std::runtime_error("unsupported mesh file " + fileName + ", rerun ProcessAssets");
+    }
+    Model model;
+    model.vertices.resize(readUint32());
+    model.indices.resize(readUint32());
+    file.read(reinterpret_cast<char*>(model.vertices.data()), sizeof(Vertex) * model.vertices.size());
+    file.read(reinterpret_cast<char*>(model.indices.data()), sizeof(uint32_t) * model.indices.size());
+    model.material.baseColorTexture = readString();
+    model.material.normalTexture = readString();
+    model.material.roughnessTexture = readString();
+    if (!file) {
+        throw std::runtime_error("truncated mesh file " + fileName);
+    }
+    for (uint32_t index : model.indices) {
+        if (index >= model.vertices.size()) {
+            throw std::runtime_error("invalid index in mesh file " + fileName);
+        }
+    }
+    return model;
+}
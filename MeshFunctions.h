@@ -1,10 +1,52 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
 #include <vector>
 #include "Vertex.h"
+#include "Model.h"
 
-std::vector<Vertex> createSphereMesh(int subdivide = 0, float radius = 1.0f) {
+// Vertices are compared bitwise, welding never merges vertices which differ in any attribute
+struct VertexBitwiseHash {
+    size_t operator()(Vertex const& vertex) const {
+        static_assert(sizeof(Vertex) % sizeof(uint32_t) == 0);
+        std::array<uint32_t, sizeof(Vertex) / sizeof(uint32_t)> words;
+        memcpy(words.data(), &vertex, sizeof(Vertex));
+        // FNV-1a over 32-bit words
+        uint64_t hash = 14695981039346656037ull;
+        for (uint32_t word : words) {
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+        return size_t(hash);
+    }
+};
+
+struct VertexBitwiseEqual {
+    bool operator()(Vertex const& a, Vertex const& b) const {
+        return memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+};
+
+// Merges identical corners of a triangle list into the unique vertices and indices of the model
+void weldVertices(std::vector<Vertex> const& corners, Model& model) {
+    std::unordered_map<Vertex, uint32_t, VertexBitwiseHash, VertexBitwiseEqual> vertexIndices;
+    vertexIndices.reserve(corners.size());
+    model.vertices.clear();
+    model.indices.clear();
+    model.indices.reserve(corners.size());
+    for (Vertex const& corner : corners) {
+        auto [it, inserted] = vertexIndices.try_emplace(corner, uint32_t(model.vertices.size()));
+        if (inserted) {
+            model.vertices.push_back(corner);
+        }
+        model.indices.push_back(it->second);
+    }
+}
+
+// Shared edges are split identically by both triangles, so the subdivided sphere welds into a closed mesh
+Model createSphereMesh(int subdivide = 0, float radius = 1.0f) {
     // Icosahedron
     static const float a = 0.525731112119;
     static const float b = 0.850650808352;
@@ -65,11 +107,14 @@ std::vector<Vertex> createSphereMesh(int subdivide = 0, float radius = 1.0f) {
         triangleCount *= 4;
     }
 
-    std::vector<Vertex> result;
+    std::vector<Vertex> corners;
+    corners.reserve(triangleVertices.size());
     for (auto const& v : triangleVertices) {
         // set normals to vertex values which leads to smoothed normals
-        result.push_back({.pos=v * radius, .normal=v});
+        corners.push_back({.pos=v * radius, .normal=v});
     }
 
-    return result;
+    Model model;
+    weldVertices(corners, model);
+    return model;
 }
@@ -5,6 +5,9 @@
 struct MeshObject {
     uint32_t vertexCount;
     VkBuffer vertexBuffer;
+    uint32_t indexCount;
+    VkBuffer indexBuffer;
+    VkIndexType indexType;
 
     VkImage baseColorImage;
     VkImageView baseColorImageView;
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#include <glm/glm.hpp>
+#include <Profiler.h>
+#include "Vertex.h"
+
+/*
+Offline reordering of indexed triangle lists (Sander, Nehab, Barczak: Fast Triangle Reordering
+for Vertex Locality and Reduced Overdraw, 2007).
+
+1. Triangles are ordered for the post-transform vertex cache with Tipsify.
+2. The ordered triangles are split into clusters which keep the cache efficiency within a threshold,
+   and the clusters are sorted so that the outward facing ones on the hull of the mesh are drawn first
+   and occlude the rest. The sort is view independent.
+3. Vertices are renumbered in the order of first use, so vertex fetch walks the vertex buffer forward.
+
+Cache efficiency is measured with a FIFO cache: ACMR is the number of transformed vertices per triangle
+(0.5 at best for big regular meshes, 3 at worst), ATVR the number of transformed vertices per vertex (1 at best).
+*/
+
+// FIFO post-transform cache. A vertex is cached if it was inserted less than cacheSize insertions ago.
+class VertexCacheSimulator {
+public:
+    VertexCacheSimulator(size_t vertexCount, uint32_t cacheSize)
+        : m_timestamps(vertexCount, 0)
+        , m_cacheSize(cacheSize)
+        , m_time(cacheSize + 1)
+    {}
+
+    // Returns true on a cache miss
+    bool access(uint32_t vertex) {
+        if (m_time - m_timestamps[vertex] > m_cacheSize) {
+            m_timestamps[vertex] = m_time++;
+            return true;
+        }
+        return false;
+    }
+
+    uint32_t accessTriangle(const uint32_t* triangle) {
+        return uint32_t(access(triangle[0])) + uint32_t(access(triangle[1])) + uint32_t(access(triangle[2]));
+    }
+
+    // Evicts everything
+    void reset() {
+        m_time += m_cacheSize + 1;
+    }
+
+private:
+    std::vector<uint32_t> m_timestamps;
+    uint32_t m_cacheSize;
+    uint32_t m_time;
+};
+
+struct VertexCacheStats {
+    float acmr = 0; // average cache miss ratio, transformed vertices per triangle
+    float atvr = 0; // average transformed vertex ratio, transformed vertices per referenced vertex
+};
+
+VertexCacheStats analyzeVertexCache(std::vector<uint32_t> const& indices, size_t vertexCount, uint32_t cacheSize) {
+    VertexCacheSimulator cache(vertexCount, cacheSize);
+    std::vector<bool> referenced(vertexCount, false);
+    size_t misses = 0;
+    size_t referencedCount = 0;
+    for (uint32_t index : indices) {
+        misses += cache.access(index);
+        if (!referenced[index]) {
+            referenced[index] = true;
+            referencedCount++;
+        }
+    }
+    VertexCacheStats stats;
+    if (!indices.empty()) {
+        stats.acmr = float(misses) / float(indices.size() / 3);
+        stats.atvr = float(misses) / float(referencedCount);
+    }
+    return stats;
+}
+
+// Triangles of every vertex, as offsets into one array
+struct VertexTriangleAdjacency {
+    std::vector<uint32_t> offsets; // vertexCount + 1
+    std::vector<uint32_t> triangles;
+
+    VertexTriangleAdjacency(std::vector<uint32_t> const& indices, size_t vertexCount): offsets(vertexCount + 1, 0), triangles(indices.size()) {
+        for (uint32_t index : indices) {
+            offsets[index + 1]++;
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i) {
+            triangles[fill[indices[i]]++] = uint32_t(i / 3);
+        }
+    }
+};
+
+// Tipsify: fans around a vertex while its remaining triangles still hit the cache, then moves to the
+// most recently used vertex that is likely to stay cached. Triangle winding is preserved.
+std::vector<uint32_t> optimizeVertexCache(std::vector<uint32_t> const& indices, size_t vertexCount, uint32_t cacheSize) {
+    PROFILE_ME_AS("optimizeVertexCache");
+    size_t triangleCount = indices.size() / 3;
+    VertexTriangleAdjacency adjacency(indices, vertexCount);
+    std::vector<uint32_t> liveTriangles(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) {
+        liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+    }
+    std::vector<uint32_t> timestamps(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnds; // recently used vertices, candidates when the fan runs out
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    uint32_t time = cacheSize + 1;
+    size_t cursor = 0; // next vertex in input order to restart from
+
+    int64_t fanning = vertexCount > 0 ? 0 : -1;
+    while (fanning >= 0) {
+        candidates.clear();
+        for (uint32_t a = adjacency.offsets[fanning]; a < adjacency.offsets[fanning + 1]; ++a) {
+            uint32_t t = adjacency.triangles[a];
+            if (emitted[t]) continue;
+            for (int k = 0; k < 3; ++k) {
+                uint32_t v = indices[t * 3 + k];
+                result.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - timestamps[v] > cacheSize) {
+                    timestamps[v] = time++;
+                }
+            }
+            emitted[t] = true;
+        }
+
+        // Prefer the candidate that entered the cache earliest among the ones whose remaining triangles still fit in
+        fanning = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates) {
+            if (liveTriangles[v] == 0) continue;
+            int64_t priority = 0;
+            if (time - timestamps[v] + 2 * liveTriangles[v] <= cacheSize) {
+                priority = time - timestamps[v];
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                fanning = v;
+            }
+        }
+        if (fanning >= 0) continue;
+
+        while (!deadEnds.empty()) {
+            uint32_t v = deadEnds.back();
+            deadEnds.pop_back();
+            if (liveTriangles[v] > 0) {
+                fanning = v;
+                break;
+            }
+        }
+        while (fanning < 0 && cursor < vertexCount) {
+            if (liveTriangles[cursor] > 0) {
+                fanning = int64_t(cursor);
+            }
+            cursor++;
+        }
+    }
+    return result;
+}
+
+// Reorders the triangles of a cache optimized list for less overdraw. Clusters are split where the running
+// ACMR of a cluster falls to threshold times the ACMR of the whole run between two cache flushes,
+// so threshold 1.05 allows about 5% more vertex transforms. Threshold 0 keeps the order.
+std::vector<uint32_t> optimizeOverdraw(std::vector<uint32_t> const& indices, std::vector<Vertex> const& vertices, uint32_t cacheSize, float threshold) {
+    PROFILE_ME_AS("optimizeOverdraw");
+    size_t triangleCount = indices.size() / 3;
+    if (threshold <= 0 || triangleCount == 0) {
+        return indices;
+    }
+
+    // Hard boundaries: triangles missing all of their vertices, the cache has been flushed anyway.
+    // The first triangle always starts one, it may be degenerate and miss fewer.
+    std::vector<uint32_t> hardBoundaries{0};
+    {
+        VertexCacheSimulator cache(vertices.size(), cacheSize);
+        cache.accessTriangle(&indices[0]);
+        for (size_t t = 1; t < triangleCount; ++t) {
+            if (cache.accessTriangle(&indices[t * 3]) == 3) {
+                hardBoundaries.push_back(uint32_t(t));
+            }
+        }
+    }
+    hardBoundaries.push_back(uint32_t(triangleCount));
+
+    // Soft boundaries, every cluster starts with an empty cache since clusters are reordered
+    std::vector<uint32_t> clusters;
+    VertexCacheSimulator cache(vertices.size(), cacheSize);
+    for (size_t h = 0; h + 1 < hardBoundaries.size(); ++h) {
+        uint32_t begin = hardBoundaries[h];
+        uint32_t end = hardBoundaries[h + 1];
+        cache.reset();
+        uint32_t hardMisses = 0;
+        for (uint32_t t = begin; t < end; ++t) {
+            hardMisses += cache.accessTriangle(&indices[t * 3]);
+        }
+        float clusterThreshold = threshold * float(hardMisses) / float(end - begin);
+
+        cache.reset();
+        uint32_t clusterBegin = begin;
+        uint32_t clusterMisses = 0;
+        clusters.push_back(begin);
+        for (uint32_t t = begin; t < end; ++t) {
+            clusterMisses += cache.accessTriangle(&indices[t * 3]);
+            if (t + 1 < end && float(clusterMisses) / float(t + 1 - clusterBegin) <= clusterThreshold) {
+                clusterBegin = t + 1;
+                clusterMisses = 0;
+                clusters.push_back(clusterBegin);
+                cache.reset();
+            }
+        }
+    }
+    clusters.push_back(uint32_t(triangleCount));
+
+    // Area weighted centroids and normals of the mesh and the clusters
+    glm::vec3 meshCentroid{0.0f};
+    float meshArea = 0;
+    size_t clusterCount = clusters.size() - 1;
+    std::vector<float> sortKeys(clusterCount);
+    std::vector<glm::vec3> clusterCentroids(clusterCount);
+    std::vector<glm::vec3> clusterNormals(clusterCount);
+    for (size_t c = 0; c < clusterCount; ++c) {
+        glm::vec3 centroid{0.0f};
+        glm::vec3 normal{0.0f};
+        float area = 0;
+        for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+            glm::vec3 p0 = vertices[indices[t * 3]].pos;
+            glm::vec3 p1 = vertices[indices[t * 3 + 1]].pos;
+            glm::vec3 p2 = vertices[indices[t * 3 + 2]].pos;
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(n);
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        meshCentroid += centroid;
+        meshArea += area;
+        clusterCentroids[c] = area > 0 ? centroid / area : vertices[indices[clusters[c] * 3]].pos;
+        float normalLength = glm::length(normal);
+        clusterNormals[c] = normalLength > 0 ? normal / normalLength : glm::vec3(0.0f);
+    }
+    if (meshArea > 0) {
+        meshCentroid /= meshArea;
+    }
+    for (size_t c = 0; c < clusterCount; ++c) {
+        sortKeys[c] = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+    }
+
+    std::vector<uint32_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (uint32_t c : order) {
+        result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+    }
+    return result;
+}
+
+// Renumbers vertices in the order of first use, unreferenced vertices are dropped
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+    PROFILE_ME_AS("optimizeVertexFetch");
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for (uint32_t& index : indices) {
+        if (remap[index] == UINT32_MAX) {
+            remap[index] = uint32_t(reordered.size());
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices = std::move(reordered);
+}
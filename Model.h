@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <string>
 #include "Vertex.h"
@@ -7,5 +8,6 @@
 
 struct Model {
     std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices; // triangle list
     Material material;
 };
@@ -3,8 +3,10 @@
 #include <filesystem>
 #include <iostream>
 #include <tiny_obj_loader.h>
+#include <Profiler.h>
 #include "Vertex.h"
 #include "Model.h"
+#include "MeshFunctions.h"
 
 void normalizeModel(std::vector<Vertex>& vertices, float size = 1) {
     struct {glm::vec3 min; glm::vec3 max;} aabb{{999.0f, 999.0f, 999.0f}, {-999, -999, -999}};
@@ -57,7 +59,8 @@ Model loadObj(const std::string& filePath) {
         roughnessTexture = parent / materials[0].roughness_texname;
     }
 
-    std::vector<Vertex> vertices;
+    // Every face corner gets its own vertex first, identical ones are welded afterwards
+    std::vector<Vertex> corners;
     for (size_t s = 0; s < shapes.size(); s++) {
         size_t index_offset = 0;
         for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
@@ -73,6 +76,7 @@ Model loadObj(const std::string& filePath) {
             }
 
             bool has_normals = false;
+            size_t face_offset = corners.size();
 
             // Loop over vertices in the face.
             for (size_t v = 0; v < fv; v++) {
@@ -108,13 +112,13 @@ Model loadObj(const std::string& filePath) {
                 // tinyobj::real_t green = attrib.colors[3*size_t(idx.vertex_index)+1];
                 // tinyobj::real_t blue  = attrib.colors[3*size_t(idx.vertex_index)+2];
 
-                vertices.push_back({{vx, vy, vz}, normal, color, uv});
+                corners.push_back({{vx, vy, vz}, normal, color, uv});
             }
 
             if (!has_normals) {
-                glm::vec3 v0 = vertices[index_offset].pos;
-                glm::vec3 v1 = vertices[index_offset + 1].pos;
-                glm::vec3 v2 = vertices[index_offset + 2].pos;
+                glm::vec3 v0 = corners[face_offset].pos;
+                glm::vec3 v1 = corners[face_offset + 1].pos;
+                glm::vec3 v2 = corners[face_offset + 2].pos;
 
                 // Calculate the two edges of the triangle
                 glm::vec3 edge1 = v1 - v0;
@@ -122,18 +126,21 @@ Model loadObj(const std::string& filePath) {
 
                 // Calculate the normal using the cross product
                 glm::vec3 normal = glm::normalize(glm::cross(edge1, edge2));
-                vertices[index_offset].normal = normal;
-                vertices[index_offset + 1].normal = normal;
-                vertices[index_offset + 2].normal = normal;
+                for (size_t v = 0; v < fv; v++) {
+                    corners[face_offset + v].normal = normal;
+                }
             }
 
             index_offset += fv;
         }
     }
 
-    return {vertices, {
+    Model model;
+    weldVertices(corners, model);
+    model.material = {
         .baseColorTexture = baseColorTexture,
         .normalTexture = normalTexture,
         .roughnessTexture = roughnessTexture,
-    }};
+    };
+    return model;
 }
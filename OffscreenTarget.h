@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "SurfaceFormatSet.h"
+#include "VulkanFunctions.h"
+
+/*
+Stand-in for Swapchain when rendering without a window.
+
+Owns imageCount color images which are used round robin, one per frame in flight.
+Formats are matched only by VkFormat, the color space just tells how the pixels are meant to be displayed.
+Rendered images are left in FINAL_LAYOUT, so they can be copied to the host with readPixels.
+*/
+class OffscreenTarget {
+public:
+    static constexpr VkImageLayout FINAL_LAYOUT = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+    OffscreenTarget(
+        VkPhysicalDevice physicalDevice,
+        VkDevice device,
+        VkExtent2D extent,
+        uint32_t imageCount,
+        std::vector<VkSurfaceFormatKHR> const& preferredFormats
+    ):
+        m_physicalDevice(physicalDevice),
+        m_device(device),
+        m_extent(extent),
+        m_imageCount(imageCount),
+        m_images(imageCount),
+        m_imageMemory(imageCount),
+        m_imageViews(imageCount)
+    {
+        for (const VkSurfaceFormatKHR& format : preferredFormats) {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, format.format, &properties);
+            VkFormatFeatureFlags required = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+            if ((properties.optimalTilingFeatures & required) == required) {
+                m_supportedFormats.insert(format);
+            }
+        }
+        m_surfaceFormat = chooseFormat(preferredFormats, m_supportedFormats);
+
+        for (uint32_t i = 0; i < imageCount; ++i) {
+            createImage(
+                physicalDevice,
+                device,
+                extent.width,
+                extent.height,
+                m_surfaceFormat.format,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                m_images[i],
+                m_imageMemory[i]
+            );
+            VkImageViewCreateInfo viewInfo {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                .image = m_images[i],
+                .viewType = VK_IMAGE_VIEW_TYPE_2D,
+                .format = m_surfaceFormat.format,
+                .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .subresourceRange.baseMipLevel = 0,
+                .subresourceRange.levelCount = 1,
+                .subresourceRange.baseArrayLayer = 0,
+                .subresourceRange.layerCount = 1,
+            };
+            if (vkCreateImageView(device, &viewInfo, nullptr, &m_imageViews[i]) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create offscreen image view!");
+            }
+        }
+    }
+
+    ~OffscreenTarget() {
+        for (uint32_t i = 0; i < m_imageCount; ++i) {
+            vkDestroyImageView(m_device, m_imageViews[i], nullptr);
+            vkDestroyImage(m_device, m_images[i], nullptr);
+            vkFreeMemory(m_device, m_imageMemory[i], nullptr);
+        }
+    }
+
+    OffscreenTarget(const OffscreenTarget&) = delete;
+    OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+    uint32_t acquireNextImage() {
+        uint32_t imageIndex = m_currentImage;
+        m_currentImage = (m_currentImage + 1) % m_imageCount;
+        return imageIndex;
+    }
+
+    // Copies a rendered image to the host, rows are tightly packed.
+    // Blocks until the queue is idle.
+    std::vector<uint8_t> readPixels(uint32_t imageIndex, VkCommandPool commandPool, VkQueue queue) const {
+        VkDeviceSize size = VkDeviceSize(m_extent.width) * m_extent.height * getPixelSize(m_surfaceFormat.format);
+        VkDeviceMemory bufferMemory;
+        VkBuffer buffer = createBuffer(
+            m_device,
+            m_physicalDevice,
+            size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            &bufferMemory
+        );
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(m_device, commandPool);
+        VkImageMemoryBarrier renderBarrier {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .oldLayout = FINAL_LAYOUT,
+            .newLayout = FINAL_LAYOUT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = m_images[imageIndex],
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &renderBarrier);
+        VkBufferImageCopy region {
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+            .imageExtent = {m_extent.width, m_extent.height, 1},
+        };
+        vkCmdCopyImageToBuffer(commandBuffer, m_images[imageIndex], FINAL_LAYOUT, buffer, 1, &region);
+        VkBufferMemoryBarrier hostBarrier {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = buffer,
+            .size = VK_WHOLE_SIZE,
+        };
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
+        endSingleTimeCommands(m_device, commandPool, queue, commandBuffer);
+
+        std::vector<uint8_t> pixels(size);
+        void* data;
+        vkMapMemory(m_device, bufferMemory, 0, size, 0, &data);
+        memcpy(pixels.data(), data, size);
+        vkUnmapMemory(m_device, bufferMemory);
+        vkDestroyBuffer(m_device, buffer, nullptr);
+        vkFreeMemory(m_device, bufferMemory, nullptr);
+        return pixels;
+    }
+
+    VkExtent2D getExtent() const {
+        return m_extent;
+    }
+
+    VkSurfaceFormatKHR getFormat() const {
+        return m_surfaceFormat;
+    }
+
+    uint32_t getImageCount() const {
+        return m_imageCount;
+    }
+
+    VkImageView getImageView(int i) const {
+        return m_imageViews[i];
+    }
+
+    const SurfaceFormatSet& getSupportedFormats() const {
+        return m_supportedFormats;
+    }
+
+private:
+    static VkSurfaceFormatKHR chooseFormat(
+        std::vector<VkSurfaceFormatKHR> const& preferredFormats,
+        SurfaceFormatSet const& supportedFormats
+    ) {
+        for (const VkSurfaceFormatKHR& preferredFormat : preferredFormats) {
+            if (supportedFormats.contains(preferredFormat)) {
+                return preferredFormat;
+            }
+        }
+        throw std::runtime_error("No suitable offscreen format available");
+    }
+
+    static uint32_t getPixelSize(VkFormat format) {
+        switch (format) {
+            case VK_FORMAT_R16G16B16A16_SFLOAT:
+                return 8;
+            case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+            case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+            case VK_FORMAT_B8G8R8A8_SRGB:
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_B8G8R8A8_UNORM:
+                return 4;
+            default:
+                throw std::runtime_error("Unsupported offscreen format for reading pixels");
+        }
+    }
+
+    VkPhysicalDevice m_physicalDevice;
+    VkDevice m_device;
+    VkExtent2D m_extent;
+    uint32_t m_imageCount;
+    std::vector<VkImage> m_images;
+    std::vector<VkDeviceMemory> m_imageMemory;
+    std::vector<VkImageView> m_imageViews;
+    VkSurfaceFormatKHR m_surfaceFormat;
+    SurfaceFormatSet m_supportedFormats;
+    uint32_t m_currentImage = 0;
+};
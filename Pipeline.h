@@ -9,6 +9,7 @@
 #include "FileFunctions.h"
 #include "MeshObject.h"
 #include "UniformBuffer.h"
+#include "FrameCounters.h"
 
 /**
 The class represents a concrete Vulkan pipeline to render textured meshes.
@@ -70,12 +71,16 @@ public:
         VkDescriptorSet frameLevelDescriptorSet,
         std::vector<MeshObject> const& objects
     ) {
+        FrameCounters& counters = frameCounters();
         for (size_t i = 0; i < objects.size(); ++i) {
             m_modelTransforms.data()[i] = {objects[i].getTransform()};
         }
+        counters.uniformBytesWritten += objects.size() * sizeof(m_modelTransforms.data()[0]);
 
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
         vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_layout, 0, 1, &frameLevelDescriptorSet, 0, nullptr);
+        counters.pipelineBinds++;
+        counters.descriptorSetBinds++;
 
         // TODO group by vertex buffer and material
         for (uint32_t i = 0; i < objects.size(); i++) {
@@ -86,7 +91,12 @@ public:
             VkBuffer vertexBuffers[] = { object.vertexBuffer };
             VkDeviceSize offsets[] = { 0 };
             vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-            vkCmdDraw(commandBuffer, object.vertexCount, 1, 0, 0);
+            vkCmdBindIndexBuffer(commandBuffer, object.indexBuffer, 0, object.indexType);
+            vkCmdDrawIndexed(commandBuffer, object.indexCount, 1, 0, 0, 0);
+            counters.descriptorSetBinds++;
+            counters.vertexBufferBinds++;
+            counters.indexBufferBinds++;
+            counters.draw(object.indexCount);
         }
     }
 
@@ -100,6 +110,7 @@ public:
         // TODO need a proper Material object to handle the lifetime
         auto propsBuffer = new UniformBuffer<MaterialProps>(m_physicalDevice, m_device);
         propsBuffer->data() = props;
+        frameCounters().uniformBytesWritten += sizeof(props);
         VkDescriptorSet materialDescriptorSet = createMaterialDescriptorSet();
         {
             VkDescriptorImageInfo baseColorImageInfo {
@@ -143,6 +154,7 @@ public:
                 },
             };
             vkUpdateDescriptorSets(m_device, writes.size(), writes.data(), 0, nullptr);
+            frameCounters().descriptorUpdates += writes.size();
         }
         return materialDescriptorSet;
     }
@@ -191,6 +203,7 @@ private:
             };
         };
         vkUpdateDescriptorSets(m_device, writes.size(), writes.data(), 0, nullptr);
+        frameCounters().descriptorUpdates += writes.size();
         return descriptorSets;
     }
 
@@ -1,12 +1,25 @@
 #include <filesystem>
 #include <fstream>
 #include <vector>
+#include <optional>
 #include <format>
 #include <fkYAML.hpp>
 #include "FileFunctions.h"
 #include "CubemapFunctions.h"
 #include "SunExtraction.h"
+#include "EnvmapIngest.h"
+#include "SphericalHarmonics.h"
 #include "BRDF.h"
+#include "ThreadPool.h"
+#include "AssetCache.h"
+#include "JobGraph.h"
+#include "ObjFile.h"
+#include "MeshOptimizer.h"
+#include "MeshFile.h"
+#include <CLI11.hpp>
+
+// Bump when baking code changes in a way that affects the output, to invalidate cached assets
+constexpr int BAKER_VERSION = 5;
 
 void saveSunDataToFile(ExtractedSunData const& sunData, const char* fileName) {
     std::ofstream ofs(fileName);
@@ -27,78 +40,306 @@ void saveSunDataToFile(ExtractedSunData const& sunData, const char* fileName) {
     ofs << "solidAngle: " << sunData.solidAngle;
 }
 
-int processEnvmap(const std::filesystem::path& assetPath, fkyaml::node const& yaml, const std::string& outDir) {
+// Source file of an asset is the asset file name without ".asset.yaml" suffix
+std::filesystem::path assetSourcePath(const std::filesystem::path& assetPath) {
+    return assetPath.string().substr(0, assetPath.string().size() - std::string(".asset.yaml").size());
+}
+
+// Asset scheduled for baking
+struct AssetBake {
+    std::filesystem::path assetPath;
+    uint64_t cacheKey;
+    std::vector<std::filesystem::path> outputs;
+    std::vector<JobGraph::JobId> jobs;
+};
+
+int processEnvmap(JobGraph& graph, ThreadPool& threadPool, SamplingTables& samplingTables, fkyaml::node const& yaml, const std::string& outDir, uint32_t zstdLevel, AssetBake& bake) {
     int faceSize = yaml["faceSize"].as_int();
     bool extractSun = yaml.contains("extractSun") ? yaml["extractSun"].as_bool() : false;
     int specularSampleCount = yaml.contains("specularSampleCount") ? yaml["specularSampleCount"].as_int() : 16;
-    const std::filesystem::path inputFileName = assetPath.string().substr(0, assetPath.string().size() - std::string(".asset.yaml").size());
-    ImageData imageData = loadImage(inputFileName);
+    uint32_t specularSampleSeed = yaml.contains("specularSampleSeed") ? yaml["specularSampleSeed"].as_int() : 0;
+    // Adaptive sampling replaces the fixed specularSampleCount when a target error is set
+    std::optional<AdaptiveSampling> adaptive;
+    if (yaml.contains("specularTargetError")) {
+        adaptive = AdaptiveSampling{
+            .targetRelativeError = float(yaml["specularTargetError"].as_float()),
+            .minSampleCount = yaml.contains("specularMinSampleCount") ? int(yaml["specularMinSampleCount"].as_int()) : 8,
+            .maxSampleCount = yaml.contains("specularMaxSampleCount") ? int(yaml["specularMaxSampleCount"].as_int()) : 256,
+        };
+        if (adaptive->targetRelativeError <= 0.0f || adaptive->minSampleCount < 1 || adaptive->maxSampleCount < adaptive->minSampleCount) {
+            std::cout << "specularTargetError must be positive and 1 <= specularMinSampleCount <= specularMaxSampleCount" << std::endl;
+            return -1;
+        }
+    }
+    int shOrder = yaml.contains("shOrder") ? yaml["shOrder"].as_int() : 2;
+    if (shOrder < 0 || shOrder > SH_MAX_ORDER) {
+        std::cout << "shOrder must be in [0, " << SH_MAX_ORDER << "]" << std::endl;
+        return -1;
+    }
+    TextureFormat format = TextureFormat::RGBA32F;
+    if (yaml.contains("format")) {
+        std::string formatName = yaml["format"].as_str();
+        bool parsed = parseTextureFormat(formatName, format);
+        if (!parsed || (format != TextureFormat::RGBA32F && format != TextureFormat::RGBA16F && format != TextureFormat::RGB9E5 && format != TextureFormat::BC6H)) {
+            std::cout << "Unsupported envmap format: " << formatName << " (rgba32f, rgba16f, rgb9e5 or bc6h)" << std::endl;
+            return -1;
+        }
+    }
+    TextureEncoding encoding = {.format = format, .zstdLevel = zstdLevel};
+    if (yaml.contains("bc6hQuality") && !parseBC6HQuality(yaml["bc6hQuality"].as_str(), encoding.bc6hQuality)) {
+        std::cout << "Unsupported bc6hQuality: " << yaml["bc6hQuality"].as_str() << " (fast, normal or high)" << std::endl;
+        return -1;
+    }
+    const std::filesystem::path inputFileName = assetSourcePath(bake.assetPath);
+    const std::string jobPrefix = bake.assetPath.filename().string() + " ";
+
+    // Stages: [sun extraction] -> ingest (cubemap conversion and SH projection in one streaming pass) -> prefilter and SH output
+    struct EnvmapBakeState {
+        std::unique_ptr<EquirectangularReader> reader;
+        std::optional<SunRemoval> sunRemoval;
+        IngestedEnvmap ingested;
+    };
+    auto state = std::make_shared<EnvmapBakeState>();
+    std::vector<JobGraph::JobId> ingestDependencies;
 
     if (extractSun) {
         float sunSolidAngle = yaml["sunSolidAngle"].as_float();
-        ExtractedSunData sunData = extractSunFromEquirectangularPanorama(imageData, sunSolidAngle);
-        if (sunData.error) {
-            std::cout << "Failed to extract sun: " << sunData.error << std::endl;
-            return -1;
-        }
         std::string sunDataFileName = std::string(outDir / inputFileName.stem()) + ".sun.yaml";
-        saveSunDataToFile(sunData, sunDataFileName.c_str());
+        JobGraph::JobId sunJob = graph.add(jobPrefix + "sun", [&threadPool, state, inputFileName, sunSolidAngle, sunDataFileName] {
+            state->reader = std::make_unique<EquirectangularReader>(inputFileName);
+            SunPeak peak = findSunPeak(threadPool, *state->reader);
+            SunRemoval removal;
+            ExtractedSunData sunData = extractSunAroundPeak(*state->reader, peak, sunSolidAngle, removal);
+            if (sunData.error) {
+                std::cout << "Failed to extract sun: " << sunData.error << std::endl;
+                return -1;
+            }
+            state->sunRemoval = removal;
+            saveSunDataToFile(sunData, sunDataFileName.c_str());
+            return 0;
+        });
+        bake.jobs.push_back(sunJob);
+        bake.outputs.push_back(sunDataFileName);
+        ingestDependencies.push_back(sunJob);
     }
 
+    JobGraph::JobId ingestJob = graph.add(jobPrefix + "ingest", [&threadPool, &samplingTables, state, inputFileName, faceSize, shOrder] {
+        if (!state->reader) {
+            state->reader = std::make_unique<EquirectangularReader>(inputFileName);
+        }
+        SunRemoval const* sunRemoval = state->sunRemoval ? &*state->sunRemoval : nullptr;
+        state->ingested = ingestEquirectangularPanorama(threadPool, samplingTables, *state->reader, faceSize, shOrder, sunRemoval);
+        state->reader.reset();
+        return 0;
+    }, ingestDependencies);
+    bake.jobs.push_back(ingestJob);
+
     std::string outputFileName = std::string(outDir / inputFileName.stem()) + ".ktx2";
-    if (prefilterEnvmap(imageData, outputFileName.c_str(), faceSize, specularSampleCount) != 0) {
-        return -1;
-    }
+    bake.jobs.push_back(graph.add(jobPrefix + "prefilter", [&threadPool, &samplingTables, state, outputFileName, faceSize, specularSampleCount, specularSampleSeed, encoding, adaptive] {
+        return prefilterEnvmap(threadPool, samplingTables, std::move(state->ingested.cubemap), outputFileName.c_str(), faceSize, specularSampleCount, specularSampleSeed, encoding, adaptive ? &*adaptive : nullptr);
+    }, {ingestJob}));
+    bake.outputs.push_back(outputFileName);
 
     std::string diffuseShFileName = std::string(outDir / inputFileName.stem()) + ".sh.txt";
-    if (calculateDiffuseSphericalHarmonics(imageData, diffuseShFileName.c_str()) != 0) {
-        return -1;
-    }
-
+    bake.jobs.push_back(graph.add(jobPrefix + "sh", [state, diffuseShFileName] {
+        return saveSHCoeffs(state->ingested.diffuseSH, diffuseShFileName.c_str());
+    }, {ingestJob}));
+    bake.outputs.push_back(diffuseShFileName);
     return 0;
 }
 
-int processDfgLut(
-    [[maybe_unused]] const std::filesystem::path& assetPath,
-    fkyaml::node const& yaml,
-    const std::string& outDir
-) {
+int processDfgLut(JobGraph& graph, ThreadPool& threadPool, fkyaml::node const& yaml, const std::string& outDir, uint32_t zstdLevel, AssetBake& bake) {
     uint32_t size = yaml["size"].as_int();
     uint32_t numSamples = yaml["numSamples"].as_int();
-    std::vector<float> lutData = generateDFGLookupTable(size, numSamples);
-    return generate2DLookupTableToFile(lutData, size, (outDir + "/dfg.ktx2").c_str());
+    TextureFormat format = TextureFormat::RG32F;
+    if (yaml.contains("format")) {
+        std::string formatName = yaml["format"].as_str();
+        bool parsed = parseTextureFormat(formatName, format);
+        if (!parsed || (format != TextureFormat::RG32F && format != TextureFormat::RG16F)) {
+            std::cout << "Unsupported DFG LUT format: " << formatName << " (rg32f or rg16f)" << std::endl;
+            return -1;
+        }
+    }
+    TextureEncoding encoding = {.format = format, .zstdLevel = zstdLevel};
+    std::string outputFileName = outDir + "/dfg.ktx2";
+    bake.jobs.push_back(graph.add(bake.assetPath.filename().string() + " generate", [&threadPool, size, numSamples, outputFileName, encoding] {
+        std::vector<float> lutData = generateDFGLookupTable(threadPool, size, numSamples);
+        return generate2DLookupTableToFile(lutData, size, outputFileName.c_str(), encoding);
+    }));
+    bake.outputs.push_back(outputFileName);
+    return 0;
+}
+
+int processMesh(JobGraph& graph, fkyaml::node const& yaml, const std::string& outDir, AssetBake& bake) {
+    int cacheSize = yaml.contains("vertexCacheSize") ? yaml["vertexCacheSize"].get_value<int>() : 16;
+    float overdrawThreshold = yaml.contains("overdrawThreshold") ? yaml["overdrawThreshold"].get_value<float>() : 1.05f;
+    if (cacheSize < 3) {
+        std::cout << "vertexCacheSize must be at least 3" << std::endl;
+        return -1;
+    }
+    uint32_t vertexCacheSize = uint32_t(cacheSize);
+    if (overdrawThreshold != 0 && overdrawThreshold < 1) {
+        std::cout << "overdrawThreshold must be 0 (keep the cache order) or at least 1" << std::endl;
+        return -1;
+    }
+    const std::filesystem::path inputFileName = assetSourcePath(bake.assetPath);
+    std::string outputFileName = std::string(outDir / inputFileName.stem()) + ".mesh";
+    bake.jobs.push_back(graph.add(bake.assetPath.filename().string() + " optimize", [inputFileName, outputFileName, vertexCacheSize, overdrawThreshold] {
+        Model model = loadObj(inputFileName.string());
+        VertexCacheStats before = analyzeVertexCache(model.indices, model.vertices.size(), vertexCacheSize);
+        size_t indexCount = model.indices.size();
+        model.indices = optimizeVertexCache(model.indices, model.vertices.size(), vertexCacheSize);
+        model.indices = optimizeOverdraw(model.indices, model.vertices, vertexCacheSize, overdrawThreshold);
+        if (model.indices.size() != indexCount) {
+            std::cerr << "Error: " << inputFileName.string() << ": reordering changed the index count from " << indexCount << " to " << model.indices.size() << std::endl;
+            return -1;
+        }
+        optimizeVertexFetch(model.vertices, model.indices);
+        VertexCacheStats after = analyzeVertexCache(model.indices, model.vertices.size(), vertexCacheSize);
+        std::ostringstream report;
+        report << std::fixed << std::setprecision(3) << outputFileName
+            << ": " << model.vertices.size() << " vertices, " << model.indices.size() / 3 << " triangles"
+            << ", ACMR " << before.acmr << " -> " << after.acmr
+            << ", ATVR " << before.atvr << " -> " << after.atvr
+            << " (FIFO cache of " << vertexCacheSize << ")\n";
+        // One write per line, other jobs print concurrently
+        std::cout << report.str() << std::flush;
+        return saveMesh(model, outputFileName.c_str());
+    }));
+    bake.outputs.push_back(outputFileName);
+    return 0;
 }
 
-int processAsset(const std::filesystem::path& assetPath, const std::string& outDir) {
+struct ProcessStats {
+    int failureCount = 0;
+    int cacheHits = 0;
+    int cacheMisses = 0;
+};
+
+// Checks the cache and schedules baking jobs of an outdated asset.
+// Returns -1 if the asset can't be baked.
+int processAsset(
+    JobGraph& graph,
+    ThreadPool& threadPool,
+    SamplingTables& samplingTables,
+    const std::filesystem::path& assetPath,
+    const std::string& outDir,
+    AssetCache& cache,
+    bool force,
+    uint32_t zstdLevel,
+    ProcessStats& stats,
+    std::vector<AssetBake>& bakes
+) {
     auto assetYaml = loadYaml(assetPath.c_str());
     std::string assetType = assetYaml["type"].as_str();
+    if (assetType != "envmap" && assetType != "dfgLut" && assetType != "mesh") {
+        std::cout << "Unknown asset type: " << assetType << std::endl;
+        return -1;
+    }
+
+    // Cache key covers everything the output depends on
+    ContentHash key;
+    key.update(uint64_t(BAKER_VERSION));
+    key.update(fkyaml::node::serialize(assetYaml));
+    key.update(uint64_t(zstdLevel));
+    if (assetType != "dfgLut") {
+        std::filesystem::path sourcePath = assetSourcePath(assetPath);
+        if (!std::filesystem::exists(sourcePath)) {
+            std::cerr << "Source file not found: " << sourcePath << std::endl;
+            return -1;
+        }
+        key.update(cache.hashFile(sourcePath));
+        // Vertex colors come from the materials
+        std::filesystem::path materialPath = std::filesystem::path(sourcePath).replace_extension(".mtl");
+        if (assetType == "mesh" && std::filesystem::exists(materialPath)) {
+            key.update(cache.hashFile(materialPath));
+        }
+    }
 
-    if (assetType == "envmap") return processEnvmap(assetPath, assetYaml, outDir);
-    if (assetType == "dfgLut") return processDfgLut(assetPath, assetYaml, outDir);
+    if (!force && cache.isUpToDate(assetPath.string(), key.get())) {
+        stats.cacheHits++;
+        std::cout << " up to date" << std::endl;
+        return 0;
+    }
+    stats.cacheMisses++;
 
-    std::cout << "Unknown asset type: " << assetType << std::endl;
-    return -1;
+    AssetBake& bake = bakes.emplace_back();
+    bake.assetPath = assetPath;
+    bake.cacheKey = key.get();
+    int result = 0;
+    if (assetType == "envmap") {
+        result = processEnvmap(graph, threadPool, samplingTables, assetYaml, outDir, zstdLevel, bake);
+    } else if (assetType == "dfgLut") {
+        result = processDfgLut(graph, threadPool, assetYaml, outDir, zstdLevel, bake);
+    } else {
+        result = processMesh(graph, assetYaml, outDir, bake);
+    }
+    if (result != 0) {
+        bakes.pop_back();  // nothing was scheduled
+    }
+    return result;
 }
 
-int main() {
+int main(int argc, char** argv) {
     std::string assetsDir = "assets";
     std::string outDir = "build";
-    int failureCount = 0;
+    bool force = false;
+    uint32_t zstdLevel = 0;
+    unsigned jobCount = std::thread::hardware_concurrency();
+    std::string traceFileName;
+
+    CLI::App app{"Bakes assets from the assets directory into the build directory"};
+    app.add_flag("--force", force, "Rebake all assets, ignoring the cache");
+    app.add_option("-j,--jobs", jobCount, "Number of worker threads")->check(CLI::PositiveNumber);
+    app.add_option("--zstd", zstdLevel, "Zstandard supercompression level of KTX2 outputs, 0 to store them uncompressed")->check(CLI::Range(0, 22));
+    app.add_option("--trace", traceFileName, "Write a Chrome trace (chrome://tracing, ui.perfetto.dev) of the bake to the file");
+    CLI11_PARSE(app, argc, argv);
+    profiler::set_thread_name("main");
+
+    ThreadPool threadPool(jobCount);
+    SamplingTables samplingTables;
+    AssetCache cache(std::filesystem::path(outDir) / "ProcessAssets.cache");
+    ProcessStats stats;
+    JobGraph graph;
+    std::vector<AssetBake> bakes;
 
     for (auto const& dirEntry : std::filesystem::recursive_directory_iterator(assetsDir)) {
         std::filesystem::path filePath = dirEntry.path();
         if (filePath.string().ends_with(".asset.yaml")) {
             std::cout << filePath.string() << std::endl;
-            if (processAsset(filePath, outDir) != 0) {
-                failureCount++;
+            if (processAsset(graph, threadPool, samplingTables, filePath, outDir, cache, force, zstdLevel, stats, bakes) != 0) {
+                stats.failureCount++;
                 std::cout << " FAILED" << std::endl;
             }
         }
     }
-    if (failureCount) {
-        std::cerr << "Failures: " << failureCount << std::endl;
+
+    if (!bakes.empty()) {
+        std::cout << "Baking " << bakes.size() << " assets on " << threadPool.getThreadCount() << " threads" << std::endl;
+        graph.run(threadPool);
+        graph.printTimings(std::cout);
+    }
+
+    for (AssetBake const& bake : bakes) {
+        bool succeeded = std::all_of(bake.jobs.begin(), bake.jobs.end(), [&](JobGraph::JobId id) { return graph.succeeded(id); });
+        if (succeeded) {
+            cache.store(bake.assetPath.string(), bake.cacheKey, bake.outputs);
+        } else {
+            stats.failureCount++;
+            std::cout << bake.assetPath.string() << " FAILED" << std::endl;
+        }
+    }
+    cache.save();
+
+    if (!traceFileName.empty() && !profiler::getInstance().write_chrome_trace(traceFileName.c_str())) {
+        std::cerr << "Failed to write trace " << traceFileName << std::endl;
+    }
+
+    std::cout << "Cache: " << stats.cacheHits << " hits, " << stats.cacheMisses << " misses" << std::endl;
+    if (stats.failureCount) {
+        std::cerr << "Failures: " << stats.failureCount << std::endl;
     } else {
         std::cout << "No failures" << std::endl;
     }
-    return failureCount == 0 ? 0 : 1;
+    return stats.failureCount == 0 ? 0 : 1;
 }
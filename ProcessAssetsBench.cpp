@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include "CubemapFunctions.h"
+#include "EnvmapIngest.h"
+#include "SphericalHarmonics.h"
+#include "SunExtraction.h"
+#include "BRDF.h"
+#include "ThreadPool.h"
+#include <CLI11.hpp>
+
+/*
+Microbenchmarks of the baking kernels.
+
+Every case runs its warmup iterations, then the measured repetitions, and reports the median throughput.
+Setup (input generation, copies of data a kernel modifies) is excluded from the timings.
+Results are printed as a table and optionally written as JSON, to be compared between commits.
+*/
+
+struct BenchResult {
+    std::string kernel;
+    std::string input;  // input description, like sizes and sample counts
+    std::string unit;   // what is counted, like texels or samples
+    double itemsPerRun;
+    std::vector<double> seconds;
+
+    double median() const {
+        std::vector<double> sorted = seconds;
+        std::sort(sorted.begin(), sorted.end());
+        size_t n = sorted.size();
+        return n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+    }
+    double min() const { return *std::min_element(seconds.begin(), seconds.end()); }
+    double mean() const { return std::accumulate(seconds.begin(), seconds.end(), 0.0) / seconds.size(); }
+    double stddev() const {
+        if (seconds.size() < 2) return 0.0;
+        double m = mean();
+        double sum = 0.0;
+        for (double s : seconds) sum += (s - m) * (s - m);
+        return std::sqrt(sum / (seconds.size() - 1));
+    }
+    double throughput() const { return itemsPerRun / median(); }
+};
+
+std::string jsonString(std::string const& value) {
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+class Bench {
+public:
+    Bench(int warmup, int repetitions, std::string filter)
+        : m_warmup(warmup), m_repetitions(repetitions), m_filter(std::move(filter)) {}
+
+    // setup runs before every iteration and isn't timed. Returns the median seconds, 0 if the case is filtered out.
+    double run(std::string const& kernel, std::string const& input, std::string const& unit, double itemsPerRun,
+               std::function<void()> const& fn, std::function<void()> const& setup = {}) {
+        std::string name = kernel + " " + input;
+        if (!m_filter.empty() && name.find(m_filter) == std::string::npos) return 0.0;
+
+        BenchResult result{kernel, input, unit, itemsPerRun, {}};
+        for (int i = 0; i < m_warmup + m_repetitions; ++i) {
+            if (setup) setup();
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            auto end = std::chrono::steady_clock::now();
+            if (i >= m_warmup) {
+                result.seconds.push_back(std::chrono::duration<double>(end - start).count());
+            }
+        }
+        std::cout << "  " << name << ": " << result.median() * 1000.0 << " ms median, "
+                  << result.min() * 1000.0 << " ms min, +-" << result.stddev() * 1000.0 << " ms, "
+                  << result.throughput() / 1e6 << " M" << unit << "/s" << std::endl;
+        double median = result.median();
+        m_results.push_back(std::move(result));
+        return median;
+    }
+
+    void writeJson(std::ostream& os, unsigned threadCount) const {
+        os << "{\n  \"threads\": " << threadCount << ",\n  \"warmup\": " << m_warmup << ",\n  \"repetitions\": " << m_repetitions << ",\n  \"results\": [";
+        for (size_t i = 0; i < m_results.size(); ++i) {
+            BenchResult const& r = m_results[i];
+            os << (i ? ",\n" : "\n");
+            os << "    {\"kernel\": " << jsonString(r.kernel) << ", \"input\": " << jsonString(r.input) << ", \"unit\": " << jsonString(r.unit)
+               << ", \"itemsPerRun\": " << r.itemsPerRun
+               << ", \"medianSeconds\": " << r.median() << ", \"minSeconds\": " << r.min()
+               << ", \"meanSeconds\": " << r.mean() << ", \"stddevSeconds\": " << r.stddev()
+               << ", \"itemsPerSecond\": " << r.throughput() << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+private:
+    int m_warmup;
+    int m_repetitions;
+    std::string m_filter;
+    std::vector<BenchResult> m_results;
+};
+
+// Smooth gradients with a high frequency pattern and a small bright sun, so filtering and compression do real work
+ImageData syntheticPanorama(int width, int height) {
+    ImageData image;
+    image.width = width;
+    image.height = height;
+    image.dataSize = size_t(width) * height * 4 * sizeof(float);
+    image.imageFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+    image.data.reset(malloc(image.dataSize));
+    float* rgba = static_cast<float*>(image.data.get());
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(0.0f, 0.1f);
+    int sunX = width * 2 / 3;
+    int sunY = height / 4;
+    int sunRadius = std::max(width / 1024, 1);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float* texel = rgba + (size_t(y) * width + x) * 4;
+            float sky = 1.0f - float(y) / height;
+            texel[0] = 0.2f + 0.5f * sky + noise(rng);
+            texel[1] = 0.3f + 0.6f * sky + noise(rng);
+            texel[2] = 0.4f + 0.8f * sky + 0.2f * std::sin(x * 0.05f) + noise(rng);
+            texel[3] = 1.0f;
+            int dx = x - sunX;
+            int dy = y - sunY;
+            if (dx * dx + dy * dy <= sunRadius * sunRadius) {
+                texel[0] = texel[1] = texel[2] = 50000.0f;
+            }
+        }
+    }
+    return image;
+}
+
+ImageData copyImage(ImageData const& image) {
+    ImageData copy;
+    copy.width = image.width;
+    copy.height = image.height;
+    copy.dataSize = image.dataSize;
+    copy.imageFormat = image.imageFormat;
+    copy.data.reset(malloc(image.dataSize));
+    std::memcpy(copy.data.get(), image.data.get(), image.dataSize);
+    return copy;
+}
+
+std::string sizeName(int width, int height) {
+    return std::to_string(width) + "x" + std::to_string(height);
+}
+
+// The cubemap conversion of ingestEquirectangularPanorama, with the whole panorama in memory as a single band
+std::vector<float> convertPanoramaWithTexelTable(ThreadPool& threadPool, EquirectangularTexelTable const& table, ImageData const& panorama, int faceSize) {
+    std::vector<float> cubemap(6 * size_t(faceSize) * faceSize * 3);
+    std::vector<uint32_t> texels = groupCubemapTexelsByBand(threadPool, table, faceSize, panorama.height, panorama.height)[0];
+    EquirectangularRows rows = {static_cast<const float*>(panorama.data.get()), panorama.width, panorama.height, 0, panorama.height};
+    size_t taskCount = (texels.size() + INGEST_TEXELS_PER_TASK - 1) / INGEST_TEXELS_PER_TASK;
+    threadPool.parallelFor(taskCount, [&](size_t task) {
+        size_t begin = task * INGEST_TEXELS_PER_TASK;
+        size_t count = std::min(INGEST_TEXELS_PER_TASK, texels.size() - begin);
+        convertEquirectangularRowsToCubemapTexels(rows, table, texels.data() + begin, count, cubemap.data());
+    });
+    return cubemap;
+}
+
+void benchPanorama(Bench& bench, ThreadPool& threadPool, ImageData const& panorama, std::string const& name, std::vector<int> const& faceSizes) {
+    std::string input = name + " " + sizeName(panorama.width, panorama.height);
+    double panoramaTexels = double(panorama.width) * panorama.height;
+
+    for (int faceSize : faceSizes) {
+        std::string faceInput = input + " face " + std::to_string(faceSize);
+        double cubemapTexels = 6.0 * faceSize * faceSize;
+        // Cold: the first panorama of its size, the texel table is built as well
+        std::unique_ptr<SamplingTables> coldTables;
+        bench.run("equirectToCubeColdTable", faceInput, "texels", cubemapTexels, [&] {
+            auto table = coldTables->equirectangularTexels(threadPool, faceSize, panorama.width, panorama.height);
+            convertPanoramaWithTexelTable(threadPool, *table, panorama, faceSize);
+        }, [&] {
+            coldTables = std::make_unique<SamplingTables>();
+        });
+        // Warm: the table is cached from an earlier panorama of the same size
+        SamplingTables warmTables;
+        auto table = warmTables.equirectangularTexels(threadPool, faceSize, panorama.width, panorama.height);
+        bench.run("equirectToCubeWarmTable", faceInput, "texels", cubemapTexels, [&] {
+            convertPanoramaWithTexelTable(threadPool, *table, panorama, faceSize);
+        });
+    }
+
+    for (int order : {2, 4}) {
+        bench.run("shProjection", input + " order " + std::to_string(order), "texels", panoramaTexels, [&] {
+            calculateDiffuseSphericalHarmonics(threadPool, panorama, order);
+        });
+    }
+
+    ImageData scratch;
+    bench.run("sunExtraction", input, "texels", panoramaTexels, [&] {
+        extractSunFromEquirectangularPanorama(scratch, 0.0025f);
+    }, [&] {
+        scratch = copyImage(panorama);
+    });
+}
+
+// Every roughness mip of a prefilter, each one is a separate case
+void benchPrefilter(Bench& bench, ThreadPool& threadPool, SamplingTables& samplingTables, std::vector<float> const& baseLevel, int baseFaceSize, int sampleCount) {
+    CubemapPyramid source = buildCubemapPyramid(threadPool, baseLevel, baseFaceSize);
+    int numMipLevels = static_cast<int>(std::floor(std::log2(baseFaceSize))) + 1;
+    for (int mip = 1; mip < numMipLevels; ++mip) {
+        int faceSize = std::max(baseFaceSize >> mip, 1);
+        float roughness = static_cast<float>(mip) / static_cast<float>(numMipLevels - 1);
+        auto samples = samplingTables.ggxSamples(roughness, sampleCount, baseFaceSize, 0);
+        std::vector<CubemapTile> tiles;
+        appendCubemapTiles(tiles, mip, faceSize);
+
+        std::string input = "face " + std::to_string(baseFaceSize) + " mip " + std::to_string(mip) + " " + std::to_string(sampleCount) + " spp";
+        bench.run("ggxPrefilter", input, "samples", 6.0 * faceSize * faceSize * samples->size(), [&] {
+            threadPool.parallelFor(tiles.size(), [&](size_t i) {
+                float tileData[CUBEMAP_TILE_SIZE * CUBEMAP_TILE_SIZE * 3];
+                filterCubemapTileForRoughness(source, faceSize, tiles[i], *samples, nullptr, tileData);
+            });
+        });
+    }
+}
+
+// Encoding of a full mip chain into KTX2 storage and the file write
+void benchKtx2Write(Bench& bench, ThreadPool& threadPool, std::vector<float> const& baseLevel, int baseFaceSize, std::filesystem::path const& outDir) {
+    CubemapPyramid pyramid = buildCubemapPyramid(threadPool, baseLevel, baseFaceSize);
+    int numMipLevels = int(pyramid.levels.size());
+    std::vector<CubemapTile> tiles;
+    double texelCount = 0;
+    for (int mip = 0; mip < numMipLevels; ++mip) {
+        int faceSize = std::max(baseFaceSize >> mip, 1);
+        appendCubemapTiles(tiles, mip, faceSize);
+        texelCount += 6.0 * faceSize * faceSize;
+    }
+    std::string fileName = (outDir / "ProcessAssetsBench.ktx2").string();
+
+    struct Case {
+        const char* name;
+        TextureEncoding encoding;
+    };
+    for (Case const& c : {
+        Case{"rgba16f", {.format = TextureFormat::RGBA16F}},
+        Case{"rgb9e5", {.format = TextureFormat::RGB9E5}},
+        Case{"bc6h fast", {.format = TextureFormat::BC6H, .bc6hQuality = BC6HQuality::Fast}},
+        Case{"bc6h normal", {.format = TextureFormat::BC6H}},
+        Case{"rgb9e5 zstd 10", {.format = TextureFormat::RGB9E5, .zstdLevel = 10}},
+    }) {
+        std::string input = "face " + std::to_string(baseFaceSize) + " " + c.name;
+        bench.run("ktx2Write", input, "texels", texelCount, [&] {
+            ktxTexture2* texture = createCubemapKtx2(baseFaceSize, numMipLevels, c.encoding.format);
+            threadPool.parallelFor(tiles.size(), [&](size_t i) {
+                CubemapTile const& tile = tiles[i];
+                int faceSize = std::max(baseFaceSize >> tile.mip, 1);
+                const float* texels = pyramid.levels[tile.mip].data() + ((size_t(tile.face) * faceSize + tile.y0) * faceSize + tile.x0) * 3;
+                storeCubemapTile(texture, c.encoding, faceSize, tile, texels, faceSize);
+            });
+            writeKtx2ToFile(texture, fileName.c_str(), c.encoding.zstdLevel);
+            ktxTexture_Destroy(ktxTexture(texture));
+        });
+    }
+    std::filesystem::remove(fileName);
+}
+
+// Vectorized DFG LUT against the scalar reference on the same LUT: speedup and max difference
+void benchDfgLut(Bench& bench, ThreadPool& threadPool, uint32_t size, uint32_t numSamples) {
+    std::string input = std::to_string(size) + " " + std::to_string(numSamples) + " spp";
+    double samples = double(size) * size * numSamples;
+    std::vector<float> lut;
+    std::vector<float> reference;
+    double vectorizedSeconds = bench.run("dfgLut", input, "samples", samples, [&] {
+        lut = generateDFGLookupTable(threadPool, size, numSamples);
+    });
+    double scalarSeconds = bench.run("dfgLutScalar", input, "samples", samples, [&] {
+        reference = generateDFGLookupTableReference(threadPool, size, numSamples);
+    });
+    if (vectorizedSeconds > 0 && scalarSeconds > 0) {
+        float maxDifference = 0;
+        for (size_t i = 0; i < lut.size(); ++i) {
+            maxDifference = std::max(maxDifference, std::abs(lut[i] - reference[i]));
+        }
+        std::cout << "  dfgLut " << input << ": " << scalarSeconds / vectorizedSeconds << "x faster than scalar, max difference "
+                  << maxDifference << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    int warmup = 1;
+    int repetitions = 5;
+    std::string filter;
+    std::string jsonFileName;
+    std::vector<std::string> inputs;
+    std::string outDir = std::filesystem::temp_directory_path().string();
+    unsigned jobCount = std::thread::hardware_concurrency();
+
+    CLI::App app{"Benchmarks the baking kernels on synthetic panoramas and optional real ones"};
+    app.add_option("--warmup", warmup, "Untimed iterations before measuring")->check(CLI::NonNegativeNumber);
+    app.add_option("-r,--repetitions", repetitions, "Timed iterations")->check(CLI::PositiveNumber);
+    app.add_option("-f,--filter", filter, "Only run cases whose name contains the string");
+    app.add_option("--json", jsonFileName, "Write results as JSON to the file");
+    app.add_option("-i,--input", inputs, "Real equirectangular panoramas (EXR) to benchmark in addition to synthetic ones")->check(CLI::ExistingFile);
+    app.add_option("--out-dir", outDir, "Directory for temporary KTX2 files");
+    app.add_option("-j,--jobs", jobCount, "Number of worker threads")->check(CLI::PositiveNumber);
+    CLI11_PARSE(app, argc, argv);
+
+    ThreadPool threadPool(jobCount);
+    SamplingTables samplingTables;
+    Bench bench(warmup, repetitions, filter);
+    std::cout << "Benchmarking on " << threadPool.getThreadCount() << " threads" << std::endl;
+
+    for (auto [width, height] : {std::pair{1024, 512}, std::pair{4096, 2048}}) {
+        ImageData panorama = syntheticPanorama(width, height);
+        benchPanorama(bench, threadPool, panorama, "synthetic", {width / 4});
+    }
+    for (std::string const& input : inputs) {
+        ImageData panorama = loadImage(input);
+        benchPanorama(bench, threadPool, panorama, std::filesystem::path(input).filename().string(), {256, 1024});
+    }
+
+    ImageData cubemapSource = syntheticPanorama(2048, 1024);
+    for (int faceSize : {128, 512}) {
+        auto table = samplingTables.equirectangularTexels(threadPool, faceSize, cubemapSource.width, cubemapSource.height);
+        std::vector<float> baseLevel = convertPanoramaWithTexelTable(threadPool, *table, cubemapSource, faceSize);
+        benchPrefilter(bench, threadPool, samplingTables, baseLevel, faceSize, 64);
+        benchKtx2Write(bench, threadPool, baseLevel, faceSize, outDir);
+    }
+
+    for (int size : {128, 512}) {
+        benchDfgLut(bench, threadPool, size, 1024);
+    }
+
+    if (!jsonFileName.empty()) {
+        std::ofstream json(jsonFileName);
+        bench.writeJson(json, threadPool.getThreadCount());
+        if (!json) {
+            std::cerr << "Failed to write " << jsonFileName << std::endl;
+            return -1;
+        }
+        std::cout << "Results written to " << jsonFileName << std::endl;
+    }
+    return 0;
+}
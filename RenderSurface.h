@@ -7,16 +7,20 @@
 #include <vulkan/vk_enum_string_helper.h>
 
 #include "Swapchain.h"
+#include "OffscreenTarget.h"
 #include "VulkanFunctions.h"
 #include "Tonemapper.h"
+#include "GpuTimer.h"
+#include "FrameCounters.h"
 
 /*
 Manages:
-- Swapchain
+- Swapchain, or offscreen images when there is no window (headless rendering)
 - Command buffers
 - Frames in flight synchronization
 - Render passes and framebuffers
 - Presentation (including tonemapping)
+- GPU timestamps and pipeline statistics of the frames
 */
 class RenderSurface {
 public:
@@ -29,16 +33,19 @@ public:
         VkQueue graphicsQueue;
         VkQueue presentQueue;
         uint32_t graphicsQueueFamilyIndex;
-        SDL_Window* window;
+        SDL_Window* window; // nullptr to render into offscreen images
         uint32_t framesInFlight;
         bool vsyncEnabled;
         VkSampleCountFlagBits msaaSamples;
         VkDescriptorSetLayout frameLevelDescriptorSetLayout;
+        bool pipelineStatisticsQuery = false;
+        VkExtent2D offscreenExtent = {}; // size of the offscreen images
     };
     struct Frame {
         VkCommandBuffer commandBuffer;
         uint32_t swapchainImageIndex;
         VkSemaphore swapchainImageAvailableSemaphore;
+        uint32_t frameIndex; // frame in flight
     };
 
     RenderSurface(const CreateArgs& args): 
@@ -51,20 +58,28 @@ public:
         m_presentQueue(args.presentQueue),
         m_vsyncEnabled(args.vsyncEnabled),
         m_frameLevelDescriptorSetLayout(args.frameLevelDescriptorSetLayout),
+        m_offscreenExtent(args.offscreenExtent),
         m_colorImageFormat(args.renderInFormat),
         m_msaaSamples(args.msaaSamples),
         m_framesInFlight(args.framesInFlight),
         m_framebuffers(args.framesInFlight),
         m_renderFinishedSemaphores(args.framesInFlight),
         m_renderFences(args.framesInFlight),
-        m_commandBuffers(args.framesInFlight)
+        m_commandBuffers(args.framesInFlight),
+        m_gpuTimer(args.physicalDevice, args.device, args.graphicsQueueFamilyIndex, args.framesInFlight),
+        m_pipelineStatistics(args.device, args.framesInFlight, args.pipelineStatisticsQuery)
     {
-        if (SDL_Vulkan_CreateSurface(m_window, m_instance, &m_surface) != SDL_TRUE) {
-            std::cerr << SDL_GetError() << std::endl;
-            throw std::runtime_error("Failed to create Vulkan surface");
-        }
         VkExtent2D extent = getWindowExtent();
-        m_swapchain = std::make_unique<Swapchain>(args.physicalDevice, args.device, m_surface, extent, args.framesInFlight, args.vsyncEnabled, m_preferredSurfaceFormats);
+        if (m_window) {
+            if (SDL_Vulkan_CreateSurface(m_window, m_instance, &m_surface) != SDL_TRUE) {
+                std::cerr << SDL_GetError() << std::endl;
+                throw std::runtime_error("Failed to create Vulkan surface");
+            }
+            m_swapchain = std::make_unique<Swapchain>(args.physicalDevice, args.device, m_surface, extent, args.framesInFlight, args.vsyncEnabled, m_preferredSurfaceFormats);
+        }
+        else {
+            m_offscreenTarget = std::make_unique<OffscreenTarget>(args.physicalDevice, args.device, extent, args.framesInFlight, m_preferredSurfaceFormats);
+        }
         createSyncObjects();
         createCommandBuffers(args.graphicsQueueFamilyIndex);
         createImages(extent);
@@ -83,8 +98,11 @@ public:
     Frame beginFrame(VkClearColorValue clearColor = {}) {
         vkWaitForFences(m_device, 1, &m_renderFences[m_currentFrame], true, UINT64_MAX);
         uint32_t swapchainImageIndex;
-        VkSemaphore swapchainImageAvailableSemaphore;
-        while (true) {
+        VkSemaphore swapchainImageAvailableSemaphore = VK_NULL_HANDLE;
+        if (m_offscreenTarget) {
+            swapchainImageIndex = m_offscreenTarget->acquireNextImage();
+        }
+        else while (true) {
             auto [needRecreateSwapchain, _swapchainImageIndex, _swapchainImageAvailableSemaphore] = m_swapchain->acquireNextImage();
             if (needRecreateSwapchain) {
                 recreateSwapchain();
@@ -105,6 +123,8 @@ public:
         if (vkBeginCommandBuffer(commandBuffer, &commanBufferBeginInfo) != VK_SUCCESS) {
             throw std::runtime_error("Failed to begin recording command buffer!");
         }
+        m_gpuTimer.beginFrame(commandBuffer, m_currentFrame);
+        m_pipelineStatistics.beginFrame(commandBuffer, m_currentFrame);
 
         std::array clearValues{
             VkClearValue{.depthStencil={1.0f, 0}},
@@ -116,17 +136,18 @@ public:
             .renderPass = m_renderPass,
             .framebuffer = m_framebuffers[swapchainImageIndex],
             .renderArea.offset = { 0, 0 },
-            .renderArea.extent = m_swapchain->getExtent(),
+            .renderArea.extent = getExtent(),
             .clearValueCount = clearValues.size(),
             .pClearValues = clearValues.data(),
         };
         vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-        return {commandBuffer, swapchainImageIndex, swapchainImageAvailableSemaphore};
+        return {commandBuffer, swapchainImageIndex, swapchainImageAvailableSemaphore, m_currentFrame};
     }
 
     void postprocess(Frame frame, VkDescriptorSet frameLevelDescriptorSet) {
         vkCmdNextSubpass(frame.commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+        GpuTimer::Scope gpuScope = gpuTimerScope(frame, GpuTimer::Phase::Tonemap);
         m_tonemapper->tonemap(
             frame.commandBuffer,
             frameLevelDescriptorSet,
@@ -138,28 +159,34 @@ public:
 
     void endFrame(Frame frame) {
         vkCmdEndRenderPass(frame.commandBuffer);
+        m_gpuTimer.endFrame(frame.commandBuffer, frame.frameIndex);
+        m_pipelineStatistics.endFrame(frame.commandBuffer, frame.frameIndex);
 
         if (vkEndCommandBuffer(frame.commandBuffer) != VK_SUCCESS) {
             throw std::runtime_error("Failed to record command buffer!");
         }
 
-        // Submit the command buffer
+        // Submit the command buffer, offscreen images are reused only after the fence so there is nothing to wait for or signal
         VkPipelineStageFlags waitStages[] = {
             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT // Wait for color output stage
         };
         VkSubmitInfo submitInfo{
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .waitSemaphoreCount = 1,
+            .waitSemaphoreCount = m_swapchain ? 1u : 0u,
             .pWaitSemaphores = &frame.swapchainImageAvailableSemaphore, // Wait for the image to be available
             .pWaitDstStageMask = waitStages,
             .commandBufferCount = 1,
             .pCommandBuffers = &frame.commandBuffer,
-            .signalSemaphoreCount = 1,
+            .signalSemaphoreCount = m_swapchain ? 1u : 0u,
             .pSignalSemaphores = &m_renderFinishedSemaphores[m_currentFrame], // Signal when rendering is finished
         };
         if (vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_renderFences[m_currentFrame]) != VK_SUCCESS) {
             throw std::runtime_error("Failed to submit draw command buffer!");
         }
+        if (m_offscreenTarget) {
+            m_currentFrame = (m_currentFrame + 1) % m_framesInFlight;
+            return;
+        }
 
         // Present the rendered image
         VkPresentInfoKHR presentInfo {
@@ -184,16 +211,35 @@ public:
     }
 
     // Getters
-    VkExtent2D getExtent() const { return m_swapchain->getExtent(); }
-    VkSurfaceFormatKHR getFormat() const { return m_swapchain->getFormat(); }
-    VkFormat getImageFormat() const { return m_swapchain->getFormat().format; }
+    VkExtent2D getExtent() const { return m_swapchain ? m_swapchain->getExtent() : m_offscreenTarget->getExtent(); }
+    VkSurfaceFormatKHR getFormat() const { return m_swapchain ? m_swapchain->getFormat() : m_offscreenTarget->getFormat(); }
+    VkFormat getImageFormat() const { return getFormat().format; }
     VkFormat getDepthFormat() const { return m_depthFormat; }
     uint32_t getImageCount() const { return m_framesInFlight; }
     VkRenderPass getRenderPass() const { return m_renderPass; }
     VkSampleCountFlagBits getMsaaSamples() const { return m_msaaSamples; }
     uint32_t getFramesInFlight() const { return m_framesInFlight; }
+    GpuTimer::Times const& getGpuTimes() const { return m_gpuTimer.latest(); }
+    PipelineStatisticsQuery::Statistics const& getPipelineStatistics() const { return m_pipelineStatistics.latest(); }
+
+    // Measures the GPU time of the commands recorded while the scope is alive
+    GpuTimer::Scope gpuTimerScope(Frame const& frame, GpuTimer::Phase phase) {
+        return GpuTimer::Scope(m_gpuTimer, frame.commandBuffer, frame.frameIndex, phase);
+    }
     bool isFormatSupported(VkSurfaceFormatKHR surfaceFormat) const {
-        return m_swapchain->getSupportedFormats().contains(surfaceFormat);
+        SurfaceFormatSet const& supportedFormats = m_swapchain ? m_swapchain->getSupportedFormats() : m_offscreenTarget->getSupportedFormats();
+        return supportedFormats.contains(surfaceFormat);
+    }
+    bool isOffscreen() const { return m_offscreenTarget != nullptr; }
+
+    // Pixels of an offscreen image after tonemapping, in getImageFormat().
+    // Waits for all rendering to finish.
+    std::vector<uint8_t> readPixels(uint32_t swapchainImageIndex) {
+        if (!m_offscreenTarget) {
+            throw std::runtime_error("Only offscreen images can be read back!");
+        }
+        vkDeviceWaitIdle(m_device);
+        return m_offscreenTarget->readPixels(swapchainImageIndex, m_commandPool, m_graphicsQueue);
     }
     
     // Config changes
@@ -357,14 +403,14 @@ private:
         uint32_t outputAttachment = attachments.size();
         attachments.push_back(
             {
-                .format = m_swapchain->getFormat().format,
+                .format = getImageFormat(),
                 .samples = VK_SAMPLE_COUNT_1_BIT,
                 .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
                 .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
                 .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
                 .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
                 .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                .finalLayout = m_swapchain ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : OffscreenTarget::FINAL_LAYOUT,
             }
         );
 
@@ -456,13 +502,13 @@ private:
             throw std::runtime_error("Failed to create render pass!");
         }
 
-        VkExtent2D extent = m_swapchain->getExtent();
+        VkExtent2D extent = getExtent();
         std::vector<VkImageView> framebufferAttachments;
         for (size_t i = 0; i < m_framebuffers.size(); i++) {
             framebufferAttachments = {
                 m_depthImageView,
                 m_colorImageView,
-                m_swapchain->getImageView(i),
+                m_swapchain ? m_swapchain->getImageView(i) : m_offscreenTarget->getImageView(i),
             };
             if (m_msaaSamples > 1) {
                 framebufferAttachments.push_back(m_multisampledColorImageView);
@@ -491,7 +537,13 @@ private:
         }
         destroyImages();
         VkExtent2D extent = getWindowExtent();
-        m_swapchain = std::make_unique<Swapchain>(m_physicalDevice, m_device, m_surface, extent, m_framesInFlight, m_vsyncEnabled, m_preferredSurfaceFormats, std::move(m_swapchain));
+        if (m_swapchain) {
+            m_swapchain = std::make_unique<Swapchain>(m_physicalDevice, m_device, m_surface, extent, m_framesInFlight, m_vsyncEnabled, m_preferredSurfaceFormats, std::move(m_swapchain));
+        }
+        else {
+            m_offscreenTarget.reset();
+            m_offscreenTarget = std::make_unique<OffscreenTarget>(m_physicalDevice, m_device, extent, m_framesInFlight, m_preferredSurfaceFormats);
+        }
         createImages(extent);
 
         vkDestroyRenderPass(m_device, m_renderPass, nullptr);
@@ -534,6 +586,9 @@ private:
     }
 
     VkExtent2D getWindowExtent() const {
+        if (!m_window) {
+            return m_offscreenExtent;
+        }
         int width;
         int height;
         SDL_GetWindowSize(m_window, &width, &height);
@@ -554,6 +609,10 @@ private:
     std::unique_ptr<Swapchain> m_swapchain;
     VkDescriptorSetLayout m_frameLevelDescriptorSetLayout;
 
+    // Headless rendering, instead of the swapchain
+    VkExtent2D m_offscreenExtent;
+    std::unique_ptr<OffscreenTarget> m_offscreenTarget;
+
     // Tone mapping
     std::unique_ptr<Tonemapper> m_tonemapper;
     Tonemapper::Operator m_tonemapOperator = Tonemapper::Operator::NoTonemapping;
@@ -585,4 +644,7 @@ private:
     std::vector<VkSemaphore> m_renderFinishedSemaphores;
     std::vector<VkFence> m_renderFences;
     std::vector<VkCommandBuffer> m_commandBuffers;
+
+    GpuTimer m_gpuTimer;
+    PipelineStatisticsQuery m_pipelineStatistics;
 };
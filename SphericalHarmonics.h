@@ -0,0 +1,306 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <glm/glm.hpp>
+#include "CubemapFunctions.h"
+#include "ImageFunctions.h"
+#include "ThreadPool.h"
+
+// Highest supported SH band, the runtime uniform buffer is sized for it
+constexpr int SH_MAX_ORDER = 4;
+constexpr int SH_MAX_COEFFICIENTS = (SH_MAX_ORDER + 1) * (SH_MAX_ORDER + 1);
+
+constexpr int shCoefficientCount(int order) {
+    return (order + 1) * (order + 1);
+}
+
+// Real, orthonormal SH basis up to the given order (bands 0..order), coefficient index is l * (l + 1) + m.
+// Must match evaluateSH in shader.fragment.glsl.
+void evaluateSHBasis(int order, glm::vec3 dir, float* Y) {
+    float x = dir.x;
+    float y = dir.y;
+    float z = dir.z;
+    float x2 = x * x;
+    float y2 = y * y;
+    float z2 = z * z;
+
+    Y[0] = 0.282095f;
+    if (order < 1) return;
+    Y[1] = 0.488603f * y;
+    Y[2] = 0.488603f * z;
+    Y[3] = 0.488603f * x;
+    if (order < 2) return;
+    Y[4] = 1.092548f * x * y;
+    Y[5] = 1.092548f * y * z;
+    Y[6] = 0.315392f * (3.0f * z2 - 1.0f);
+    Y[7] = 1.092548f * x * z;
+    Y[8] = 0.546274f * (x2 - y2);
+    if (order < 3) return;
+    Y[9] = 0.590044f * y * (3.0f * x2 - y2);
+    Y[10] = 2.890611f * x * y * z;
+    Y[11] = 0.457046f * y * (5.0f * z2 - 1.0f);
+    Y[12] = 0.373176f * z * (5.0f * z2 - 3.0f);
+    Y[13] = 0.457046f * x * (5.0f * z2 - 1.0f);
+    Y[14] = 1.445306f * z * (x2 - y2);
+    Y[15] = 0.590044f * x * (x2 - 3.0f * y2);
+    if (order < 4) return;
+    Y[16] = 2.503343f * x * y * (x2 - y2);
+    Y[17] = 1.770131f * y * z * (3.0f * x2 - y2);
+    Y[18] = 0.946175f * x * y * (7.0f * z2 - 1.0f);
+    Y[19] = 0.669047f * y * z * (7.0f * z2 - 3.0f);
+    Y[20] = 0.105786f * (35.0f * z2 * z2 - 30.0f * z2 + 3.0f);
+    Y[21] = 0.669047f * x * z * (7.0f * z2 - 3.0f);
+    Y[22] = 0.473087f * (x2 - y2) * (7.0f * z2 - 1.0f);
+    Y[23] = 1.770131f * x * z * (x2 - 3.0f * y2);
+    Y[24] = 0.625836f * (x2 * (x2 - 3.0f * y2) - y2 * (3.0f * x2 - y2));
+}
+
+/*
+Projects an equirectangular environment map onto SH.
+
+Along a row of the panorama every basis function is a trigonometric polynomial of degree <= order in phi.
+Its Fourier coefficients are computed once per row from 2 * order + 1 samples,
+so per texel only the color is multiplied with the column table of cos(m * phi) and sin(m * phi)
+and there is no trigonometry or basis evaluation in the inner loop.
+
+Columns are accumulated in independent lanes (vectorized by the compiler), lanes are summed pairwise per row
+and rows are accumulated in double precision, which keeps 8k+ panoramas accurate.
+*/
+class SHProjector {
+public:
+    static constexpr int MAX_HARMONICS = 2 * SH_MAX_ORDER + 1;
+    static constexpr int LANES = 8;
+
+    SHProjector(int width, int height, int order):
+        m_width(width),
+        m_height(height),
+        m_order(order),
+        m_harmonicCount(2 * order + 1),
+        m_columnTrig(size_t(m_harmonicCount) * width),
+        m_rowSinTheta(height),
+        m_rowCosTheta(height)
+    {
+        if (order < 0 || order > SH_MAX_ORDER) {
+            throw std::runtime_error("Unsupported SH order: " + std::to_string(order));
+        }
+        // Harmonic 0 is the constant, 2m - 1 is cos(m * phi), 2m is sin(m * phi)
+        for (int x = 0; x < width; ++x) {
+            double phi = (x + 0.5) / width * 2.0 * M_PI;
+            m_columnTrig[x] = 1.0f;
+            for (int m = 1; m <= order; ++m) {
+                m_columnTrig[size_t(2 * m - 1) * width + x] = float(std::cos(m * phi));
+                m_columnTrig[size_t(2 * m) * width + x] = float(std::sin(m * phi));
+            }
+        }
+        for (int y = 0; y < height; ++y) {
+            double theta = (y + 0.5) / height * M_PI;
+            m_rowSinTheta[y] = std::sin(theta);
+            m_rowCosTheta[y] = std::cos(theta);
+        }
+    }
+
+    int getOrder() const { return m_order; }
+    int getCoefficientCount() const { return shCoefficientCount(m_order); }
+
+    // Adds the projection of rows [rowBegin, rowEnd) to sums (RGB triplets, getCoefficientCount() of them).
+    // rgba points to the first texel of rowBegin.
+    void accumulateRows(const float* rgba, int rowBegin, int rowEnd, std::vector<double>& sums) const {
+        sums.resize(getCoefficientCount() * 3, 0.0);
+        float rowBasis[SH_MAX_COEFFICIENTS][MAX_HARMONICS];
+        float rowSums[MAX_HARMONICS][3];
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            rowFourierBasis(y, rowBasis);
+            accumulateRow(rgba + size_t(y - rowBegin) * m_width * 4, rowSums);
+
+            // Differential solid angle of the texel, sin(θ) comes from Jacobian of spherical coordinates
+            double dOmega = (M_PI / m_height) * (2.0 * M_PI / m_width) * m_rowSinTheta[y];
+            for (int i = 0; i < getCoefficientCount(); ++i) {
+                for (int c = 0; c < 3; ++c) {
+                    double sum = 0.0;
+                    for (int h = 0; h < m_harmonicCount; ++h) {
+                        sum += double(rowBasis[i][h]) * rowSums[h][c];
+                    }
+                    sums[i * 3 + c] += sum * dOmega;
+                }
+            }
+        }
+    }
+
+    static std::vector<glm::vec3> toCoefficients(std::vector<double> const& sums) {
+        std::vector<glm::vec3> shCoeffs(sums.size() / 3);
+        for (size_t i = 0; i < shCoeffs.size(); ++i) {
+            shCoeffs[i] = glm::vec3(float(sums[i * 3]), float(sums[i * 3 + 1]), float(sums[i * 3 + 2]));
+        }
+        return shCoeffs;
+    }
+
+private:
+    // Fourier coefficients of the basis functions along row y, indexed like m_columnTrig
+    void rowFourierBasis(int y, float (&rowBasis)[SH_MAX_COEFFICIENTS][MAX_HARMONICS]) const {
+        // 2 * order + 1 equidistant samples determine a trigonometric polynomial of degree order exactly
+        int sampleCount = m_harmonicCount;
+        float Y[SH_MAX_COEFFICIENTS];
+        double coefficients[SH_MAX_COEFFICIENTS][MAX_HARMONICS] = {};
+        for (int j = 0; j < sampleCount; ++j) {
+            double phi = 2.0 * M_PI * j / sampleCount;
+            glm::vec3 dir = worldDirFromSphericalCoordinates(float(m_rowSinTheta[y]), float(m_rowCosTheta[y]), float(std::sin(phi)), float(std::cos(phi)));
+            evaluateSHBasis(m_order, dir, Y);
+            for (int i = 0; i < getCoefficientCount(); ++i) {
+                coefficients[i][0] += Y[i];
+                for (int m = 1; m <= m_order; ++m) {
+                    coefficients[i][2 * m - 1] += 2.0 * Y[i] * std::cos(m * phi);
+                    coefficients[i][2 * m] += 2.0 * Y[i] * std::sin(m * phi);
+                }
+            }
+        }
+        for (int i = 0; i < getCoefficientCount(); ++i) {
+            for (int h = 0; h < m_harmonicCount; ++h) {
+                rowBasis[i][h] = float(coefficients[i][h] / sampleCount);
+            }
+        }
+    }
+
+    // Sums of color * harmonic over the row
+    void accumulateRow(const float* row, float (&rowSums)[MAX_HARMONICS][3]) const {
+        float lanes[MAX_HARMONICS][3][LANES] = {};
+        float r[LANES], g[LANES], b[LANES];
+        int x = 0;
+        for (; x + LANES <= m_width; x += LANES) {
+            for (int lane = 0; lane < LANES; ++lane) {
+                r[lane] = row[(x + lane) * 4 + 0];
+                g[lane] = row[(x + lane) * 4 + 1];
+                b[lane] = row[(x + lane) * 4 + 2];
+            }
+            for (int h = 0; h < m_harmonicCount; ++h) {
+                const float* trig = m_columnTrig.data() + size_t(h) * m_width + x;
+                for (int lane = 0; lane < LANES; ++lane) {
+                    lanes[h][0][lane] += r[lane] * trig[lane];
+                    lanes[h][1][lane] += g[lane] * trig[lane];
+                    lanes[h][2][lane] += b[lane] * trig[lane];
+                }
+            }
+        }
+        for (; x < m_width; ++x) {
+            for (int h = 0; h < m_harmonicCount; ++h) {
+                float trig = m_columnTrig[size_t(h) * m_width + x];
+                for (int c = 0; c < 3; ++c) {
+                    lanes[h][c][0] += row[x * 4 + c] * trig;
+                }
+            }
+        }
+        for (int h = 0; h < m_harmonicCount; ++h) {
+            for (int c = 0; c < 3; ++c) {
+                float* l = lanes[h][c];
+                for (int width = LANES / 2; width > 0; width /= 2) {
+                    for (int lane = 0; lane < width; ++lane) {
+                        l[lane] += l[lane + width];
+                    }
+                }
+                rowSums[h][c] = l[0];
+            }
+        }
+    }
+
+    int m_width;
+    int m_height;
+    int m_order;
+    int m_harmonicCount;
+    std::vector<float> m_columnTrig;  // [harmonic][x]
+    std::vector<double> m_rowSinTheta;
+    std::vector<double> m_rowCosTheta;
+};
+
+// Rows per parallel SH projection task
+constexpr int SH_ROWS_PER_TASK = 8;
+
+// Sums per-task partial projections pairwise, in a fixed order so the result doesn't depend on the thread count
+std::vector<double> reduceSHPartials(std::vector<std::vector<double>> partials) {
+    if (partials.empty()) return {};
+    for (size_t stride = 1; stride < partials.size(); stride *= 2) {
+        for (size_t i = 0; i + stride < partials.size(); i += 2 * stride) {
+            std::vector<double>& dst = partials[i];
+            std::vector<double> const& src = partials[i + stride];
+            dst.resize(std::max(dst.size(), src.size()), 0.0);
+            for (size_t k = 0; k < src.size(); ++k) dst[k] += src[k];
+        }
+    }
+    return std::move(partials[0]);
+}
+
+// Turns radiance SH into diffuse reflected radiance SH, the order is derived from the coefficient count
+void applyLambertianConvolution(std::vector<glm::vec3>& shCoeffs) {
+    // Projection of the clamped cosine lobe (cosθ/π) onto zonal harmonics, per band.
+    // Odd bands above 1 vanish.
+    constexpr std::array<float, SH_MAX_ORDER + 1> bandWeights = {1.0f, 2.0f / 3.0f, 1.0f / 4.0f, 0.0f, -1.0f / 24.0f};
+    for (int l = 0; l <= SH_MAX_ORDER; ++l) {
+        for (int i = l * l; i < shCoefficientCount(l) && i < int(shCoeffs.size()); ++i) {
+            shCoeffs[i] *= bandWeights[l];
+        }
+    }
+}
+
+// Calculate diffuse spherical harmonics from equirectangular environment map
+std::vector<glm::vec3> calculateDiffuseSphericalHarmonics(ThreadPool& threadPool, ImageData const& image, int order = 2) {
+    SHProjector projector(image.width, image.height, order);
+    auto rgba = static_cast<const float*>(image.data.get());
+    size_t taskCount = (image.height + SH_ROWS_PER_TASK - 1) / SH_ROWS_PER_TASK;
+    std::vector<std::vector<double>> partials(taskCount);
+    threadPool.parallelFor(taskCount, [&](size_t task) {
+        int rowBegin = int(task) * SH_ROWS_PER_TASK;
+        int rowEnd = std::min(rowBegin + SH_ROWS_PER_TASK, image.height);
+        projector.accumulateRows(rgba + size_t(rowBegin) * image.width * 4, rowBegin, rowEnd, partials[task]);
+    });
+    std::vector<glm::vec3> shCoeffs = SHProjector::toCoefficients(reduceSHPartials(std::move(partials)));
+    applyLambertianConvolution(shCoeffs);
+    return shCoeffs;
+}
+
+int saveSHCoeffs(std::vector<glm::vec3> const& shCoeffs, const char* outputFileName) {
+    std::ofstream outFile(outputFileName);
+    if (!outFile) {
+        std::cerr << "Error: Could not open file for writing: " << outputFileName << std::endl;
+        return -1;
+    }
+
+    outFile << shCoeffs.size() << std::endl;
+
+    for (const auto& coeff : shCoeffs) {
+        outFile << coeff.x << " " << coeff.y << " " << coeff.z << std::endl;
+    }
+
+    outFile.close();
+    return 0;
+}
+
+// Accepts any order up to SH_MAX_ORDER
+std::vector<glm::vec3> loadSHCoeffs(const char* filename) {
+    std::ifstream inFile(filename);
+    if (!inFile) {
+        std::cerr << "Error: Could not open file for reading: " << filename << std::endl;
+        return {};
+    }
+
+    size_t numCoeffs;
+    inFile >> numCoeffs;
+    int order = int(std::lround(std::sqrt(double(numCoeffs)))) - 1;
+    if (!inFile || order < 0 || order > SH_MAX_ORDER || shCoefficientCount(order) != int(numCoeffs)) {
+        std::cerr << "Error: Unsupported SH coefficient count in " << filename << std::endl;
+        return {};
+    }
+
+    std::vector<glm::vec3> shCoeffs;
+    shCoeffs.reserve(numCoeffs);
+
+    for (size_t i = 0; i < numCoeffs; ++i) {
+        float x, y, z;
+        inFile >> x >> y >> z;
+        shCoeffs.emplace_back(x, y, z);
+    }
+
+    inFile.close();
+    return shCoeffs;
+}
@@ -11,50 +11,153 @@ struct ExtractedSunData {
     const char* error = nullptr;
 };
 
-ExtractedSunData extractSunFromEquirectangularPanorama(ImageData& image, float sunSolidAngle) {
-    float* equiRgba = static_cast<float*>(image.data.get());
-    float maxRadiance = 0;
-    int maxRadianceX = 0;
-    int maxRadianceY = 0;
-    for (int y = 0; y < image.height; y++) {
-        for (int x = 0; x < image.width; x++) {
-            float* texel = equiRgba + (y * image.width + x) * 4;
-            float radiance = texel[0] + texel[1] + texel[2];
-            if (radiance > maxRadiance) {
-                maxRadiance = radiance;
-                maxRadianceX = x;
-                maxRadianceY = y;
+// Brightest texel of the panorama
+struct SunPeak {
+    float radiance = 0;
+    int x = 0;
+    int y = 0;
+};
+
+// Sun region texels get replaced with the dimmest texel of the region
+struct SunRemoval {
+    SunPeak peak;
+    float solidAngle = 0;
+    glm::vec3 replacement = {};
+};
+
+// Functions below work on rows [rowBegin, rowEnd) of an equirectangular image, rgba points to the first texel of rowBegin.
+// This allows processing the panorama in bands. Region texels outside of the rows are skipped.
+
+// Lanes of the vectorizable row loops
+constexpr int SUN_SEARCH_LANES = 8;
+
+// Largest r + g + b of a row. Independent lanes let the compiler vectorize the loop.
+float rowMaxRadiance(const float* row, int width) {
+    float lanes[SUN_SEARCH_LANES] = {};
+    int x = 0;
+    for (; x + SUN_SEARCH_LANES <= width; x += SUN_SEARCH_LANES) {
+        for (int i = 0; i < SUN_SEARCH_LANES; i++) {
+            const float* texel = row + size_t(x + i) * 4;
+            lanes[i] = std::max(lanes[i], texel[0] + texel[1] + texel[2]);
+        }
+    }
+    for (; x < width; x++) {
+        const float* texel = row + size_t(x) * 4;
+        lanes[0] = std::max(lanes[0], texel[0] + texel[1] + texel[2]);
+    }
+    return *std::max_element(lanes, lanes + SUN_SEARCH_LANES);
+}
+
+// Rows must be passed in the top to bottom order.
+// Two level search: the maximum of every row is found with vector code, only a row that beats the peak is searched for the texel.
+void findSunPeakInRows(const float* rgba, int width, int rowBegin, int rowEnd, SunPeak& peak) {
+    for (int y = rowBegin; y < rowEnd; y++) {
+        const float* row = rgba + size_t(y - rowBegin) * width * 4;
+        float radiance = rowMaxRadiance(row, width);
+        if (radiance > peak.radiance) {
+            for (int x = 0; x < width; x++) {
+                const float* texel = row + size_t(x) * 4;
+                if (texel[0] + texel[1] + texel[2] == radiance) {
+                    peak = {radiance, x, y};
+                    break;
+                }
             }
         }
     }
-    if (maxRadiance == 0) {
+}
+
+// Calls fn(y, xBegin, xEnd) for the sun region texels within rows [rowBegin, rowEnd), xEnd is exclusive.
+// Spans crossing the panorama seam wrap around horizontally, rows beyond the poles are skipped.
+template<typename Fn>
+void forEachSunRegionSpan(SunPeak peak, int width, int height, float sunSolidAngle, int rowBegin, int rowEnd, Fn&& fn) {
+    rowBegin = std::max(rowBegin, 0);
+    rowEnd = std::min(rowEnd, height);
+    equirectangularCircle(peak.x, peak.y, width, height, sunSolidAngle).forEachRow([&](int y, int xBegin, int xEnd) {
+        if (y < rowBegin || y >= rowEnd) return;
+        if (xEnd - xBegin >= width) {
+            fn(y, 0, width);
+            return;
+        }
+        int begin = (xBegin % width + width) % width;
+        int end = begin + (xEnd - xBegin);
+        fn(y, begin, std::min(end, width));
+        if (end > width) {
+            fn(y, 0, end - width);
+        }
+    });
+}
+
+// Range of rows covered by the sun region
+std::pair<int, int> sunRegionRows(SunPeak peak, int width, int height, float sunSolidAngle) {
+    CircleRangeEllipse region = equirectangularCircle(peak.x, peak.y, width, height, sunSolidAngle);
+    return {std::max(region.top(), 0), std::min(region.bottom(), height)};
+}
+
+// Rows must contain the whole sun region (see sunRegionRows)
+ExtractedSunData extractSunFromRows(const float* rgba, int width, int height, int rowBegin, int rowEnd, SunPeak peak, float sunSolidAngle, SunRemoval& removal) {
+    if (peak.radiance == 0) {
         return {.error="The input image is completely black"};
     }
-    float minRadiance = maxRadiance;
-    glm::vec3 minRadianceTexel;
-    for (auto [x, y] : equirectangularCircle(maxRadianceX, maxRadianceY, image.width, image.height, sunSolidAngle)) {
-        float* texel = equiRgba + (y * image.width + x) * 4;
-        float radiance = texel[0] + texel[1] + texel[2];
-        if (radiance < minRadiance) {
-            minRadiance = radiance;
-            minRadianceTexel = {texel[0], texel[1], texel[2]};
+    auto rowAt = [&](int y) {
+        return rgba + size_t(y - rowBegin) * width * 4;
+    };
+
+    float minRadiance = peak.radiance;
+    const float* peakTexel = rowAt(peak.y) + size_t(peak.x) * 4;
+    glm::vec3 minRadianceTexel = {peakTexel[0], peakTexel[1], peakTexel[2]};
+    forEachSunRegionSpan(peak, width, height, sunSolidAngle, rowBegin, rowEnd, [&](int y, int xBegin, int xEnd) {
+        const float* row = rowAt(y);
+        for (int x = xBegin; x < xEnd; x++) {
+            const float* texel = row + size_t(x) * 4;
+            float radiance = texel[0] + texel[1] + texel[2];
+            if (radiance < minRadiance) {
+                minRadiance = radiance;
+                minRadianceTexel = {texel[0], texel[1], texel[2]};
+            }
         }
-    }
-    glm::vec3 extractedRadianceSum;
+    });
+
+    glm::vec3 extractedRadianceSum = {};
     int totalTexels = 0;
-    for (auto [x, y] : equirectangularCircle(maxRadianceX, maxRadianceY, image.width, image.height, sunSolidAngle)) {
-        float* texel = equiRgba + (y * image.width + x) * 4;
-        extractedRadianceSum += glm::vec3{texel[0], texel[1], texel[2]} - minRadianceTexel;
-        texel[0] = minRadianceTexel.r;
-        texel[1] = minRadianceTexel.g;
-        texel[2] = minRadianceTexel.b;
-        totalTexels++;
-    }
+    forEachSunRegionSpan(peak, width, height, sunSolidAngle, rowBegin, rowEnd, [&](int y, int xBegin, int xEnd) {
+        const float* row = rowAt(y);
+        for (int x = xBegin; x < xEnd; x++) {
+            const float* texel = row + size_t(x) * 4;
+            extractedRadianceSum += glm::vec3{texel[0], texel[1], texel[2]} - minRadianceTexel;
+        }
+        totalTexels += xEnd - xBegin;
+    });
+    removal = {peak, sunSolidAngle, minRadianceTexel};
+
     glm::vec3 sunRadiance = extractedRadianceSum / static_cast<float>(totalTexels);
     ExtractedSunData sunData;
-    sunData.dir = worldDirFromEquirectangularCoordinates(maxRadianceX, maxRadianceY, image.width, image.height);
+    sunData.dir = worldDirFromEquirectangularCoordinates(peak.x, peak.y, width, height);
     sunData.dir = -sunData.dir; // Make it direction of the sun
     sunData.radiance = sunRadiance;
     sunData.solidAngle = sunSolidAngle;
     return sunData;
 }
+
+void removeSunFromRows(float* rgba, int width, int height, int rowBegin, int rowEnd, SunRemoval const& removal) {
+    forEachSunRegionSpan(removal.peak, width, height, removal.solidAngle, rowBegin, rowEnd, [&](int y, int xBegin, int xEnd) {
+        float* row = rgba + size_t(y - rowBegin) * width * 4;
+        for (int x = xBegin; x < xEnd; x++) {
+            float* texel = row + size_t(x) * 4;
+            texel[0] = removal.replacement.r;
+            texel[1] = removal.replacement.g;
+            texel[2] = removal.replacement.b;
+        }
+    });
+}
+
+ExtractedSunData extractSunFromEquirectangularPanorama(ImageData& image, float sunSolidAngle) {
+    float* equiRgba = static_cast<float*>(image.data.get());
+    SunPeak peak;
+    findSunPeakInRows(equiRgba, image.width, 0, image.height, peak);
+    SunRemoval removal;
+    ExtractedSunData sunData = extractSunFromRows(equiRgba, image.width, image.height, 0, image.height, peak, sunSolidAngle, removal);
+    if (!sunData.error) {
+        removeSunFromRows(equiRgba, image.width, image.height, 0, image.height, removal);
+    }
+    return sunData;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <ktx.h>
+#include <Profiler.h>
+#include <vulkan/vulkan.h>
+
+// Storage formats of baked textures
+enum class TextureFormat {
+    RGBA32F,
+    RGBA16F,
+    RGB9E5,  // shared exponent, unsigned
+    RG32F,
+    RG16F,
+    BC6H,  // unsigned, 4x4 blocks of 16 bytes
+};
+
+enum class BC6HQuality {
+    Fast,    // mode 11 only, no refinement
+    Normal,  // all single region modes, two refinement passes
+    High,    // all single region modes, more refinement passes and endpoint search
+};
+
+// How a baked texture is stored
+struct TextureEncoding {
+    TextureFormat format;
+    BC6HQuality bc6hQuality = BC6HQuality::Normal;
+    uint32_t zstdLevel = 0;  // KTX2 supercompression level, 0 disables it
+};
+
+// Names used by the "format" option of asset files
+bool parseTextureFormat(std::string const& name, TextureFormat& format) {
+    if (name == "rgba32f") format = TextureFormat::RGBA32F;
+    else if (name == "rgba16f") format = TextureFormat::RGBA16F;
+    else if (name == "rgb9e5") format = TextureFormat::RGB9E5;
+    else if (name == "rg32f") format = TextureFormat::RG32F;
+    else if (name == "rg16f") format = TextureFormat::RG16F;
+    else if (name == "bc6h") format = TextureFormat::BC6H;
+    else return false;
+    return true;
+}
+
+bool parseBC6HQuality(std::string const& name, BC6HQuality& quality) {
+    if (name == "fast") quality = BC6HQuality::Fast;
+    else if (name == "normal") quality = BC6HQuality::Normal;
+    else if (name == "high") quality = BC6HQuality::High;
+    else return false;
+    return true;
+}
+
+VkFormat textureFormatToVkFormat(TextureFormat format) {
+    switch (format) {
+        case TextureFormat::RGBA32F: return VK_FORMAT_R32G32B32A32_SFLOAT;
+        case TextureFormat::RGBA16F: return VK_FORMAT_R16G16B16A16_SFLOAT;
+        case TextureFormat::RGB9E5: return VK_FORMAT_E5B9G9R9_UFLOAT_PACK32;
+        case TextureFormat::RG32F: return VK_FORMAT_R32G32_SFLOAT;
+        case TextureFormat::RG16F: return VK_FORMAT_R16G16_SFLOAT;
+        case TextureFormat::BC6H: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+    }
+    return VK_FORMAT_UNDEFINED;
+}
+
+// Size of an uncompressed texel, 0 for block compressed formats
+size_t textureFormatTexelSize(TextureFormat format) {
+    switch (format) {
+        case TextureFormat::RGBA32F: return 16;
+        case TextureFormat::RGBA16F: return 8;
+        case TextureFormat::RGB9E5: return 4;
+        case TextureFormat::RG32F: return 8;
+        case TextureFormat::RG16F: return 4;
+        case TextureFormat::BC6H: return 0;
+    }
+    return 0;
+}
+
+size_t textureFormatImageSize(TextureFormat format, int width, int height) {
+    if (format == TextureFormat::BC6H) {
+        return size_t((width + 3) / 4) * ((height + 3) / 4) * 16;
+    }
+    return textureFormatTexelSize(format) * width * height;
+}
+
+// IEEE 754 binary16 with round to nearest even.
+// Values beyond the half range are clamped to the largest finite half instead of becoming infinity, NaN becomes 0.
+uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t absBits = bits & 0x7FFFFFFF;
+
+    if (absBits > 0x7F800000) return 0;  // NaN
+    if (absBits >= 0x477FF000) return sign | 0x7BFF;  // rounds to 65520 or more (or infinity)
+    if (absBits < 0x38800000) {
+        // Subnormal half: the value in units of 2^-24, exact scaling by a power of two, then round to nearest even
+        return sign | static_cast<uint16_t>(std::nearbyint(std::fabs(value) * 16777216.0f));
+    }
+
+    // Rebias the exponent (127 -> 15) and drop 13 mantissa bits, a mantissa carry correctly bumps the exponent
+    uint32_t half = (absBits - 0x38000000) >> 13;
+    uint32_t roundBits = absBits & 0x1FFF;
+    if (roundBits > 0x1000 || (roundBits == 0x1000 && (half & 1))) half++;
+    return sign | static_cast<uint16_t>(half);
+}
+
+// Shared exponent RGB as specified by EXT_texture_shared_exponent: 9-bit mantissas, 5-bit exponent with bias 15.
+// Channels are clamped to [0, 65408], NaN becomes 0.
+uint32_t floatToRgb9e5(float r, float g, float b) {
+    constexpr int MANTISSA_BITS = 9;
+    constexpr int EXPONENT_BIAS = 15;
+    constexpr float MAX_VALUE = 65408.0f;  // (2^9 - 1) / 2^9 * 2^16
+
+    auto clampChannel = [&](float c) { return c > 0.0f ? std::min(c, MAX_VALUE) : 0.0f; };  // NaN fails the comparison
+    float rc = clampChannel(r);
+    float gc = clampChannel(g);
+    float bc = clampChannel(b);
+    float maxChannel = std::max({rc, gc, bc});
+
+    // floor(log2(maxChannel)), exact thanks to frexp
+    int maxExponent = -EXPONENT_BIAS - 1;
+    if (maxChannel > 0.0f) {
+        std::frexp(maxChannel, &maxExponent);
+        maxExponent = std::max(maxExponent - 1, -EXPONENT_BIAS - 1);
+    }
+    int sharedExponent = maxExponent + 1 + EXPONENT_BIAS;
+
+    // Rounding the largest channel may overflow the mantissa, then the next exponent is needed
+    float maxMantissa = std::floor(std::ldexp(maxChannel, MANTISSA_BITS + EXPONENT_BIAS - sharedExponent) + 0.5f);
+    if (maxMantissa == float(1 << MANTISSA_BITS)) sharedExponent++;
+
+    auto mantissa = [&](float c) {
+        return static_cast<uint32_t>(std::floor(std::ldexp(c, MANTISSA_BITS + EXPONENT_BIAS - sharedExponent) + 0.5f));
+    };
+    return mantissa(rc) | (mantissa(gc) << 9) | (mantissa(bc) << 18) | (uint32_t(sharedExponent) << 27);
+}
+
+// Encodes count texels of srcChannels floats each into dst, only for uncompressed formats.
+// Missing channels are filled with 0, missing alpha with 1.
+void encodeTexels(TextureFormat format, const float* src, int srcChannels, size_t count, void* dst) {
+    auto channel = [&](size_t texel, int c) {
+        return c < srcChannels ? src[texel * srcChannels + c] : (c == 3 ? 1.0f : 0.0f);
+    };
+    switch (format) {
+        case TextureFormat::RGBA32F:
+        case TextureFormat::RG32F: {
+            int channels = format == TextureFormat::RGBA32F ? 4 : 2;
+            float* out = static_cast<float*>(dst);
+            for (size_t i = 0; i < count; ++i) {
+                for (int c = 0; c < channels; ++c) out[i * channels + c] = channel(i, c);
+            }
+            break;
+        }
+        case TextureFormat::RGBA16F:
+        case TextureFormat::RG16F: {
+            int channels = format == TextureFormat::RGBA16F ? 4 : 2;
+            uint16_t* out = static_cast<uint16_t*>(dst);
+            for (size_t i = 0; i < count; ++i) {
+                for (int c = 0; c < channels; ++c) out[i * channels + c] = floatToHalf(channel(i, c));
+            }
+            break;
+        }
+        case TextureFormat::RGB9E5: {
+            uint32_t* out = static_cast<uint32_t*>(dst);
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = floatToRgb9e5(channel(i, 0), channel(i, 1), channel(i, 2));
+            }
+            break;
+        }
+        case TextureFormat::BC6H:
+            break;
+    }
+}
+
+// Applies supercompression (every level becomes a zstd frame) and writes the texture
+int writeKtx2ToFile(ktxTexture2* texture, const char* fileName, uint32_t zstdLevel) {
+    PROFILE_ME_AS("writeKtx2ToFile");
+    KTX_error_code result;
+    if (zstdLevel > 0) {
+        result = ktxTexture2_DeflateZstd(texture, zstdLevel);
+        if (result != KTX_SUCCESS) {
+            std::cerr << "Failed to supercompress KTX2 texture: " << ktxErrorString(result) << std::endl;
+            return -1;
+        }
+    }
+    result = ktxTexture_WriteToNamedFile(ktxTexture(texture), fileName);
+    if (result != KTX_SUCCESS) {
+        std::cerr << "Failed to write KTX2 file: " << ktxErrorString(result) << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -1,9 +1,15 @@
 #pragma once
 
+#include <atomic>
+#include <fstream>
+#include <memory>
 #include <vector>
 #include <iostream>
 #include <vulkan/vulkan.h>
 #include <ktxvulkan.h>
+#include <zstd.h>
+#include "BC6H.h"
+#include "ThreadPool.h"
 
 class TextureLoader {
 public:
@@ -50,6 +56,18 @@ public:
             throw std::runtime_error("ktxTexture_CreateFromNamedFile failed");
         }
 
+        if (kTexture->classId == ktxTexture2_c
+            && reinterpret_cast<ktxTexture2*>(kTexture)->supercompressionScheme == KTX_SS_ZSTD) {
+            kTexture = inflateZstdTexture(kTexture, fileName);
+        }
+
+        if (kTexture->classId == ktxTexture2_c
+            && reinterpret_cast<ktxTexture2*>(kTexture)->vkFormat == VK_FORMAT_BC6H_UFLOAT_BLOCK
+            && !isFormatSampleable(VK_FORMAT_BC6H_UFLOAT_BLOCK)) {
+            std::cerr << "BC6H is not supported by the device, decoding " << fileName << " on the CPU" << std::endl;
+            kTexture = decodeBC6HTexture(kTexture);
+        }
+
         result = ktxTexture_VkUploadEx(
             kTexture, 
             &m_deviceInfo,
@@ -189,7 +207,131 @@ public:
     }
 
 private:
+    bool isFormatSampleable(VkFormat format) const {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(m_deviceInfo.physicalDevice, format, &properties);
+        return properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    }
+
+    // Fallback for devices without BC6H sampling: replaces the texture with an RGBA16F copy
+    static ktxTexture* decodeBC6HTexture(ktxTexture* source) {
+        if (source->pData == nullptr && ktxTexture_LoadImageData(source, nullptr, 0) != KTX_SUCCESS) {
+            throw std::runtime_error("ktxTexture_LoadImageData failed");
+        }
+        ktxTextureCreateInfo createInfo = {
+            .vkFormat = VK_FORMAT_R16G16B16A16_SFLOAT,
+            .baseWidth = source->baseWidth,
+            .baseHeight = source->baseHeight,
+            .baseDepth = source->baseDepth,
+            .numDimensions = source->numDimensions,
+            .numLevels = source->numLevels,
+            .numLayers = source->numLayers,
+            .numFaces = source->numFaces,
+            .isArray = source->isArray,
+            .generateMipmaps = false,
+        };
+        ktxTexture2* decoded;
+        if (ktxTexture2_Create(&createInfo, KTX_TEXTURE_CREATE_ALLOC_STORAGE, &decoded) != KTX_SUCCESS) {
+            throw std::runtime_error("ktxTexture2_Create failed");
+        }
+        for (ktx_uint32_t level = 0; level < source->numLevels; ++level) {
+            int width = std::max(int(source->baseWidth >> level), 1);
+            int height = std::max(int(source->baseHeight >> level), 1);
+            for (ktx_uint32_t layer = 0; layer < source->numLayers; ++layer) {
+                for (ktx_uint32_t face = 0; face < source->numFaces; ++face) {
+                    ktx_size_t srcOffset, dstOffset;
+                    ktxTexture_GetImageOffset(source, level, layer, face, &srcOffset);
+                    ktxTexture_GetImageOffset(ktxTexture(decoded), level, layer, face, &dstOffset);
+                    auto dst = reinterpret_cast<uint16_t*>(ktxTexture_GetData(ktxTexture(decoded)) + dstOffset);
+                    if (!decodeBC6HImage(ktxTexture_GetData(source) + srcOffset, width, height, dst)) {
+                        throw std::runtime_error("unsupported BC6H block mode");
+                    }
+                }
+            }
+        }
+        ktxTexture_Destroy(source);
+        return ktxTexture(decoded);
+    }
+
+    struct KtxTextureDeleter {
+        void operator()(ktxTexture* texture) const { ktxTexture_Destroy(texture); }
+    };
+    using KtxTexturePtr = std::unique_ptr<ktxTexture, KtxTextureDeleter>;
+
+    // KTX2 keeps every supercompressed level as a separate zstd frame, so the levels are inflated in parallel
+    // instead of one after another by ktxTexture_LoadImageData. Replaces the texture with an uncompressed copy,
+    // source is destroyed on every path.
+    ktxTexture* inflateZstdTexture(ktxTexture* source, const char* fileName) {
+        PROFILE_ME;
+        KtxTexturePtr sourceOwner(source);
+        std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error(std::string("failed to open ") + fileName);
+        }
+        std::vector<char> fileData(file.tellg());
+        file.seekg(0);
+        if (!file.read(fileData.data(), fileData.size())) {
+            throw std::runtime_error(std::string("failed to read ") + fileName);
+        }
+
+        // Level index follows the 80 byte header and section index
+        struct LevelIndexEntry {
+            uint64_t byteOffset;
+            uint64_t byteLength;
+            uint64_t uncompressedByteLength;
+        };
+        constexpr size_t LEVEL_INDEX_OFFSET = 80;
+        std::vector<LevelIndexEntry> levels(source->numLevels);
+        if (fileData.size() < LEVEL_INDEX_OFFSET + levels.size() * sizeof(LevelIndexEntry)) {
+            throw std::runtime_error(std::string("truncated KTX2 file ") + fileName);
+        }
+        std::memcpy(levels.data(), fileData.data() + LEVEL_INDEX_OFFSET, levels.size() * sizeof(LevelIndexEntry));
+
+        ktxTextureCreateInfo createInfo = {
+            .vkFormat = reinterpret_cast<ktxTexture2*>(source)->vkFormat,
+            .baseWidth = source->baseWidth,
+            .baseHeight = source->baseHeight,
+            .baseDepth = source->baseDepth,
+            .numDimensions = source->numDimensions,
+            .numLevels = source->numLevels,
+            .numLayers = source->numLayers,
+            .numFaces = source->numFaces,
+            .isArray = source->isArray,
+            .generateMipmaps = false,
+        };
+        ktxTexture2* inflated;
+        if (ktxTexture2_Create(&createInfo, KTX_TEXTURE_CREATE_ALLOC_STORAGE, &inflated) != KTX_SUCCESS) {
+            throw std::runtime_error("ktxTexture2_Create failed");
+        }
+        KtxTexturePtr inflatedOwner(ktxTexture(inflated));
+
+        std::atomic<bool> failed = false;
+        m_threadPool.parallelFor(levels.size(), [&](size_t level) {
+            PROFILE_ME_AS("inflateZstdLevel");
+            LevelIndexEntry const& entry = levels[level];
+            ktx_size_t offset;
+            ktxTexture_GetImageOffset(ktxTexture(inflated), level, 0, 0, &offset);
+            ktx_size_t levelSize = ktxTexture_GetImageSize(ktxTexture(inflated), level) * source->numLayers * source->numFaces;
+            if (entry.byteOffset + entry.byteLength > fileData.size() || entry.uncompressedByteLength != levelSize) {
+                failed = true;
+                return;
+            }
+            size_t size = ZSTD_decompress(
+                ktxTexture_GetData(ktxTexture(inflated)) + offset, levelSize,
+                fileData.data() + entry.byteOffset, entry.byteLength
+            );
+            if (ZSTD_isError(size) || size != levelSize) {
+                failed = true;
+            }
+        });
+        if (failed) {
+            throw std::runtime_error(std::string("failed to inflate ") + fileName);
+        }
+        return inflatedOwner.release();
+    }
+
     ktxVulkanDeviceInfo m_deviceInfo;
+    ThreadPool m_threadPool;
     std::vector<VkImage> m_images;
     std::vector<VkImageView> m_imageViews;
     std::vector<ktxVulkanTexture> m_ktxTextures;
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <Profiler.h>
+
+/*
+Work-stealing thread pool.
+
+Every worker owns a task deque: it pops its own tasks from the back (LIFO, cache friendly)
+and, when it runs out of work, steals from the front of other workers' deques.
+A thread waiting for a task group helps executing queued tasks,
+so parallel loops can be nested inside tasks without deadlocks.
+*/
+class ThreadPool {
+public:
+    // Tracks completion of a set of tasks
+    class TaskGroup {
+    public:
+        bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+    private:
+        friend class ThreadPool;
+        std::atomic<size_t> m_pending = 0;
+        std::mutex m_exceptionMutex;
+        std::exception_ptr m_exception;
+    };
+
+    explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency()) {
+        threadCount = std::max(threadCount, 1u);
+        for (unsigned i = 0; i < threadCount; ++i) {
+            m_queues.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned i = 0; i < threadCount; ++i) {
+            m_threads.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(m_sleepMutex);
+            m_stopping = true;
+        }
+        m_wakeUp.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned getThreadCount() const { return static_cast<unsigned>(m_threads.size()); }
+
+    // Enqueues a task. The group is notified when the task finishes.
+    void submit(TaskGroup& group, std::function<void()> task) {
+        group.m_pending.fetch_add(1, std::memory_order_relaxed);
+        push([&group, task = std::move(task)] {
+            try {
+                task();
+            } catch (...) {
+                std::lock_guard lock(group.m_exceptionMutex);
+                if (!group.m_exception) {
+                    group.m_exception = std::current_exception();
+                }
+            }
+            group.m_pending.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    // Blocks until all tasks of the group are finished, executing queued tasks meanwhile.
+    // Rethrows the first exception thrown by a task of the group.
+    void wait(TaskGroup& group) {
+        while (!group.done()) {
+            if (!runPendingTask()) {
+                std::this_thread::yield();
+            }
+        }
+        if (group.m_exception) {
+            std::rethrow_exception(group.m_exception);
+        }
+    }
+
+    // Calls fn(i) for every i in [0, count) and returns when all calls are finished.
+    // Each index is a separate task, so the work should be split into reasonably coarse items.
+    template<typename Fn>
+    void parallelFor(size_t count, Fn&& fn) {
+        TaskGroup group;
+        for (size_t i = 0; i < count; ++i) {
+            submit(group, [&fn, i] { fn(i); });
+        }
+        wait(group);
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void push(std::function<void()> task) {
+        // Workers push to their own queue, other threads distribute tasks round-robin
+        size_t queueIndex = t_workerPool == this
+            ? t_workerIndex
+            : m_nextQueue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+        {
+            std::lock_guard lock(m_queues[queueIndex]->mutex);
+            m_queues[queueIndex]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard lock(m_sleepMutex);
+            m_queuedTaskCount++;
+        }
+        m_wakeUp.notify_one();
+    }
+
+    bool popOwn(size_t queueIndex, std::function<void()>& task) {
+        Queue& queue = *m_queues[queueIndex];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t thiefIndex, std::function<void()>& task) {
+        for (size_t i = 1; i <= m_queues.size(); ++i) {
+            Queue& queue = *m_queues[(thiefIndex + i) % m_queues.size()];
+            std::lock_guard lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    bool tryTakeTask(std::function<void()>& task) {
+        bool isWorker = t_workerPool == this;
+        size_t index = isWorker ? t_workerIndex : 0;
+        if ((isWorker && popOwn(index, task)) || steal(index, task)) {
+            std::lock_guard lock(m_sleepMutex);
+            m_queuedTaskCount--;
+            return true;
+        }
+        return false;
+    }
+
+    bool runPendingTask() {
+        std::function<void()> task;
+        if (!tryTakeTask(task)) return false;
+        task();
+        return true;
+    }
+
+    void workerLoop(size_t index) {
+        t_workerPool = this;
+        t_workerIndex = index;
+        profiler::set_thread_name("worker " + std::to_string(index));
+        while (true) {
+            if (runPendingTask()) continue;
+            std::unique_lock lock(m_sleepMutex);
+            m_wakeUp.wait(lock, [this] { return m_stopping || m_queuedTaskCount > 0; });
+            if (m_stopping && m_queuedTaskCount <= 0) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_nextQueue = 0;
+
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wakeUp;
+    long long m_queuedTaskCount = 0;  // signed: a task may be taken before its push is counted
+    bool m_stopping = false;
+
+    static inline thread_local ThreadPool* t_workerPool = nullptr;
+    static inline thread_local size_t t_workerIndex = 0;
+};
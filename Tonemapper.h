@@ -4,6 +4,7 @@
 #include <vulkan/vulkan.h>
 
 #include "VulkanFunctions.h"
+#include "FrameCounters.h"
 
 class Tonemapper {
 public:
@@ -62,6 +63,11 @@ public:
         vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pushConstants), &pushConstants);
 
         vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+
+        FrameCounters& counters = frameCounters();
+        counters.pipelineBinds++;
+        counters.descriptorSetBinds++;
+        counters.draw(3);
     }
 
 private:
@@ -132,6 +138,7 @@ private:
             },
         };
         vkUpdateDescriptorSets(m_device, writes.size(), writes.data(), 0, nullptr);
+        frameCounters().descriptorUpdates += writes.size();
         return descriptorSet;
     }
 
@@ -1,43 +1,74 @@
 #pragma once
 
+#include <cstring>
+#include <string>
 #include <vector>
 #include <vulkan/vulkan.h>
-#include <vulkan/vulkan_metal.h>
 
 #include "VulkanFunctions.h"
 
+/*
+Instance, device, graphics queue and command pool.
+
+Extensions are chosen from what the loader and the device offer: the ones needed for presenting are required
+unless headless, the rest (portability, color spaces) are enabled when available.
+The platform surface extensions come from the window system (SDL_Vulkan_GetInstanceExtensions),
+so a missing one fails here rather than at surface creation.
+Headless contexts need no window system at all, e.g. a software ICD like lavapipe on a build machine.
+*/
 class VulkanContext {
 public:
     VkInstance instance;
-    VkPhysicalDevice physicalDevice;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
     VkPhysicalDeviceProperties physicalDeviceProperties;
     VkDevice device;
     uint32_t graphicsQueueFamilyIndex;
     VkQueue graphicsQueue;
     VkCommandPool commandPool;
+    bool pipelineStatisticsQuery = false;
 
-    VulkanContext() {
-        std::vector extensions = {
+    // windowExtensions are the instance extensions the window system needs for its surfaces, ignored when headless
+    VulkanContext(bool headless = false, std::vector<const char*> const& windowExtensions = {}) {
+        std::vector<const char*> requiredExtensions;
+        std::vector<const char*> optionalExtensions = {
             VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME,
-            VK_EXT_METAL_SURFACE_EXTENSION_NAME,
-            VK_KHR_SURFACE_EXTENSION_NAME,
             "VK_KHR_get_physical_device_properties2",
-            "VK_EXT_swapchain_colorspace",
-            // VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME,
-            // "VK_KHR_get_surface_capabilities2",
         };
-    
-        const std::vector<const char*> validationLayers = {
+        if (!headless) {
+            requiredExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+            for (const char* name : windowExtensions) {
+                if (!hasExtension(requiredExtensions, name)) {
+                    requiredExtensions.push_back(name);
+                }
+            }
+            optionalExtensions.insert(optionalExtensions.end(), {
+                "VK_EXT_swapchain_colorspace",
+                // VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME,
+                // "VK_KHR_get_surface_capabilities2",
+            });
+        }
+        std::vector<VkExtensionProperties> availableExtensions;
+        {
+            uint32_t extensionCount = 0;
+            vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+            availableExtensions.resize(extensionCount);
+            vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+        }
+        std::vector extensions = selectExtensions(availableExtensions, requiredExtensions, optionalExtensions, "instance");
+        bool portabilityEnumeration = hasExtension(extensions, VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
+
+        std::vector<const char*> validationLayers = {
             "VK_LAYER_KHRONOS_validation"
         };
         if (!checkValidationLayerSupport(validationLayers)) {
-            throw std::runtime_error("Validation layers requested, but not available!");
+            std::cout << "Validation layers are not available, continuing without them" << std::endl;
+            validationLayers.clear();
         }
     
         {
             VkInstanceCreateInfo createInfo{
                 .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-                .flags = VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR,
+                .flags = portabilityEnumeration ? VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR : VkInstanceCreateFlags(0),
                 .enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
                 .ppEnabledExtensionNames = extensions.data(),
                 .enabledLayerCount = static_cast<uint32_t>(validationLayers.size()),
@@ -112,14 +143,28 @@ public:
             float queuePriority = 1.0f;
             queueCreateInfo.pQueuePriorities = &queuePriority;
     
-            std::vector deviceExtensions = {
-                VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+            std::vector<const char*> requiredDeviceExtensions;
+            if (!headless) {
+                requiredDeviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+            }
+            std::vector<const char*> optionalDeviceExtensions = {
+                // Must be enabled when the implementation offers it
                 "VK_KHR_portability_subset",
                 // VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME,
             };
+            uint32_t extensionCount = 0;
+            vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+            std::vector<VkExtensionProperties> availableDeviceExtensions(extensionCount);
+            vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableDeviceExtensions.data());
+            std::vector deviceExtensions = selectExtensions(availableDeviceExtensions, requiredDeviceExtensions, optionalDeviceExtensions, "device");
             VkPhysicalDeviceFeatures deviceFeatures{};
             deviceFeatures.samplerAnisotropy = VK_TRUE;
             deviceFeatures.imageCubeArray = VK_TRUE;
+            // Optional, for the per-frame statistics in the HUD
+            VkPhysicalDeviceFeatures supportedFeatures;
+            vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+            pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+            deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
             VkDeviceCreateInfo deviceCreateInfo{};
             deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
             deviceCreateInfo.queueCreateInfoCount = 1;
@@ -148,4 +193,40 @@ public:
             }
         }
     }
+
+private:
+    // All of the required extensions and the available optional ones
+    static std::vector<const char*> selectExtensions(
+        std::vector<VkExtensionProperties> const& availableExtensions,
+        std::vector<const char*> const& requiredExtensions,
+        std::vector<const char*> const& optionalExtensions,
+        const char* kind
+    ) {
+        auto isAvailable = [&](const char* name) {
+            for (const auto& extension : availableExtensions) {
+                if (strcmp(extension.extensionName, name) == 0) return true;
+            }
+            return false;
+        };
+        std::vector<const char*> extensions;
+        for (const char* name : requiredExtensions) {
+            if (!isAvailable(name)) {
+                throw std::runtime_error(std::string("Required ") + kind + " extension " + name + " is not available!");
+            }
+            extensions.push_back(name);
+        }
+        for (const char* name : optionalExtensions) {
+            if (isAvailable(name)) {
+                extensions.push_back(name);
+            }
+        }
+        return extensions;
+    }
+
+    static bool hasExtension(std::vector<const char*> const& extensions, const char* name) {
+        for (const char* extension : extensions) {
+            if (strcmp(extension, name) == 0) return true;
+        }
+        return false;
+    }
 };
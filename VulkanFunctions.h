@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <numeric>
 #include <vulkan/vulkan.h>
@@ -274,6 +276,29 @@ VkBuffer createVertexBuffer(VkPhysicalDevice physicalDevice, VkDevice device, st
     return vertexBuffer;
 }
 
+// 16-bit indices when all of them fit, 32-bit otherwise
+VkBuffer createIndexBuffer(VkPhysicalDevice physicalDevice, VkDevice device, std::vector<uint32_t> const& indices, VkIndexType* indexType) {
+    bool shortIndices = std::all_of(indices.begin(), indices.end(), [](uint32_t index) { return index <= UINT16_MAX; });
+    *indexType = shortIndices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    std::vector<uint16_t> shortIndexData;
+    const void* indexData = indices.data();
+    VkDeviceSize bufferSize = sizeof(uint32_t) * indices.size();
+    if (shortIndices) {
+        shortIndexData.assign(indices.begin(), indices.end());
+        indexData = shortIndexData.data();
+        bufferSize = sizeof(uint16_t) * indices.size();
+    }
+    VkDeviceMemory indexBufferMemory;
+    VkBuffer indexBuffer = createBuffer(device, physicalDevice, bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &indexBufferMemory);
+    {
+        void* data = nullptr;
+        vkMapMemory(device, indexBufferMemory, 0, bufferSize, 0, &data);
+        memcpy(data, indexData, (size_t)bufferSize);
+        vkUnmapMemory(device, indexBufferMemory);
+    }
+    return indexBuffer;
+}
+
 VkCommandBuffer beginSingleTimeCommands(VkDevice device, VkCommandPool commandPool) {
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
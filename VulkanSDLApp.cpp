@@ -24,7 +24,7 @@
 #include "VulkanFunctions.h"
 #include "Model.h"
 #include "Camera.h"
-#include "ObjFile.h"
+#include "MeshFile.h"
 #include "MeshObject.h"
 #include "MeshFunctions.h"
 #include "OrbitCameraController.h"
@@ -35,8 +35,12 @@
 #include "TextureLoader.h"
 #include "ColorTemperature.h"
 #include "CubemapFunctions.h"
+#include "SphericalHarmonics.h"
 #include "Environment.h"
 #include "FileFunctions.h"
+#include "FrameStats.h"
+#include "Benchmark.h"
+#include <CLI11.hpp>
 
 
 VkDescriptorSet transferMaterialToGpu(
@@ -80,6 +84,8 @@ MeshObject transferModelToGpu(VulkanContext vulkanContext, float maxAnisotropy,
     MeshObject object{};
     object.vertexBuffer = createVertexBuffer(vulkanContext.physicalDevice, vulkanContext.device, model.vertices);
     object.vertexCount = model.vertices.size();
+    object.indexBuffer = createIndexBuffer(vulkanContext.physicalDevice, vulkanContext.device, model.indices, &object.indexType);
+    object.indexCount = model.indices.size();
 
     ImageData baseColorImageData = loadTextureOrDefault(model.material.baseColorTexture, glm::vec4 {1.0f});
     object.baseColorMipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(baseColorImageData.width, baseColorImageData.height)))) + 1;
@@ -140,7 +146,9 @@ public:
     };
 
     struct SphericalHarmonics {
-        std::array<glm::vec4, 9> lambertianSphericalHamonics;
+        std::array<glm::vec4, SH_MAX_COEFFICIENTS> lambertianSphericalHamonics;
+        int order;
+        glm::vec3 _padding;
     };
 
     FrameLevelResources(
@@ -166,12 +174,14 @@ public:
 
     void setViewProjection(int frameIndex, glm::mat4 const& view, glm::mat4 const& projection) {
         m_viewProjection.data()[frameIndex] = {view, projection};
+        frameCounters().uniformBytesWritten += sizeof(ViewProjection);
     }
 
     void setLights(int frameIndex, std::vector<Light> const& lights) {
         LightBlock& lightBlock = m_lightBlock.data()[frameIndex];
         lightBlock.lightCount = (int) std::min(lightBlock.lights.size(), lights.size());
         std::copy_n(std::begin(lights), lightBlock.lightCount, std::begin(lightBlock.lights));
+        frameCounters().uniformBytesWritten += sizeof(LightBlock);
     }
 
     void setEnvironment(int frameIndex, Environment const& env, VkSampler sampler) {
@@ -192,9 +202,14 @@ public:
             },
         };
         vkUpdateDescriptorSets(m_device, writes.size(), writes.data(), 0, nullptr);
+        frameCounters().descriptorUpdates += writes.size();
 
         m_diffuseSphericalHarmonics.data()[frameIndex] = {};
-        for (size_t i = 0; i < env.diffuseSphericalHarmonics.size(); i++) {
+        size_t shCount = std::min(env.diffuseSphericalHarmonics.size(), size_t(SH_MAX_COEFFICIENTS));
+        int shOrder = 0;
+        while (shCoefficientCount(shOrder) < int(shCount)) shOrder++;
+        m_diffuseSphericalHarmonics.data()[frameIndex].order = shOrder;
+        for (size_t i = 0; i < shCount; i++) {
             auto const& coeffs = env.diffuseSphericalHarmonics[i];
             glm::vec4& dst = m_diffuseSphericalHarmonics.data()[frameIndex].lambertianSphericalHamonics[i];
             dst[0] = coeffs[0];
@@ -207,6 +222,7 @@ public:
             .radiance=env.sun.radiance,
             .solidAngle=env.sun.solidAngle,
         };
+        frameCounters().uniformBytesWritten += sizeof(m_diffuseSphericalHarmonics.data()[frameIndex]) + sizeof(m_sunBuffer.data()[frameIndex]);
     }
 
 private:
@@ -363,6 +379,7 @@ private:
                 },
             };
             vkUpdateDescriptorSets(m_device, writes.size(), writes.data(), 0, nullptr);
+            frameCounters().descriptorUpdates += writes.size();
         }
         return descriptorSets;
     }
@@ -386,27 +403,79 @@ void sphericalHarmonicsGui(std::vector<glm::vec3>& shCoeffs) {
     ImGui::End();
 }
 
-int main() {
-    PROFILE_ME;
-    VulkanContext vulkanContext;
-    RenderingConfig config {
-        .vsyncEnabled = true,
-        .maxAnisotropy = vulkanContext.physicalDeviceProperties.limits.maxSamplerAnisotropy,
-        .msaaSamples = VK_SAMPLE_COUNT_4_BIT,
-    };
-
+int main(int argc, char** argv) {
+    std::string traceFileName;
+    bool headless = false;
+    uint32_t frameLimit = 0;
     uint32_t width = 1024;
     uint32_t height = 768;
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-        std::cerr << "Failed to initialize SDL: " << SDL_GetError() << std::endl;
+    std::string screenshotFileName;
+    std::string statsFileName;
+    std::string benchmarkFileName;
+    std::string benchmarkOutFileName = "benchmark.json";
+    std::string recordCameraFileName;
+    CLI::App app{"Vulkan renderer"};
+    app.add_option("--trace", traceFileName, "Write a Chrome trace (chrome://tracing, ui.perfetto.dev) to the file on exit");
+    auto framesOption = app.add_option("--frames", frameLimit, "Exit after rendering this many frames");
+    auto headlessFlag = app.add_flag("--headless", headless, "Render into offscreen images without a window, GUI and input (needs --frames or --benchmark)");
+    app.add_option("--width", width, "Width of the window or the offscreen images");
+    app.add_option("--height", height, "Height of the window or the offscreen images");
+    app.add_option("--screenshot", screenshotFileName, "Save the last frame to an EXR file")
+        ->needs(headlessFlag);
+    app.add_option("--stats", statsFileName, "Save frame stats to the file on exit (.json or .csv)");
+    auto benchmarkOption = app.add_option("--benchmark", benchmarkFileName, "Run a benchmark script (YAML) and exit")
+        ->excludes(framesOption);
+    app.add_option("--benchmark-out", benchmarkOutFileName, "Benchmark results file (JSON)")
+        ->needs(benchmarkOption);
+    app.add_option("--record-camera", recordCameraFileName, "Record the camera path to a benchmark script on exit")
+        ->excludes(benchmarkOption)
+        ->excludes(headlessFlag);
+    CLI11_PARSE(app, argc, argv);
+    if (headless && frameLimit == 0 && benchmarkFileName.empty()) {
+        std::cerr << "--headless needs --frames or --benchmark" << std::endl;
         return -1;
     }
-    SDL_Window* window = SDL_CreateWindow("Vulkan SDL App", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_VULKAN);
-    if (!window) {
-        std::cerr << "Failed to create window: " << SDL_GetError() << std::endl;
-        SDL_Quit();
-        return -1;
+    std::optional<BenchmarkRunner> benchmark;
+    if (!benchmarkFileName.empty()) {
+        benchmark.emplace(loadBenchmarkScript(benchmarkFileName.c_str()));
     }
+    std::optional<CameraRecorder> cameraRecorder;
+    if (!recordCameraFileName.empty()) {
+        cameraRecorder.emplace();
+    }
+    profiler::set_thread_name("main");
+
+    PROFILE_ME;
+    SDL_Window* window = nullptr;
+    std::vector<const char*> windowExtensions;
+    if (!headless) {
+        if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+            std::cerr << "Failed to initialize SDL: " << SDL_GetError() << std::endl;
+            return -1;
+        }
+        window = SDL_CreateWindow("Vulkan SDL App", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_VULKAN);
+        if (!window) {
+            std::cerr << "Failed to create window: " << SDL_GetError() << std::endl;
+            SDL_Quit();
+            return -1;
+        }
+        unsigned int extensionCount = 0;
+        if (SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, nullptr) != SDL_TRUE) {
+            std::cerr << "Failed to query Vulkan instance extensions: " << SDL_GetError() << std::endl;
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return -1;
+        }
+        windowExtensions.resize(extensionCount);
+        SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, windowExtensions.data());
+    }
+
+    VulkanContext vulkanContext(headless, windowExtensions);
+    RenderingConfig config {
+        .vsyncEnabled = !headless,
+        .maxAnisotropy = vulkanContext.physicalDeviceProperties.limits.maxSamplerAnisotropy,
+        .msaaSamples = VK_SAMPLE_COUNT_4_BIT,
+    };
 
     TextureLoader textureLoader(
         vulkanContext.physicalDevice,
@@ -455,6 +524,8 @@ int main() {
         .msaaSamples = config.msaaSamples,
         .frameLevelDescriptorSetLayout = frameLevelResources.descriptorSetLayout(),
         .renderInFormat = VK_FORMAT_R16G16B16A16_SFLOAT,
+        .pipelineStatisticsQuery = vulkanContext.pipelineStatisticsQuery,
+        .offscreenExtent = {width, height},
     });
     config.surfaceFormat = renderSurface.getFormat();
 
@@ -513,6 +584,10 @@ int main() {
         .environments = environmentLabels,
         .surfaceFormats = supportedSurfaceFormats,
     };
+    if (benchmark) {
+        VkPhysicalDeviceLimits const& limits = vulkanContext.physicalDeviceProperties.limits;
+        validateBenchmarkScript(benchmark->getScript(), environments.size(), limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts, framesInFlight);
+    }
 
     CubemapBackgroundPipeline backgroundPipeline(
         vulkanContext.device,
@@ -535,7 +610,7 @@ int main() {
     std::vector<FrameLevelResources::Light> lights;
 
     {
-        Model woodenStoolModel = loadObj("assets/wooden_stool_02_4k.obj");
+        Model woodenStoolModel = loadMesh("build/wooden_stool_02_4k.mesh");
         MeshObject woodenStool = transferModelToGpu(vulkanContext, config.maxAnisotropy, pipeline, woodenStoolModel);
         meshObjects.push_back(woodenStool);
     }
@@ -543,8 +618,7 @@ int main() {
     {
         glm::vec3 color = temperatureToRgb(1000);
         float intensity = 0.5f;
-        Model lightModel1;
-        lightModel1.vertices = createSphereMesh(2, 0.03);
+        Model lightModel1 = createSphereMesh(2, 0.03);
         lightModel1.material.baseColorFactor = glm::vec3{0.0f};
         lightModel1.material.emitFactor = 10.0f * color;
         MeshObject lightObj1 = transferModelToGpu(vulkanContext, config.maxAnisotropy, pipeline, lightModel1);
@@ -557,8 +631,7 @@ int main() {
     {
         glm::vec3 color = temperatureToRgb(25000);
         float intensity = 1.5f;
-        Model lightModel2;
-        lightModel2.vertices = createSphereMesh(2, 0.05);
+        Model lightModel2 = createSphereMesh(2, 0.05);
         lightModel2.material.baseColorFactor = glm::vec3{0.0f};
         lightModel2.material.emitFactor = 10.0f * color;
         MeshObject lightObj2 = transferModelToGpu(vulkanContext, config.maxAnisotropy, pipeline, lightModel2);
@@ -572,17 +645,15 @@ int main() {
         std::vector<Vertex> vertices;
         vertices.push_back({{-1.0f, 0, 1.0f}, {0, 1.0f, 0}, {1.0f, 1.0f, 1.0f}, {0, 0}});
         vertices.push_back({{1.0f, 0, 1.0f}, {0, 1.0f, 0}, {1.0f, 1.0f, 1.0f}, {1, 0}});
-        vertices.push_back({{1.0f, 0, -1.0f}, {0, 1.0f, 0}, {1.0f, 1.0f, 1.0f}, {1, 1}});
-
         vertices.push_back({{1.0f, 0, -1.0f}, {0, 1.0f, 0}, {1.0f, 1.0f, 1.0f}, {1, 1}});
         vertices.push_back({{-1.0f, 0, -1.0f}, {0, 1.0f, 0}, {1.0f, 1.0f, 1.0f}, {0, 1}});
-        vertices.push_back({{-1.0f, 0, 1.0f}, {0, 1.0f, 0}, {1.0f, 1.0f, 1.0f}, {0, 0}});
+        std::vector<uint32_t> indices = {0, 1, 2, 2, 3, 0};
 
         Material floorMaterial{
             .baseColorFactor = {0.7f, 0.7f, 0.7f},
             .roughnessFactor=0.35,
         };
-        Model model{vertices, floorMaterial};
+        Model model{vertices, indices, floorMaterial};
         MeshObject floorObj = transferModelToGpu(vulkanContext, config.maxAnisotropy, pipeline, model);
         meshObjects.push_back(floorObj);
     }
@@ -596,7 +667,8 @@ int main() {
                 .roughnessFactor = roughness[x],
                 .metallicFactor = metallic[y],
             };
-            Model model {createSphereMesh(4, 0.2), material};
+            Model model = createSphereMesh(4, 0.2);
+            model.material = material;
             MeshObject meshObj = transferModelToGpu(vulkanContext, config.maxAnisotropy, pipeline, model);
             meshObj.position = (glm::vec3{0.5f * x - 1.25f, y, 0}) + glm::vec3{0, 0, -2.0f};
             meshObjects.push_back(meshObj);
@@ -611,44 +683,119 @@ int main() {
     OrbitCameraController orbitCameraController(width, height, glm::vec3(0.0f, 3.0f, 5.0f));
     FlyingCameraController flyingCameraController;
     CameraController* cameraController = &flyingCameraController;
-    SDL_SetRelativeMouseMode(SDL_TRUE);
-    bool controlCamera = true;
-
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGui::GetIO().ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
-    ImGui::GetIO().ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
-    ImGui_ImplSDL2_InitForVulkan(window);
-    ImGui_ImplVulkan_InitInfo init_info {
-        .Instance = vulkanContext.instance,
-        .PhysicalDevice = vulkanContext.physicalDevice,
-        .Device = vulkanContext.device,
-        .QueueFamily = vulkanContext.graphicsQueueFamilyIndex,
-        .Queue = vulkanContext.graphicsQueue,
-        .DescriptorPoolSize = 2,
-        .RenderPass = renderSurface.getRenderPass(),
-        .Subpass = 1,
-        .MinImageCount = 3,
-        .ImageCount = 3,
-        .MSAASamples = VK_SAMPLE_COUNT_1_BIT,
-    };
-    ImGui_ImplVulkan_Init(&init_info);
+    // Headless runs keep the camera still, benchmarks move it along their paths
+    bool controlCamera = !headless && !benchmark;
+
+    if (!headless) {
+        SDL_SetRelativeMouseMode(SDL_TRUE);
+        IMGUI_CHECKVERSION();
+        ImGui::CreateContext();
+        ImGui::GetIO().ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
+        ImGui::GetIO().ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
+        ImGui_ImplSDL2_InitForVulkan(window);
+        ImGui_ImplVulkan_InitInfo init_info {
+            .Instance = vulkanContext.instance,
+            .PhysicalDevice = vulkanContext.physicalDevice,
+            .Device = vulkanContext.device,
+            .QueueFamily = vulkanContext.graphicsQueueFamilyIndex,
+            .Queue = vulkanContext.graphicsQueue,
+            .DescriptorPoolSize = 2,
+            .RenderPass = renderSurface.getRenderPass(),
+            .Subpass = 1,
+            .MinImageCount = 3,
+            .ImageCount = 3,
+            .MSAASamples = VK_SAMPLE_COUNT_1_BIT,
+        };
+        ImGui_ImplVulkan_Init(&init_info);
+    }
 
     PROFILE_END;
     profiler::getInstance().print(std::cout, 60);
 
+    // Recreates what depends on the changed settings
+    auto applyConfig = [&](RenderingConfig const& newConfig) {
+        vkDeviceWaitIdle(vulkanContext.device);
+        RenderingConfig oldConfig = config;
+        config = newConfig;
+        if (config.maxAnisotropy != oldConfig.maxAnisotropy || config.useMipMaps != oldConfig.useMipMaps) {
+            for (auto& obj : meshObjects) {
+                obj.baseColorSampler = createTextureSampler(vulkanContext.device, config.maxAnisotropy, config.useMipMaps ? obj.baseColorMipLevels : 0);
+                obj.roughnessSampler = createTextureSampler(vulkanContext.device, config.maxAnisotropy, config.useMipMaps ? obj.roughnessMipLevels : 0);
+                obj.materialDescriptorSet = transferMaterialToGpu(
+                    obj.material,
+                    pipeline,
+                    obj.baseColorImageView,
+                    obj.baseColorSampler,
+                    obj.roughnessImageView,
+                    obj.roughnessSampler
+                );
+            }
+        }
+        if (config.vsyncEnabled != oldConfig.vsyncEnabled) {
+            renderSurface.setVsync(config.vsyncEnabled);
+        }
+        if (config.msaaSamples != oldConfig.msaaSamples) {
+            renderSurface.setMsaaSamples(config.msaaSamples);
+        }
+        if (config.surfaceFormat != oldConfig.surfaceFormat) {
+            renderSurface.setDisplayFormat(config.surfaceFormat);
+        }
+
+        pipeline.updateRenderPass(renderSurface.getRenderPass(), config.msaaSamples);
+        backgroundPipeline.updateRenderPass(renderSurface.getRenderPass(), config.msaaSamples);
+
+        if (headless) {
+            return;
+        }
+        ImGui_ImplVulkan_Shutdown();
+        ImGui_ImplVulkan_InitInfo init_info {
+            .Instance = vulkanContext.instance,
+            .PhysicalDevice = vulkanContext.physicalDevice,
+            .Device = vulkanContext.device,
+            .QueueFamily = vulkanContext.graphicsQueueFamilyIndex,
+            .Queue = vulkanContext.graphicsQueue,
+            .DescriptorPoolSize = 2,
+            .RenderPass = renderSurface.getRenderPass(),
+            .Subpass = 1,
+            .MinImageCount = 3,
+            .ImageCount = 3,
+            .MSAASamples = VK_SAMPLE_COUNT_1_BIT,
+        };
+        ImGui_ImplVulkan_Init(&init_info);
+    };
+
     typedef std::chrono::steady_clock Clock;
     auto lastUpdateTime = Clock::now();
     bool running = true;
     SDL_Event event;
+    FrameStats frameStats;
+    uint32_t frameCount = 0;
+    uint32_t lastImageIndex = 0;
+    // Descriptor updates and uniform writes of the setup aren't part of the first frame
+    frameCounters() = {};
     while (running) {
+        PROFILE_ME_AS("frame");
+        frameStats.beginFrame(FrameStats::Phase::Events);
         static const float maxFrameTime = 1.0f / 30.0f;
         auto now = Clock::now();
         float dt = std::chrono::duration<float>(now - lastUpdateTime).count();
         dt = glm::min(dt, maxFrameTime);
         lastUpdateTime = now;
 
-        while (SDL_PollEvent(&event)) {
+        if (benchmark) {
+            dt = benchmark->getTimestep();
+            RenderingConfig segmentConfig = config;
+            if (benchmark->beginFrame(frameStats, segmentConfig, camera)) {
+                frameStats.beginPhase(FrameStats::Phase::Reconfigure);
+                applyConfig(segmentConfig);
+                frameStats.beginPhase(FrameStats::Phase::Events);
+            }
+            if (benchmark->isFinished()) {
+                break;
+            }
+        }
+
+        while (!headless && SDL_PollEvent(&event)) {
             ImGui_ImplSDL2_ProcessEvent(&event);
             if (event.type == SDL_QUIT) {
                 running = false;
@@ -671,99 +818,131 @@ int main() {
             if (controlCamera)
                 cameraController->update(camera, event, dt);
         }
+        frameStats.beginPhase(FrameStats::Phase::Camera);
         if (controlCamera)
             cameraController->update(camera, dt);
-
-        RenderSurface::Frame frame = renderSurface.beginFrame();
-
+        if (cameraRecorder)
+            cameraRecorder->record(camera, dt);
+
+        frameStats.beginPhase(FrameStats::Phase::Acquire);
+        RenderSurface::Frame frame = [&] {
+            PROFILE_ME_AS("beginFrame");
+            return renderSurface.beginFrame();
+        }();
+        frameStats.setGpuTimes(renderSurface.getGpuTimes());
+        frameStats.setPipelineStatistics(renderSurface.getPipelineStatistics());
+
+        frameStats.beginPhase(FrameStats::Phase::Uniforms);
         frameLevelResources.setViewProjection(frame.swapchainImageIndex, camera.getViewMatrix(), camera.getProjectionMatrix());
         frameLevelResources.setLights(frame.swapchainImageIndex, lights);
         frameLevelResources.setEnvironment(frame.swapchainImageIndex, environments[config.environmentIndex], environmentSampler);
 
-        backgroundPipeline.draw(
-            frame.commandBuffer,
-            frameLevelResources.descriptorSet(frame.swapchainImageIndex)
-        );
-
-        pipeline.draw(
-            frame.commandBuffer,
-            frameLevelResources.descriptorSet(frame.swapchainImageIndex),
-            meshObjects
-        );
+        frameStats.beginPhase(FrameStats::Phase::Draw);
+        {
+            GpuTimer::Scope gpuScope = renderSurface.gpuTimerScope(frame, GpuTimer::Phase::Background);
+            backgroundPipeline.draw(
+                frame.commandBuffer,
+                frameLevelResources.descriptorSet(frame.swapchainImageIndex)
+            );
+        }
+        {
+            GpuTimer::Scope gpuScope = renderSurface.gpuTimerScope(frame, GpuTimer::Phase::Meshes);
+            pipeline.draw(
+                frame.commandBuffer,
+                frameLevelResources.descriptorSet(frame.swapchainImageIndex),
+                meshObjects
+            );
+        }
 
         renderSurface.setTonemappingParameters(config.tonemapOperator, config.exposure, config.reinhardWhitePoint);
         renderSurface.postprocess(frame, frameLevelResources.descriptorSet(frame.swapchainImageIndex));
 
-        ImGui_ImplVulkan_NewFrame();
-        ImGui_ImplSDL2_NewFrame();
-        ImGui::NewFrame();
+        frameStats.beginPhase(FrameStats::Phase::Gui);
         RenderingConfig stagingConfig = config;
-        bool configChanged = renderingConfigGui(stagingConfig, renderingConfigOptions, dt);
-        sphericalHarmonicsGui(environments[config.environmentIndex].diffuseSphericalHarmonics);
-        ImGui::Render();
-        ImDrawData* imguiDrawData = ImGui::GetDrawData();
-        ImGui_ImplVulkan_RenderDrawData(imguiDrawData, frame.commandBuffer);
-
-        renderSurface.endFrame(frame);
-
-        if (configChanged) {
-            vkDeviceWaitIdle(vulkanContext.device);
-            RenderingConfig oldConfig = config;
-            config = stagingConfig;
-            if (config.maxAnisotropy != oldConfig.maxAnisotropy || config.useMipMaps != oldConfig.useMipMaps) {
-                for (auto& obj : meshObjects) {
-                    obj.baseColorSampler = createTextureSampler(vulkanContext.device, config.maxAnisotropy, config.useMipMaps ? obj.baseColorMipLevels : 0);
-                    obj.roughnessSampler = createTextureSampler(vulkanContext.device, config.maxAnisotropy, config.useMipMaps ? obj.roughnessMipLevels : 0);
-                    obj.materialDescriptorSet = transferMaterialToGpu(
-                        obj.material,
-                        pipeline,
-                        obj.baseColorImageView,
-                        obj.baseColorSampler,
-                        obj.roughnessImageView,
-                        obj.roughnessSampler
-                    );
-                }
+        bool configChanged = false;
+        if (!headless) {
+            ImGui_ImplVulkan_NewFrame();
+            ImGui_ImplSDL2_NewFrame();
+            ImGui::NewFrame();
+            configChanged = renderingConfigGui(stagingConfig, renderingConfigOptions, dt);
+            sphericalHarmonicsGui(environments[config.environmentIndex].diffuseSphericalHarmonics);
+            frameStatsGui(frameStats);
+            ImGui::Render();
+            ImDrawData* imguiDrawData = ImGui::GetDrawData();
+            {
+                GpuTimer::Scope gpuScope = renderSurface.gpuTimerScope(frame, GpuTimer::Phase::Gui);
+                ImGui_ImplVulkan_RenderDrawData(imguiDrawData, frame.commandBuffer);
             }
-            if (config.vsyncEnabled != oldConfig.vsyncEnabled) {
-                renderSurface.setVsync(config.vsyncEnabled);
-            }
-            if (config.msaaSamples != oldConfig.msaaSamples) {
-                renderSurface.setMsaaSamples(config.msaaSamples);
+
+            // The ImGui backend binds its pipeline and buffers once and a descriptor set per draw
+            FrameCounters& counters = frameCounters();
+            uint64_t imguiDrawCount = 0;
+            for (ImDrawList const* drawList : imguiDrawData->CmdLists) {
+                imguiDrawCount += drawList->CmdBuffer.Size;
             }
-            if (config.surfaceFormat != oldConfig.surfaceFormat) {
-                renderSurface.setDisplayFormat(config.surfaceFormat);
+            counters.drawCalls += imguiDrawCount;
+            counters.triangles += imguiDrawData->TotalIdxCount / 3;
+            counters.descriptorSetBinds += imguiDrawCount;
+            if (imguiDrawCount > 0) {
+                counters.pipelineBinds++;
+                counters.vertexBufferBinds++;
+                counters.indexBufferBinds++;
             }
+        }
 
-            pipeline.updateRenderPass(renderSurface.getRenderPass(), config.msaaSamples);
-            backgroundPipeline.updateRenderPass(renderSurface.getRenderPass(), config.msaaSamples);
-
-            ImGui_ImplVulkan_Shutdown();
-            ImGui_ImplVulkan_InitInfo init_info {
-                .Instance = vulkanContext.instance,
-                .PhysicalDevice = vulkanContext.physicalDevice,
-                .Device = vulkanContext.device,
-                .QueueFamily = vulkanContext.graphicsQueueFamilyIndex,
-                .Queue = vulkanContext.graphicsQueue,
-                .DescriptorPoolSize = 2,
-                .RenderPass = renderSurface.getRenderPass(),
-                .Subpass = 1,
-                .MinImageCount = 3,
-                .ImageCount = 3,
-                .MSAASamples = VK_SAMPLE_COUNT_1_BIT,
-            };
-            ImGui_ImplVulkan_Init(&init_info);
+        frameStats.beginPhase(FrameStats::Phase::Present);
+        {
+            PROFILE_ME_AS("endFrame");
+            renderSurface.endFrame(frame);
+        }
+        lastImageIndex = frame.swapchainImageIndex;
+        if (frameLimit > 0 && ++frameCount >= frameLimit) {
+            running = false;
+        }
+
+        if (configChanged) {
+            frameStats.beginPhase(FrameStats::Phase::Reconfigure);
+            applyConfig(stagingConfig);
+        }
+
+        frameStats.setCounters(frameCounters());
+        frameCounters() = {};
+    }
+
+    if (!screenshotFileName.empty()) {
+        VkExtent2D extent = renderSurface.getExtent();
+        saveExr(screenshotFileName, renderSurface.readPixels(lastImageIndex), renderSurface.getImageFormat(), extent.width, extent.height);
+    }
+    if (!statsFileName.empty() && !frameStats.save(statsFileName)) {
+        std::cerr << "Failed to write frame stats " << statsFileName << std::endl;
+    }
+    if (benchmark) {
+        if (benchmark->save(benchmarkOutFileName, vulkanContext.physicalDeviceProperties.deviceName)) {
+            std::cout << "Benchmark results written to " << benchmarkOutFileName << std::endl;
+        } else {
+            std::cerr << "Failed to write benchmark results " << benchmarkOutFileName << std::endl;
         }
     }
+    if (cameraRecorder && !cameraRecorder->save(recordCameraFileName)) {
+        std::cerr << "Failed to write camera recording " << recordCameraFileName << std::endl;
+    }
 
     // Cleanup
     vkDeviceWaitIdle(vulkanContext.device);
-    ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplSDL2_Shutdown();
-    ImGui::DestroyContext();
+    if (!headless) {
+        ImGui_ImplVulkan_Shutdown();
+        ImGui_ImplSDL2_Shutdown();
+        ImGui::DestroyContext();
+    }
     // First need to delete all child objects
     // vkDestroyInstance(instance, nullptr);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    if (window) {
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+    }
 
+    if (!traceFileName.empty() && !profiler::getInstance().write_chrome_trace(traceFileName.c_str())) {
+        std::cerr << "Failed to write trace " << traceFileName << std::endl;
+    }
     return 0;
 }
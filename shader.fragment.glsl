@@ -42,11 +42,12 @@ layout(set = 1, binding = 2) uniform MaterialProps {
 };
 
 layout(set = 0, binding = 3) uniform SphericalHarmonicsUBO {
-    vec4 coeffs[9]; // vec4 = RGB + padding
+    vec4 coeffs[25]; // vec4 = RGB + padding, bands above order are zero
+    int order;
 } lambertianSH;
 
-vec3 evaluateSH(vec3 dir, vec4 sh[9]) {
-    // SH evaluation for 2nd order (L = 2) spherical harmonics
+vec3 evaluateSH(vec3 dir) {
+    // SH evaluation up to 4th order (L = 4), must match evaluateSHBasis in SphericalHarmonics.h
 
     float x = dir.x;
     float y = dir.y;
@@ -54,24 +55,44 @@ vec3 evaluateSH(vec3 dir, vec4 sh[9]) {
     float x2 = x * x;
     float y2 = y * y;
     float z2 = z * z;
-    
+
     // Evaluate spherical harmonics basis functions
     vec3 result = vec3(0);
-    result += sh[0].rgb * 0.282095;                  // L = 0, m = 0
-    result += sh[1].rgb * 0.488603 * y;              // L = 1, m = -1
-    result += sh[2].rgb * 0.488603 * z;              // L = 1, m = 0
-    result += sh[3].rgb * 0.488603 * x;              // L = 1, m = 1
-    result += sh[4].rgb * 1.092548 * (x * y);        // L = 2, m = -2
-    result += sh[5].rgb * 1.092548 * (y * z);        // L = 2, m = -1
-    result += sh[6].rgb * 0.315392 * (3 * z2 - 1.0); // L = 2, m = 0
-    result += sh[7].rgb * 1.092548 * (x * z);        // L = 2, m = 1
-    result += sh[8].rgb * 0.546274 * (x2 - y2);      // L = 2, m = 2
-    
+    result += lambertianSH.coeffs[0].rgb * 0.282095;                  // L = 0, m = 0
+    result += lambertianSH.coeffs[1].rgb * 0.488603 * y;              // L = 1, m = -1
+    result += lambertianSH.coeffs[2].rgb * 0.488603 * z;              // L = 1, m = 0
+    result += lambertianSH.coeffs[3].rgb * 0.488603 * x;              // L = 1, m = 1
+    result += lambertianSH.coeffs[4].rgb * 1.092548 * (x * y);        // L = 2, m = -2
+    result += lambertianSH.coeffs[5].rgb * 1.092548 * (y * z);        // L = 2, m = -1
+    result += lambertianSH.coeffs[6].rgb * 0.315392 * (3 * z2 - 1.0); // L = 2, m = 0
+    result += lambertianSH.coeffs[7].rgb * 1.092548 * (x * z);        // L = 2, m = 1
+    result += lambertianSH.coeffs[8].rgb * 0.546274 * (x2 - y2);      // L = 2, m = 2
+    if (lambertianSH.order >= 3) {
+        result += lambertianSH.coeffs[9].rgb * 0.590044 * y * (3 * x2 - y2);   // L = 3, m = -3
+        result += lambertianSH.coeffs[10].rgb * 2.890611 * (x * y * z);        // L = 3, m = -2
+        result += lambertianSH.coeffs[11].rgb * 0.457046 * y * (5 * z2 - 1.0); // L = 3, m = -1
+        result += lambertianSH.coeffs[12].rgb * 0.373176 * z * (5 * z2 - 3.0); // L = 3, m = 0
+        result += lambertianSH.coeffs[13].rgb * 0.457046 * x * (5 * z2 - 1.0); // L = 3, m = 1
+        result += lambertianSH.coeffs[14].rgb * 1.445306 * z * (x2 - y2);      // L = 3, m = 2
+        result += lambertianSH.coeffs[15].rgb * 0.590044 * x * (x2 - 3 * y2);  // L = 3, m = 3
+    }
+    if (lambertianSH.order >= 4) {
+        result += lambertianSH.coeffs[16].rgb * 2.503343 * x * y * (x2 - y2);                     // L = 4, m = -4
+        result += lambertianSH.coeffs[17].rgb * 1.770131 * y * z * (3 * x2 - y2);                 // L = 4, m = -3
+        result += lambertianSH.coeffs[18].rgb * 0.946175 * x * y * (7 * z2 - 1.0);                // L = 4, m = -2
+        result += lambertianSH.coeffs[19].rgb * 0.669047 * y * z * (7 * z2 - 3.0);                // L = 4, m = -1
+        result += lambertianSH.coeffs[20].rgb * 0.105786 * (35 * z2 * z2 - 30 * z2 + 3.0);        // L = 4, m = 0
+        result += lambertianSH.coeffs[21].rgb * 0.669047 * x * z * (7 * z2 - 3.0);                // L = 4, m = 1
+        result += lambertianSH.coeffs[22].rgb * 0.473087 * (x2 - y2) * (7 * z2 - 1.0);            // L = 4, m = 2
+        result += lambertianSH.coeffs[23].rgb * 1.770131 * x * z * (x2 - 3 * y2);                 // L = 4, m = 3
+        result += lambertianSH.coeffs[24].rgb * 0.625836 * (x2 * (x2 - 3 * y2) - y2 * (3 * x2 - y2)); // L = 4, m = 4
+    }
+
     return max(result, vec3(0.0));
 }
 
 vec3 lambertianReflectedRadiance(vec3 normal) {
-    return evaluateSH(normal, lambertianSH.coeffs);
+    return evaluateSH(normal);
 }
 
 vec3 fresnelSchlick(float cosTheta, vec3 F0) {